@@ -0,0 +1,58 @@
+#include "atomic_file.h"
+#include <atomic>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+// Flush a file (or directory) to stable storage
+bool syncPath(const string& path, int flags) {
+    int fd = ::open(path.c_str(), flags | O_CLOEXEC);
+    if (fd < 0) return false;
+    bool synced = fsync(fd) == 0;
+    close(fd);
+    return synced;
+}
+
+string directoryOf(const string& filename) {
+    size_t slash = filename.find_last_of('/');
+    if (slash == string::npos) return ".";
+    if (slash == 0) return "/";
+    return filename.substr(0, slash);
+}
+
+// Numbers the temporary files of one process, so overlapping saves of the same
+// file (e.g. back-to-back snapshotAsync calls) never share one
+atomic<uint64_t> tempFileCounter(0);
+
+} // namespace
+
+bool writeFileAtomically(const string& filename, const function<bool(ostream&)>& write) {
+    string tempName = filename + ".tmp." + to_string(getpid()) + "." +
+                      to_string(tempFileCounter.fetch_add(1, memory_order_relaxed));
+
+    {
+        ofstream out(tempName, ios::binary | ios::trunc);
+        if (!out.is_open()) return false;
+        bool written = write(out);
+        out.flush();
+        if (!written || out.fail()) {
+            out.close();
+            remove(tempName.c_str());
+            return false;
+        }
+    }
+
+    if (!syncPath(tempName, O_RDONLY) || rename(tempName.c_str(), filename.c_str()) != 0) {
+        remove(tempName.c_str());
+        return false;
+    }
+
+    // Persist the rename itself; the new file is already complete either way
+    syncPath(directoryOf(filename), O_RDONLY | O_DIRECTORY);
+    return true;
+}
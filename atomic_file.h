@@ -0,0 +1,16 @@
+#ifndef ATOMIC_FILE_H
+#define ATOMIC_FILE_H
+
+#include <functional>
+#include <ostream>
+#include <string>
+
+// Replace filename with whatever write() produces, or leave it untouched.
+// The content goes to a temporary file in the same directory, which is flushed,
+// fsync'ed and renamed over filename only if write() returns true; readers
+// (including existing mappings of the old file) never see a half-written filter.
+// Each call gets its own temporary file, so overlapping saves of one file are safe:
+// the last rename wins.
+bool writeFileAtomically(const std::string& filename, const std::function<bool(std::ostream&)>& write);
+
+#endif // ATOMIC_FILE_H
@@ -0,0 +1,223 @@
+#ifndef BASIC_BLOOM_FILTER_H
+#define BASIC_BLOOM_FILTER_H
+
+#include "bit_storage.h"
+#include "bloom_filter.h"
+#include "hash_policy.h"
+#include "latency_profile.h"
+#include "probe_engine.h"
+#include "sharded_counter.h"
+#include "word_ops.h"
+#include <cmath>
+#include <string_view>
+#include <type_traits>
+
+// Bloom filter assembled from compile-time policies:
+//   Storage    BitStorage (single writer) or AtomicBitStorage (lock-free sharing)
+//   HashPolicy Djb2SdbmHash (legacy bit positions) or WyHash
+//   Reduction  ModuloReduction, MaskReduction (power-of-two sizes) or FastRangeReduction
+//   K          probes fixed at compile time, or 0 to take the count at run time
+// Every probe is inlined; there is no kernel table and no virtual call.
+//
+// BasicBloomFilter<BitStorage, Djb2SdbmHash, ModuloReduction, 0> sets exactly the
+// bits BloomFilter does. BloomFilter itself stays a concrete class because it picks
+// the reduction and unrolled K at run time from whatever file it loads.
+template <typename Storage, typename HashPolicy, typename Reduction, unsigned int K = 0>
+class BasicBloomFilter {
+private:
+    static constexpr bool kAtomicStorage = std::is_same<Storage, AtomicBitStorage>::value;
+
+    Storage bitArray;
+    size_t size;
+    unsigned int numHashes;
+
+    // Running set-bit count; sharded when the storage is shared between threads
+    std::conditional_t<kAtomicStorage, ShardedCounter, size_t> setBits{};
+
+    using Engine = ProbeEngine<HashPolicy, Reduction, K>;
+
+    static constexpr bool kNeedsPowerOfTwo = std::is_same<Reduction, MaskReduction>::value;
+
+    void addSetBits(size_t added) {
+        if constexpr (kAtomicStorage) {
+            if (added) setBits.add(added);
+        } else {
+            setBits += added;
+        }
+    }
+
+    void storeSetBits(size_t total) {
+        if constexpr (kAtomicStorage) {
+            setBits.store(total);
+        } else {
+            setBits = total;
+        }
+    }
+
+    // Pull the words a key probes into cache ahead of the set/test pass
+    void prefetch(const HashPair& hp, int forWrite) const {
+        const auto* words = bitArray.data();
+        Engine::forEachIndex(hp, size, numHashes, [words, forWrite](size_t index) {
+            if (forWrite) {
+                __builtin_prefetch(&words[index >> 6], 1);
+            } else {
+                __builtin_prefetch(&words[index >> 6], 0);
+            }
+            return true;
+        });
+    }
+
+    void insertHashed(const HashPair& hp) {
+        size_t added = 0;
+        Engine::forEachIndex(hp, size, numHashes, [this, &added](size_t index) {
+            added += bitArray.set(index);
+            return true;
+        });
+        addSetBits(added);
+    }
+
+    bool containsHashed(const HashPair& hp) const {
+        return Engine::forEachIndex(hp, size, numHashes, [this](size_t index) { return bitArray.test(index); });
+    }
+
+public:
+    using StorageType = Storage;
+    using HashPolicyType = HashPolicy;
+    using ReductionType = Reduction;
+    static constexpr unsigned int kFixedHashes = K;
+
+    // With K != 0 the hash count is K whatever numHashFunctions says; MaskReduction
+    // rounds the size up to a power of two
+    BasicBloomFilter(size_t filterSize, unsigned int numHashFunctions)
+        : bitArray(kNeedsPowerOfTwo ? roundUpToPowerOfTwo(filterSize) : filterSize),
+          size(kNeedsPowerOfTwo ? roundUpToPowerOfTwo(filterSize) : filterSize),
+          numHashes(K ? K : numHashFunctions) {
+    }
+
+    // Same sizing as BloomFilter::createOptimal
+    static BasicBloomFilter createOptimal(size_t expectedItems, double falsePositiveRate) {
+        size_t optimalSize;
+        unsigned int optimalHashes;
+        BloomFilter::computeOptimalParameters(expectedItems, falsePositiveRate, kNeedsPowerOfTwo,
+                                              optimalSize, optimalHashes);
+        return BasicBloomFilter(optimalSize, optimalHashes);
+    }
+
+    void insert(std::string_view element) {
+        BLOOM_PROFILE_SCOPE(ProfiledOp::Insert);
+        insertHashed(HashPolicy::hash(element.data(), element.size()));
+    }
+    void insert(const void* data, size_t len) {
+        BLOOM_PROFILE_SCOPE(ProfiledOp::Insert);
+        insertHashed(HashPolicy::hash(static_cast<const char*>(data), len));
+    }
+    // Hashed as the key's 8 little-endian bytes through the policy's fixed-length path
+    void insert(uint64_t key) {
+        BLOOM_PROFILE_SCOPE(ProfiledOp::Insert);
+        insertHashed(HashPolicy::hashKey(key));
+    }
+
+    bool mightContain(std::string_view element) const {
+        BLOOM_PROFILE_SCOPE(ProfiledOp::Contains);
+        return containsHashed(HashPolicy::hash(element.data(), element.size()));
+    }
+    bool mightContain(const void* data, size_t len) const {
+        BLOOM_PROFILE_SCOPE(ProfiledOp::Contains);
+        return containsHashed(HashPolicy::hash(static_cast<const char*>(data), len));
+    }
+    bool mightContain(uint64_t key) const {
+        BLOOM_PROFILE_SCOPE(ProfiledOp::Contains);
+        return containsHashed(HashPolicy::hashKey(key));
+    }
+
+    // Hash a window of keys, prefetch every target word, then resolve
+    void insertBatch(const std::string_view* elements, size_t count) {
+        BLOOM_PROFILE_SCOPE(ProfiledOp::InsertBatch);
+        size_t added = 0;
+        HashPair hashes[kBatchWindow];
+        for (size_t base = 0; base < count; base += kBatchWindow) {
+            size_t n = count - base < kBatchWindow ? count - base : kBatchWindow;
+            for (size_t j = 0; j < n; j++) {
+                hashes[j] = HashPolicy::hash(elements[base + j].data(), elements[base + j].size());
+                prefetch(hashes[j], 1);
+            }
+            for (size_t j = 0; j < n; j++) {
+                Engine::forEachIndex(hashes[j], size, numHashes, [this, &added](size_t index) {
+                    added += bitArray.set(index);
+                    return true;
+                });
+            }
+        }
+        addSetBits(added);
+    }
+
+    void mightContainBatch(const std::string_view* elements, size_t count, bool* results) const {
+        BLOOM_PROFILE_SCOPE(ProfiledOp::ContainsBatch);
+        HashPair hashes[kBatchWindow];
+        for (size_t base = 0; base < count; base += kBatchWindow) {
+            size_t n = count - base < kBatchWindow ? count - base : kBatchWindow;
+            for (size_t j = 0; j < n; j++) {
+                hashes[j] = HashPolicy::hash(elements[base + j].data(), elements[base + j].size());
+                prefetch(hashes[j], 0);
+            }
+            for (size_t j = 0; j < n; j++) {
+                results[base + j] = Engine::forEachIndex(hashes[j], size, numHashes,
+                                                         [this](size_t index) { return bitArray.test(index); });
+            }
+        }
+    }
+
+    double getCurrentFalsePositiveRate(size_t insertedItems) const {
+        if (insertedItems == 0) return 0.0;
+        double exponent = -1.0 * numHashes * insertedItems / size;
+        return std::pow(1.0 - std::exp(exponent), numHashes);
+    }
+
+    size_t getSize() const { return size; }
+    unsigned int getNumHashes() const { return numHashes; }
+
+    void clear() {
+        bitArray.reset();
+        storeSetBits(0);
+    }
+
+    // OR / AND a filter of the same policies, size and hash count into this one; the
+    // words are combined with the storage's own (plain or atomic) kernels
+    bool unionWith(const BasicBloomFilter& other) {
+        if (size != other.size || numHashes != other.numHashes) return false;
+        orWords(bitArray.data(), other.bitArray.data(), bitArray.numWords());
+        storeSetBits(popcountWords(bitArray.data(), bitArray.numWords()));
+        return true;
+    }
+
+    bool intersectWith(const BasicBloomFilter& other) {
+        if (size != other.size || numHashes != other.numHashes) return false;
+        andWords(bitArray.data(), other.bitArray.data(), bitArray.numWords());
+        storeSetBits(popcountWords(bitArray.data(), bitArray.numWords()));
+        return true;
+    }
+
+    // O(1), from the running count
+    size_t countSetBits() const {
+        if constexpr (kAtomicStorage) {
+            return setBits.load();
+        } else {
+            return setBits;
+        }
+    }
+
+    double getFillRatio() const { return static_cast<double>(countSetBits()) / size; }
+    double getFalsePositiveRateFromFill() const { return std::pow(getFillRatio(), numHashes); }
+
+    // Items held, estimated from the fill (see BloomFilter::estimateCardinality)
+    double estimateCardinality() const { return estimateItemsFromBits(size, numHashes, countSetBits()); }
+
+    // Writes made through storage() are not seen by countSetBits
+    const Storage& storage() const { return bitArray; }
+    Storage& storage() { return bitArray; }
+};
+
+// wyhash with multiply-shift reduction: the "fast" variant, kept in memory only
+using FastBloomFilter = BasicBloomFilter<BitStorage, WyHash, FastRangeReduction>;
+
+#endif // BASIC_BLOOM_FILTER_H
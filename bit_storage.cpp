@@ -0,0 +1,224 @@
+#include "bit_storage.h"
+#include "checksum.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+
+using namespace std;
+
+namespace {
+
+// Words staged per write/read call when streaming
+constexpr size_t kStreamChunkWords = 4096;
+
+// Saved filters are little-endian byte streams; byte-swap words on big-endian hosts
+inline uint64_t toLittleEndian(uint64_t word) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap64(word);
+#else
+    return word;
+#endif
+}
+
+// Clear the unused bits of the last word
+inline uint64_t maskTail(uint64_t word, size_t numBits) {
+    if (numBits % BitStorage::kBitsPerWord == 0) return word;
+    return word & ((uint64_t(1) << (numBits % BitStorage::kBitsPerWord)) - 1);
+}
+
+// Zeroed, cache-line aligned buffer of count words
+void* allocateAlignedWords(size_t count) {
+    if (count == 0) return nullptr;
+    // aligned_alloc requires the byte count to be a multiple of the alignment
+    size_t bytes = count * sizeof(uint64_t);
+    bytes = (bytes + BitStorage::kAlignment - 1) / BitStorage::kAlignment * BitStorage::kAlignment;
+    void* ptr = aligned_alloc(BitStorage::kAlignment, bytes);
+    if (!ptr) throw bad_alloc();
+    memset(ptr, 0, bytes);
+    return ptr;
+}
+
+// Stream `bytes` bytes of the words [first, first + count), fetched through load(i)
+template <typename Load>
+bool streamWordsOut(ostream& out, size_t first, size_t count, size_t bytes, Load load, uint32_t* crc) {
+    uint64_t buffer[kStreamChunkWords];
+    for (size_t w = 0; w < count && bytes > 0; w += kStreamChunkWords) {
+        size_t n = min(kStreamChunkWords, count - w);
+        for (size_t i = 0; i < n; i++) {
+            buffer[i] = toLittleEndian(load(first + w + i));
+        }
+        size_t chunkBytes = min(bytes, n * sizeof(uint64_t));
+        out.write(reinterpret_cast<const char*>(buffer), chunkBytes);
+        if (crc) *crc = crc32c(*crc, buffer, chunkBytes);
+        bytes -= chunkBytes;
+    }
+    return !out.fail();
+}
+
+// Read `bytes` bytes into the words [first, first + count), handing each to store(i, word)
+template <typename Store>
+bool streamWordsIn(istream& in, size_t first, size_t count, size_t wordCount, size_t numBits,
+                   size_t bytes, Store store, uint32_t* crc) {
+    uint64_t buffer[kStreamChunkWords];
+    for (size_t w = 0; w < count; w += kStreamChunkWords) {
+        size_t n = min(kStreamChunkWords, count - w);
+        size_t chunkBytes = min(bytes, n * sizeof(uint64_t));
+        memset(buffer, 0, n * sizeof(uint64_t));
+        in.read(reinterpret_cast<char*>(buffer), chunkBytes);
+        if (in.fail()) return false;
+        if (crc) *crc = crc32c(*crc, buffer, chunkBytes);
+        for (size_t i = 0; i < n; i++) {
+            size_t index = first + w + i;
+            uint64_t word = toLittleEndian(buffer[i]);
+            // Drop any stray bits past the end so word-level operations stay exact
+            if (index == wordCount - 1) word = maskTail(word, numBits);
+            store(index, word);
+        }
+        bytes -= chunkBytes;
+    }
+    return true;
+}
+
+} // namespace
+
+uint64_t* BitStorage::allocateWords(size_t count) {
+    return static_cast<uint64_t*>(allocateAlignedWords(count));
+}
+
+void BitStorage::freeWords(uint64_t* ptr) {
+    free(ptr);
+}
+
+BitStorage::BitStorage(size_t bitCount)
+    : words(nullptr), numBits(bitCount), wordCount((bitCount + kBitsPerWord - 1) / kBitsPerWord) {
+    words = allocateWords(wordCount);
+}
+
+BitStorage::BitStorage(const BitStorage& other)
+    : words(nullptr), numBits(other.numBits), wordCount(other.wordCount) {
+    // Copies always own their words, even when copying a view
+    words = allocateWords(wordCount);
+    if (wordCount) memcpy(words, other.words, wordCount * sizeof(uint64_t));
+}
+
+BitStorage::BitStorage(BitStorage&& other) noexcept
+    : words(other.words), numBits(other.numBits), wordCount(other.wordCount), external(move(other.external)) {
+    other.words = nullptr;
+    other.numBits = 0;
+    other.wordCount = 0;
+}
+
+BitStorage& BitStorage::operator=(const BitStorage& other) {
+    if (this != &other) {
+        BitStorage copy(other);
+        *this = move(copy);
+    }
+    return *this;
+}
+
+BitStorage& BitStorage::operator=(BitStorage&& other) noexcept {
+    if (this != &other) {
+        if (!external) freeWords(words);
+        words = other.words;
+        numBits = other.numBits;
+        wordCount = other.wordCount;
+        external = move(other.external);
+        other.words = nullptr;
+        other.numBits = 0;
+        other.wordCount = 0;
+    }
+    return *this;
+}
+
+BitStorage::~BitStorage() {
+    if (!external) freeWords(words);
+}
+
+BitStorage BitStorage::view(uint64_t* externalWords, size_t bitCount, shared_ptr<void> owner) {
+    BitStorage storage(0);
+    storage.words = externalWords;
+    storage.numBits = bitCount;
+    storage.wordCount = (bitCount + kBitsPerWord - 1) / kBitsPerWord;
+    storage.external = move(owner);
+    return storage;
+}
+
+void BitStorage::reset() {
+    if (wordCount) memset(words, 0, wordCount * sizeof(uint64_t));
+}
+
+bool BitStorage::writePacked(ostream& out) const {
+    return streamWordsOut(out, 0, wordCount, packedBytes(), [this](size_t i) { return words[i]; }, nullptr);
+}
+
+bool BitStorage::readPacked(istream& in) {
+    reset();
+    in.read(reinterpret_cast<char*>(words), packedBytes());
+    if (in.fail()) return false;
+
+    for (size_t i = 0; i < wordCount; i++) {
+        words[i] = toLittleEndian(words[i]);
+    }
+    // Drop any stray bits past the end so word-level operations stay exact
+    if (wordCount) words[wordCount - 1] = maskTail(words[wordCount - 1], numBits);
+    return true;
+}
+
+bool BitStorage::writeWords(ostream& out, size_t firstWord, size_t count, uint32_t* crc) const {
+    return streamWordsOut(out, firstWord, count, count * sizeof(uint64_t),
+                          [this](size_t i) { return words[i]; }, crc);
+}
+
+bool BitStorage::readWords(istream& in, size_t firstWord, size_t count, uint32_t* crc) {
+    return streamWordsIn(in, firstWord, count, wordCount, numBits, count * sizeof(uint64_t),
+                         [this](size_t i, uint64_t word) { words[i] = word; }, crc);
+}
+
+AtomicBitStorage::AtomicBitStorage(size_t bitCount)
+    : words(nullptr), numBits(bitCount), wordCount((bitCount + BitStorage::kBitsPerWord - 1) / BitStorage::kBitsPerWord) {
+    void* memory = allocateAlignedWords(wordCount);
+    words = static_cast<atomic<uint64_t>*>(memory);
+    for (size_t i = 0; i < wordCount; i++) {
+        new (&words[i]) atomic<uint64_t>(0);
+    }
+}
+
+AtomicBitStorage::AtomicBitStorage(void* externalWords, size_t bitCount, shared_ptr<void> owner)
+    : words(static_cast<atomic<uint64_t>*>(externalWords)), numBits(bitCount),
+      wordCount((bitCount + BitStorage::kBitsPerWord - 1) / BitStorage::kBitsPerWord), external(move(owner)) {
+    // atomic<uint64_t> is trivially constructible with the plain word layout, so zeroed
+    // memory already holds zero atomics; not touching the words keeps untouched pages
+    // unfaulted (and placed by whatever policy the owner set)
+}
+
+AtomicBitStorage::~AtomicBitStorage() {
+    if (!external) free(words);
+}
+
+void AtomicBitStorage::reset() {
+    for (size_t i = 0; i < wordCount; i++) {
+        words[i].store(0, memory_order_relaxed);
+    }
+}
+
+bool AtomicBitStorage::writePacked(ostream& out) const {
+    return streamWordsOut(out, 0, wordCount, packedBytes(),
+                          [this](size_t i) { return words[i].load(memory_order_relaxed); }, nullptr);
+}
+
+bool AtomicBitStorage::readPacked(istream& in) {
+    return streamWordsIn(in, 0, wordCount, wordCount, numBits, packedBytes(),
+                         [this](size_t i, uint64_t word) { words[i].store(word, memory_order_relaxed); }, nullptr);
+}
+
+bool AtomicBitStorage::writeWords(ostream& out, size_t firstWord, size_t count, uint32_t* crc) const {
+    return streamWordsOut(out, firstWord, count, count * sizeof(uint64_t),
+                          [this](size_t i) { return words[i].load(memory_order_relaxed); }, crc);
+}
+
+bool AtomicBitStorage::readWords(istream& in, size_t firstWord, size_t count, uint32_t* crc) {
+    return streamWordsIn(in, firstWord, count, wordCount, numBits, count * sizeof(uint64_t),
+                         [this](size_t i, uint64_t word) { words[i].store(word, memory_order_relaxed); }, crc);
+}
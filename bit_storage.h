@@ -0,0 +1,143 @@
+#ifndef BIT_STORAGE_H
+#define BIT_STORAGE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+
+// Word-packed bit array backed by 64-bit words.
+// The word buffer is allocated on a 64-byte (cache line) boundary so probes can be
+// prefetched and handed to SIMD code. Bit i lives in word i / 64 at position i % 64,
+// which on little-endian hosts matches the byte-packed layout used by saved filters.
+class BitStorage {
+private:
+    uint64_t* words;
+    size_t numBits;
+    size_t wordCount;
+    // Set when words point into memory owned elsewhere (e.g. a file mapping)
+    std::shared_ptr<void> external;
+
+    static uint64_t* allocateWords(size_t count);
+    static void freeWords(uint64_t* ptr);
+
+public:
+    static constexpr size_t kAlignment = 64;
+    static constexpr size_t kBitsPerWord = 64;
+
+    explicit BitStorage(size_t bitCount = 0);
+    BitStorage(const BitStorage& other);
+    BitStorage(BitStorage&& other) noexcept;
+    BitStorage& operator=(const BitStorage& other);
+    BitStorage& operator=(BitStorage&& other) noexcept;
+    ~BitStorage();
+
+    // Set a single bit; returns true if it was clear
+    bool set(size_t index) {
+        uint64_t& word = words[index >> 6];
+        uint64_t mask = uint64_t(1) << (index & 63);
+        bool added = !(word & mask);
+        word |= mask;
+        return added;
+    }
+
+    // Test a single bit
+    bool test(size_t index) const {
+        return (words[index >> 6] >> (index & 63)) & 1;
+    }
+
+    // Wrap words owned by someone else (e.g. an mmap'd file) without copying;
+    // owner is kept alive for as long as the storage exists
+    static BitStorage view(uint64_t* externalWords, size_t bitCount, std::shared_ptr<void> owner);
+
+    // True if the words are not owned by this object
+    bool isView() const { return external != nullptr; }
+
+    // Zero every bit
+    void reset();
+
+    // Raw word access
+    uint64_t* data() { return words; }
+    const uint64_t* data() const { return words; }
+    uint64_t word(size_t index) const { return words[index]; }
+    void storeWord(size_t index, uint64_t value) { words[index] = value; }
+
+    size_t size() const { return numBits; }
+    size_t numWords() const { return wordCount; }
+
+    // Number of bytes needed to hold size() bits in byte-packed form
+    size_t packedBytes() const { return (numBits + 7) / 8; }
+
+    // Write the byte-packed bits to a stream
+    bool writePacked(std::ostream& out) const;
+
+    // Read byte-packed bits from a stream directly into the word buffer
+    bool readPacked(std::istream& in);
+
+    // Write/read count words starting at firstWord as little-endian bytes (the versioned
+    // file payload), folding them into a running CRC32C when crc is non-null
+    bool writeWords(std::ostream& out, size_t firstWord, size_t count, uint32_t* crc = nullptr) const;
+    bool readWords(std::istream& in, size_t firstWord, size_t count, uint32_t* crc = nullptr);
+};
+
+// Same layout as BitStorage, but every word is a std::atomic<uint64_t> so any number
+// of threads may set and test bits concurrently without locks. Sets use a relaxed
+// fetch_or: a Bloom filter only ever turns bits on, so no ordering is needed.
+class AtomicBitStorage {
+private:
+    std::atomic<uint64_t>* words;
+    size_t numBits;
+    size_t wordCount;
+    // Set when words live in memory owned elsewhere (e.g. a NUMA-placed region)
+    std::shared_ptr<void> external;
+
+    static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t),
+                  "atomic words must share the plain word layout");
+
+public:
+    explicit AtomicBitStorage(size_t bitCount = 0);
+    // Use zeroed memory owned by someone else, of at least numWords() words; owner is
+    // kept alive for as long as the storage exists
+    AtomicBitStorage(void* externalWords, size_t bitCount, std::shared_ptr<void> owner);
+    AtomicBitStorage(const AtomicBitStorage&) = delete;
+    AtomicBitStorage& operator=(const AtomicBitStorage&) = delete;
+    ~AtomicBitStorage();
+
+    // Set a single bit; returns true if this call changed it from 0 to 1
+    bool set(size_t index) {
+        uint64_t mask = uint64_t(1) << (index & 63);
+        return !(words[index >> 6].fetch_or(mask, std::memory_order_relaxed) & mask);
+    }
+
+    // Test a single bit
+    bool test(size_t index) const {
+        return (words[index >> 6].load(std::memory_order_relaxed) >> (index & 63)) & 1;
+    }
+
+    // Zero every bit (not atomic with respect to concurrent inserts)
+    void reset();
+
+    std::atomic<uint64_t>* data() { return words; }
+    const std::atomic<uint64_t>* data() const { return words; }
+    uint64_t word(size_t index) const { return words[index].load(std::memory_order_relaxed); }
+    void storeWord(size_t index, uint64_t value) { words[index].store(value, std::memory_order_relaxed); }
+    // OR bits into a word; safe against concurrent inserts and readers. Returns the
+    // bits this call turned on.
+    uint64_t orWord(size_t index, uint64_t bits) {
+        return bits & ~words[index].fetch_or(bits, std::memory_order_relaxed);
+    }
+
+    size_t size() const { return numBits; }
+    size_t numWords() const { return wordCount; }
+    size_t packedBytes() const { return (numBits + 7) / 8; }
+
+    // Same encodings as BitStorage
+    bool writePacked(std::ostream& out) const;
+    bool readPacked(std::istream& in);
+    bool writeWords(std::ostream& out, size_t firstWord, size_t count, uint32_t* crc = nullptr) const;
+    bool readWords(std::istream& in, size_t firstWord, size_t count, uint32_t* crc = nullptr);
+};
+
+#endif // BIT_STORAGE_H
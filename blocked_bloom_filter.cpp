@@ -0,0 +1,318 @@
+#include "blocked_bloom_filter.h"
+#include "probe_engine.h"
+#include "atomic_file.h"
+#include "filter_format.h"
+#include "latency_profile.h"
+#include "mapped_file.h"
+#include "word_ops.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+// Keys hashed and prefetched together by the batch paths; 8 keys keep 8 block
+// fetches in flight while staying well inside the line fill buffers
+constexpr size_t kBlockedBatchWindow = 8;
+
+} // namespace
+
+BlockedBloomFilter::BlockedBloomFilter(size_t filterSize, unsigned int numHashFunctions)
+    : bitArray(0), size(0), numBlocks(0), numHashes(numHashFunctions), setBits(0), setBitsCounted(true),
+      containsKernel(bestBlockContainsKernel()) {
+    if (numHashFunctions == 0) {
+        throw invalid_argument("BlockedBloomFilter needs at least one hash function");
+    }
+    numBlocks = (filterSize + kBlockBits - 1) / kBlockBits;
+    if (numBlocks == 0) numBlocks = 1;
+    size = numBlocks * kBlockBits;
+    bitArray = BitStorage(size);
+}
+
+BlockedBloomFilter::BlockedBloomFilter(BitStorage storage, unsigned int numHashFunctions)
+    : bitArray(move(storage)), size(bitArray.size()), numBlocks(bitArray.size() / kBlockBits),
+      numHashes(numHashFunctions), setBits(0), setBitsCounted(false), containsKernel(bestBlockContainsKernel()) {
+}
+
+BlockedBloomFilter BlockedBloomFilter::createOptimal(size_t expectedItems, double falsePositiveRate) {
+    if (!(falsePositiveRate > 0 && falsePositiveRate < 1)) {
+        throw invalid_argument("BlockedBloomFilter needs a false positive rate between 0 and 1");
+    }
+    if (expectedItems == 0) expectedItems = 1;
+
+    // Start from the classic optimum and grow until the blocked FPR meets the target;
+    // blocking typically costs 10-30% extra space at common FPRs
+    double classicSize = ceil(-1.0 * expectedItems * log(falsePositiveRate) / (log(2) * log(2)));
+    size_t candidate = static_cast<size_t>(classicSize);
+    if (candidate < kBlockBits) candidate = kBlockBits;
+
+    while (true) {
+        size_t blocks = (candidate + kBlockBits - 1) / kBlockBits;
+        size_t blockedSize = blocks * kBlockBits;
+
+        unsigned int bestHashes = 1;
+        double bestRate = 1.0;
+        for (unsigned int k = 1; k <= 24; k++) {
+            double rate = blockedFalsePositiveRate(blockedSize, k, expectedItems);
+            if (rate < bestRate) {
+                bestRate = rate;
+                bestHashes = k;
+            }
+        }
+
+        if (bestRate <= falsePositiveRate) {
+            return BlockedBloomFilter(blockedSize, bestHashes);
+        }
+        candidate = blockedSize + blockedSize / 20 + kBlockBits;
+    }
+}
+
+double BlockedBloomFilter::blockedFalsePositiveRate(size_t filterSize, unsigned int numHashes, size_t insertedItems) {
+    if (insertedItems == 0) return 0.0;
+
+    // Keys land in blocks as a Poisson process with mean load lambda; a block holding
+    // i keys behaves like a classic 512-bit filter with i keys (Putze et al.)
+    double blocks = static_cast<double>(filterSize) / kBlockBits;
+    double lambda = insertedItems / blocks;
+    double missPerBit = log(1.0 - 1.0 / kBlockBits);
+
+    size_t limit = static_cast<size_t>(lambda + 12.0 * sqrt(lambda) + 20.0);
+    double rate = 0.0;
+    for (size_t i = 0; i <= limit; i++) {
+        double logPoisson = i * log(lambda) - lambda - lgamma(i + 1.0);
+        double inBlock = pow(1.0 - exp(missPerBit * i * numHashes), numHashes);
+        rate += exp(logPoisson) * inBlock;
+    }
+    return rate > 1.0 ? 1.0 : rate;
+}
+
+void BlockedBloomFilter::locate(const HashPair& hp, size_t& block, uint64_t& probe, uint64_t& step) const {
+    block = FastRangeReduction::reduce(hp.h1, numBlocks);
+    probe = hp.h2;
+    // An odd step visits k distinct positions of the power-of-two block
+    step = (hp.h2 >> 9) | 1;
+}
+
+void BlockedBloomFilter::insertHashed(const HashPair& hp) {
+    size_t block;
+    uint64_t probe, step;
+    locate(hp, block, probe, step);
+    setBits += blockInsertScalar(bitArray.data() + block * kBlockWords, probe, step, numHashes);
+}
+
+void BlockedBloomFilter::recountSetBits() {
+    setBits = popcountWords(bitArray.data(), bitArray.numWords());
+    setBitsCounted = true;
+}
+
+bool BlockedBloomFilter::containsHashed(const HashPair& hp) const {
+    size_t block;
+    uint64_t probe, step;
+    locate(hp, block, probe, step);
+    return containsKernel(bitArray.data() + block * kBlockWords, probe, step, numHashes);
+}
+
+void BlockedBloomFilter::insert(string_view element) {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::Insert);
+    insertHashed(WyHash::hash(element.data(), element.size()));
+}
+
+void BlockedBloomFilter::insert(const void* data, size_t len) {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::Insert);
+    insertHashed(WyHash::hash(static_cast<const char*>(data), len));
+}
+
+void BlockedBloomFilter::insert(uint64_t key) {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::Insert);
+    insertHashed(WyHash::hashKey(key));
+}
+
+bool BlockedBloomFilter::mightContain(string_view element) const {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::Contains);
+    return containsHashed(WyHash::hash(element.data(), element.size()));
+}
+
+bool BlockedBloomFilter::mightContain(const void* data, size_t len) const {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::Contains);
+    return containsHashed(WyHash::hash(static_cast<const char*>(data), len));
+}
+
+bool BlockedBloomFilter::mightContain(uint64_t key) const {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::Contains);
+    return containsHashed(WyHash::hashKey(key));
+}
+
+void BlockedBloomFilter::insertBatch(const string_view* elements, size_t count) {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::InsertBatch);
+    size_t blocks[kBlockedBatchWindow];
+    uint64_t probes[kBlockedBatchWindow], steps[kBlockedBatchWindow];
+    uint64_t* words = bitArray.data();
+
+    for (size_t base = 0; base < count; base += kBlockedBatchWindow) {
+        size_t n = min(kBlockedBatchWindow, count - base);
+        for (size_t j = 0; j < n; j++) {
+            locate(WyHash::hash(elements[base + j].data(), elements[base + j].size()), blocks[j], probes[j], steps[j]);
+            __builtin_prefetch(words + blocks[j] * kBlockWords, 1);
+        }
+        for (size_t j = 0; j < n; j++) {
+            setBits += blockInsertScalar(words + blocks[j] * kBlockWords, probes[j], steps[j], numHashes);
+        }
+    }
+}
+
+void BlockedBloomFilter::mightContainBatch(const string_view* elements, size_t count, bool* results) const {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::ContainsBatch);
+    size_t blocks[kBlockedBatchWindow];
+    uint64_t probes[kBlockedBatchWindow], steps[kBlockedBatchWindow];
+    const uint64_t* words = bitArray.data();
+
+    for (size_t base = 0; base < count; base += kBlockedBatchWindow) {
+        size_t n = min(kBlockedBatchWindow, count - base);
+        for (size_t j = 0; j < n; j++) {
+            locate(WyHash::hash(elements[base + j].data(), elements[base + j].size()), blocks[j], probes[j], steps[j]);
+            __builtin_prefetch(words + blocks[j] * kBlockWords, 0);
+        }
+        for (size_t j = 0; j < n; j++) {
+            results[base + j] = containsKernel(words + blocks[j] * kBlockWords, probes[j], steps[j], numHashes);
+        }
+    }
+}
+
+void BlockedBloomFilter::setSimdLevel(SimdLevel level) {
+    containsKernel = blockContainsKernel(level);
+}
+
+double BlockedBloomFilter::getCurrentFalsePositiveRate(size_t insertedItems) const {
+    return blockedFalsePositiveRate(size, numHashes, insertedItems);
+}
+
+size_t BlockedBloomFilter::getSize() const {
+    return size;
+}
+
+size_t BlockedBloomFilter::getNumBlocks() const {
+    return numBlocks;
+}
+
+unsigned int BlockedBloomFilter::getNumHashes() const {
+    return numHashes;
+}
+
+void BlockedBloomFilter::clear() {
+    bitArray.reset();
+    setBits = 0;
+    setBitsCounted = true;
+}
+
+bool BlockedBloomFilter::unionWith(const BlockedBloomFilter& other) {
+    if (size != other.size || numHashes != other.numHashes) return false;
+    orWords(bitArray.data(), other.bitArray.data(), bitArray.numWords());
+    recountSetBits();
+    return true;
+}
+
+bool BlockedBloomFilter::intersectWith(const BlockedBloomFilter& other) {
+    if (size != other.size || numHashes != other.numHashes) return false;
+    andWords(bitArray.data(), other.bitArray.data(), bitArray.numWords());
+    recountSetBits();
+    return true;
+}
+
+size_t BlockedBloomFilter::countSetBits() const {
+    return setBitsCounted ? setBits : popcountWords(bitArray.data(), bitArray.numWords());
+}
+
+double BlockedBloomFilter::getFillRatio() const {
+    return static_cast<double>(countSetBits()) / size;
+}
+
+double BlockedBloomFilter::getFalsePositiveRateFromFill() const {
+    double items = estimateItemsFromBits(size, numHashes, countSetBits());
+    return blockedFalsePositiveRate(size, numHashes, static_cast<size_t>(llround(items)));
+}
+
+double BlockedBloomFilter::estimateCardinality() const {
+    // Estimate for each possible block fill, so the scan is a popcount and a lookup
+    double itemsAtFill[kBlockBits + 1];
+    for (size_t x = 0; x <= kBlockBits; x++) itemsAtFill[x] = estimateItemsFromBits(kBlockBits, numHashes, x);
+
+    const uint64_t* words = bitArray.data();
+    double total = 0.0;
+    mutex totalLock;
+    // Ranges start on cache lines, which are block boundaries
+    forEachWordRange(bitArray.numWords(), [&](size_t begin, size_t end) {
+        double partial = 0.0;
+        for (size_t w = begin; w < end; w += kBlockWords) {
+            unsigned int fill = 0;
+            for (size_t j = 0; j < kBlockWords; j++) fill += __builtin_popcountll(words[w + j]);
+            partial += itemsAtFill[fill];
+        }
+        lock_guard<mutex> guard(totalLock);
+        total += partial;
+    });
+    return total;
+}
+
+bool BlockedBloomFilter::saveToFile(const string& filename, bool compress) const {
+    return writeFileAtomically(filename, [this, compress](ostream& out) {
+        return writeFilterFile(out, FilterKind::Blocked, WyHash::id, size, numHashes, bitArray, compress);
+    });
+}
+
+namespace {
+
+bool isBlockedHeader(const FilterFileHeader& header) {
+    return header.kind == static_cast<uint32_t>(FilterKind::Blocked) &&
+           header.hashPolicy == static_cast<uint32_t>(WyHash::id) &&
+           header.numHashes > 0 &&
+           header.sizeBits % BlockedBloomFilter::kBlockBits == 0;
+}
+
+} // namespace
+
+BlockedBloomFilter* BlockedBloomFilter::loadFromFile(const string& filename) {
+    ifstream inFile(filename, ios::binary);
+
+    if (!inFile.is_open()) {
+        return nullptr;
+    }
+
+    FilterFileHeader header;
+    if (!readFilterHeader(inFile, header) || !isBlockedHeader(header)) {
+        return nullptr;
+    }
+
+    BlockedBloomFilter* loadedFilter = new BlockedBloomFilter(header.sizeBits, header.numHashes);
+    if (!readFilterPayload(inFile, header, loadedFilter->bitArray)) {
+        delete loadedFilter;
+        return nullptr;
+    }
+    loadedFilter->recountSetBits();
+    return loadedFilter;
+}
+
+BlockedBloomFilter* BlockedBloomFilter::openMapped(const string& filename, bool verifyChecksum) {
+    shared_ptr<MappedFile> mapping = MappedFile::open(filename);
+    if (!mapping || mapping->size() < kFilterHeaderBytes) {
+        return nullptr;
+    }
+
+    FilterFileHeader header;
+    memcpy(&header, mapping->data(), sizeof(header));
+    if (!validateFilterHeader(header) || !isBlockedHeader(header)) {
+        return nullptr;
+    }
+    if (!validateMappedRecord(mapping->data(), mapping->size(), header, verifyChecksum)) {
+        return nullptr;
+    }
+
+    unsigned char* payload = mapping->mutableData() + kFilterHeaderBytes;
+
+    BitStorage storage = BitStorage::view(reinterpret_cast<uint64_t*>(payload), header.sizeBits, mapping);
+    return new BlockedBloomFilter(move(storage), header.numHashes);
+}
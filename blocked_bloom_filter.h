@@ -0,0 +1,115 @@
+#ifndef BLOCKED_BLOOM_FILTER_H
+#define BLOCKED_BLOOM_FILTER_H
+
+#include "bit_storage.h"
+#include "blocked_kernels.h"
+#include "hash_policy.h"
+#include <string>
+#include <string_view>
+
+// Cache-line-blocked Bloom filter.
+// The first hash selects one 512-bit block and all k bits of a key are set inside
+// that block, so a lookup touches exactly one cache line. The price is a slightly
+// higher false positive rate than a classic filter of the same size.
+class BlockedBloomFilter {
+private:
+    BitStorage bitArray;
+    size_t size;
+    size_t numBlocks;
+    unsigned int numHashes;
+
+    // Bits set, kept up to date by every insert; mapped filters count on demand
+    size_t setBits;
+    bool setBitsCounted;
+
+    // In-block test, picked from the CPU's SIMD level
+    BlockContainsKernel containsKernel;
+
+    // Map a key's hash to a block index and an in-block probe sequence
+    void locate(const HashPair& hp, size_t& block, uint64_t& probe, uint64_t& step) const;
+
+    void insertHashed(const HashPair& hp);
+    void recountSetBits();
+    bool containsHashed(const HashPair& hp) const;
+
+    // Adopt existing storage whose size is a whole number of blocks
+    BlockedBloomFilter(BitStorage storage, unsigned int numHashFunctions);
+
+public:
+    static constexpr size_t kBlockBits = 512;
+    static constexpr size_t kBlockWords = kBlockBits / 64;
+
+    // Constructor with specified size (rounded up to whole blocks) and number of hash functions
+    BlockedBloomFilter(size_t filterSize, unsigned int numHashFunctions);
+
+    // Sizing helper: smallest blocked filter whose blocked FPR meets the target.
+    // Throws std::invalid_argument unless 0 < falsePositiveRate < 1.
+    static BlockedBloomFilter createOptimal(size_t expectedItems, double falsePositiveRate);
+
+    // False positive rate of a blocked filter with the given geometry
+    static double blockedFalsePositiveRate(size_t filterSize, unsigned int numHashes, size_t insertedItems);
+
+    // Insert an element into the filter. Raw bytes hash like the string_view of the
+    // same bytes; integer keys like their 8 little-endian bytes, via WyHash's fixed-length path.
+    void insert(std::string_view element);
+    void insert(const void* data, size_t len);
+    void insert(uint64_t key);
+
+    // Check if an element might be in the set
+    bool mightContain(std::string_view element) const;
+    bool mightContain(const void* data, size_t len) const;
+    bool mightContain(uint64_t key) const;
+
+    // Insert many elements, prefetching their blocks a window at a time
+    void insertBatch(const std::string_view* elements, size_t count);
+
+    // Check many elements at once; results[i] is set for elements[i]
+    void mightContainBatch(const std::string_view* elements, size_t count, bool* results) const;
+
+    // Force a specific kernel (scalar, AVX2, AVX-512); unsupported levels fall back
+    void setSimdLevel(SimdLevel level);
+
+    // Get current false positive probability based on items inserted
+    double getCurrentFalsePositiveRate(size_t insertedItems) const;
+
+    // Get size of the bit array
+    size_t getSize() const;
+
+    // Get number of 512-bit blocks
+    size_t getNumBlocks() const;
+
+    // Get number of hash functions
+    unsigned int getNumHashes() const;
+
+    // Reset the filter
+    void clear();
+
+    // OR / AND another blocked filter of the same size and hash count into this one;
+    // false on a mismatch (see BloomFilter::intersectWith for what an AND means)
+    bool unionWith(const BlockedBloomFilter& other);
+    bool intersectWith(const BlockedBloomFilter& other);
+
+    // Number of bits set (O(1), from the running count) and the fraction of bits set
+    size_t countSetBits() const;
+    double getFillRatio() const;
+
+    // False positive rate implied by the measured fill; the block model evaluated at
+    // the item count the fill implies
+    double getFalsePositiveRateFromFill() const;
+
+    // Items the filter holds, estimated block by block: each key lands in one block,
+    // so the per-block Swamidass-Baldi estimates are summed
+    double estimateCardinality() const;
+
+    // Save filter state to a file in the versioned format; with compress, a compressed
+    // snapshot is written when it is smaller (loadable, but not mappable)
+    bool saveToFile(const std::string& filename, bool compress = false) const;
+
+    // Load filter state from a file
+    static BlockedBloomFilter* loadFromFile(const std::string& filename);
+
+    // Map a versioned filter file and query it in place (see BloomFilter::openMapped)
+    static BlockedBloomFilter* openMapped(const std::string& filename, bool verifyChecksum = false);
+};
+
+#endif // BLOCKED_BLOOM_FILTER_H
@@ -0,0 +1,132 @@
+#include "blocked_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BLOOM_X86 1
+#endif
+
+namespace {
+
+constexpr uint32_t kBlockMask = 511;
+
+#ifdef BLOOM_X86
+
+__attribute__((target("avx2")))
+bool blockContainsAvx2(const uint64_t* block, uint64_t probe, uint64_t step, unsigned int k) {
+    const int* words = reinterpret_cast<const int*>(block);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i blockMask = _mm256_set1_epi32(kBlockMask);
+    const __m256i ones = _mm256_set1_epi32(1);
+    // Positions only depend on the low 9 bits, so 32-bit lane arithmetic is exact
+    const __m256i stride = _mm256_set1_epi32(static_cast<int>(step * 8));
+    __m256i pos = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(probe)),
+                                   _mm256_mullo_epi32(lanes, _mm256_set1_epi32(static_cast<int>(step))));
+
+    for (unsigned int i = 0; i < k; i += 8) {
+        __m256i bitPos = _mm256_and_si256(pos, blockMask);
+        __m256i wordIndex = _mm256_srli_epi32(bitPos, 5);
+        __m256i bitMask = _mm256_sllv_epi32(ones, _mm256_and_si256(bitPos, _mm256_set1_epi32(31)));
+        if (k - i < 8) {
+            // Lanes past k test nothing
+            __m256i live = _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(k - i)), lanes);
+            bitMask = _mm256_and_si256(bitMask, live);
+        }
+        __m256i gathered = _mm256_i32gather_epi32(words, wordIndex, 4);
+        if (!_mm256_testc_si256(gathered, bitMask)) return false;
+        pos = _mm256_add_epi32(pos, stride);
+    }
+    return true;
+}
+
+// GCC 12 reports the _mm512_undefined_epi32() inside the avx512fintrin.h intrinsics
+// as maybe-uninitialized; it is undefined by design and every lane used is written
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+__attribute__((target("avx512f")))
+bool blockContainsAvx512(const uint64_t* block, uint64_t probe, uint64_t step, unsigned int k) {
+    const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m512i blockMask = _mm512_set1_epi32(kBlockMask);
+    const __m512i ones = _mm512_set1_epi32(1);
+    const __m512i stride = _mm512_set1_epi32(static_cast<int>(step * 16));
+    __m512i pos = _mm512_add_epi32(_mm512_set1_epi32(static_cast<int>(probe)),
+                                   _mm512_mullo_epi32(lanes, _mm512_set1_epi32(static_cast<int>(step))));
+
+    for (unsigned int i = 0; i < k; i += 16) {
+        __mmask16 live = k - i >= 16 ? __mmask16(0xFFFF) : __mmask16((1u << (k - i)) - 1);
+        __m512i bitPos = _mm512_and_si512(pos, blockMask);
+        __m512i wordIndex = _mm512_srli_epi32(bitPos, 5);
+        __m512i bitMask = _mm512_maskz_sllv_epi32(live, ones, _mm512_and_si512(bitPos, _mm512_set1_epi32(31)));
+        __m512i gathered = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), live, wordIndex, block, 4);
+        // Any requested bit missing from the gathered words means "not present"
+        __m512i missing = _mm512_andnot_si512(gathered, bitMask);
+        if (_mm512_test_epi32_mask(missing, missing)) return false;
+        pos = _mm512_add_epi32(pos, stride);
+    }
+    return true;
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif // BLOOM_X86
+
+} // namespace
+
+bool blockContainsScalar(const uint64_t* block, uint64_t probe, uint64_t step, unsigned int k) {
+    for (unsigned int i = 0; i < k; i++) {
+        unsigned int bit = probe & kBlockMask;
+        if (!((block[bit >> 6] >> (bit & 63)) & 1)) return false;
+        probe += step;
+    }
+    return true;
+}
+
+unsigned int blockInsertScalar(uint64_t* block, uint64_t probe, uint64_t step, unsigned int k) {
+    unsigned int added = 0;
+    for (unsigned int i = 0; i < k; i++) {
+        unsigned int bit = probe & kBlockMask;
+        uint64_t mask = uint64_t(1) << (bit & 63);
+        added += !(block[bit >> 6] & mask);
+        block[bit >> 6] |= mask;
+        probe += step;
+    }
+    return added;
+}
+
+SimdLevel detectSimdLevel() {
+#ifdef BLOOM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SimdLevel::Avx512;
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::Avx2;
+#endif
+    return SimdLevel::Scalar;
+}
+
+const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::Avx512: return "AVX-512";
+        case SimdLevel::Avx2: return "AVX2";
+        default: return "scalar";
+    }
+}
+
+BlockContainsKernel blockContainsKernel(SimdLevel level) {
+    SimdLevel supported = detectSimdLevel();
+#ifdef BLOOM_X86
+    if (level == SimdLevel::Avx512 && supported == SimdLevel::Avx512) return &blockContainsAvx512;
+    if (level != SimdLevel::Scalar && supported != SimdLevel::Scalar) return &blockContainsAvx2;
+#else
+    (void)level;
+    (void)supported;
+#endif
+    return &blockContainsScalar;
+}
+
+BlockContainsKernel bestBlockContainsKernel() {
+    static const BlockContainsKernel kernel = blockContainsKernel(detectSimdLevel());
+    return kernel;
+}
@@ -0,0 +1,39 @@
+#ifndef BLOCKED_KERNELS_H
+#define BLOCKED_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Probe kernels for one 512-bit block of a BlockedBloomFilter.
+// The k bit positions of a key are (probe + i * step) mod 512, i = 0..k-1. The
+// vector kernels compute those positions in the lanes of one register, gather the
+// 32-bit block words they fall in and test every bit with a single compare.
+// The implementation is chosen once at runtime from cpuid, so one binary runs on
+// machines with and without AVX2/AVX-512.
+
+using BlockContainsKernel = bool (*)(const uint64_t* block, uint64_t probe, uint64_t step, unsigned int k);
+
+enum class SimdLevel {
+    Scalar,
+    Avx2,
+    Avx512
+};
+
+// Highest instruction set supported by this CPU
+SimdLevel detectSimdLevel();
+
+// Human-readable name of a level, for stats output
+const char* simdLevelName(SimdLevel level);
+
+// Kernel for a specific level (falls back to scalar when the level is unsupported)
+BlockContainsKernel blockContainsKernel(SimdLevel level);
+
+// Best kernel for this CPU; resolved once on first use
+BlockContainsKernel bestBlockContainsKernel();
+
+// Scalar reference kernels
+bool blockContainsScalar(const uint64_t* block, uint64_t probe, uint64_t step, unsigned int k);
+// Returns how many of the k bits were clear before
+unsigned int blockInsertScalar(uint64_t* block, uint64_t probe, uint64_t step, unsigned int k);
+
+#endif // BLOCKED_KERNELS_H
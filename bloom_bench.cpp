@@ -0,0 +1,475 @@
+// Microbenchmark suite for the filter variants, built on Google Benchmark.
+//
+// Build from the repository root by compiling bloom_bench.cpp with the filter sources
+// it uses (bloom_filter, bit_storage, concurrent_bloom_filter, blocked_bloom_filter,
+// blocked_kernels, checksum, filter_format, filter_delta, mapped_file, atomic_file,
+// word_ops, latency_profile) and linking -lbenchmark -pthread, at -O2 or higher. Add
+// -DBLOOM_ENABLE_PROFILING to measure what the latency profiler costs.
+//
+// Run with --benchmark_format=json (or --benchmark_out=results.json) to keep results
+// for regression checks, and --benchmark_filter=<regex> to pick a subset.
+//
+// Arguments, in order: log2 of the filter size in bits, hash count k, key length in
+// bytes, and (lookups only) the percentage of queries that hit an inserted key. Sizes
+// sweep from L1-resident (2^15 bits = 4 KiB) to DRAM-resident (2^30 bits = 128 MiB);
+// a size is 2^n bits plus one word so the general modulo path is measured, and the
+// <BloomFilter, true> benchmarks use exact powers of two (mask reduction) to compare.
+//
+// Lookup filters are filled to their design load (half the bits set) before timing,
+// so misses exit after as many probes as they would in production. Filter construction
+// (except in BM_SmallFilter, which measures it) and key generation are never inside
+// the timed loop, and every lookup result is consumed. Counters:
+//   time/op         time per key (per key of a batch for the Batch benchmarks)
+//   items_per_second keys per second, summed over threads
+//   hit_rate        fraction of queries reported present (hits plus false positives)
+//   llc_misses/op, l1d_misses/op
+//                   hardware cache misses per key, when perf_event_open is permitted
+
+#include "basic_bloom_filter.h"
+#include "blocked_bloom_filter.h"
+#include "bloom_filter.h"
+#include "concurrent_bloom_filter.h"
+#include "fixed_bloom_filter.h"
+#include <benchmark/benchmark.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+// Distinct keys per pool; queries cycle through them
+constexpr size_t kPoolKeys = 1 << 16;
+
+// Keys per insertBatch / mightContainBatch call
+constexpr size_t kBatchKeys = 1024;
+
+// Hardware cache-miss counters for the calling thread. Unavailable (and silently
+// skipped) where the kernel or container does not expose a PMU.
+class CacheMissCounters {
+private:
+    int llcFd;
+    int l1dFd;
+
+    static int open(uint32_t type, uint64_t config) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = type;
+        attr.size = sizeof(attr);
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    static uint64_t read(int fd) {
+        uint64_t value = 0;
+        if (fd < 0 || ::read(fd, &value, sizeof(value)) != sizeof(value)) return 0;
+        return value;
+    }
+
+    static void control(int fd, unsigned long request) {
+        if (fd >= 0) ioctl(fd, request, 0);
+    }
+
+public:
+    CacheMissCounters()
+        : llcFd(open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES)),
+          l1dFd(open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))) {
+    }
+
+    ~CacheMissCounters() {
+        if (llcFd >= 0) close(llcFd);
+        if (l1dFd >= 0) close(l1dFd);
+    }
+
+    CacheMissCounters(const CacheMissCounters&) = delete;
+    CacheMissCounters& operator=(const CacheMissCounters&) = delete;
+
+    void start() {
+        for (int fd : {llcFd, l1dFd}) {
+            control(fd, PERF_EVENT_IOC_RESET);
+            control(fd, PERF_EVENT_IOC_ENABLE);
+        }
+    }
+
+    // Stop counting and add per-key counters to state
+    void report(benchmark::State& state, double keys) {
+        for (int fd : {llcFd, l1dFd}) control(fd, PERF_EVENT_IOC_DISABLE);
+        if (keys <= 0) return;
+        if (llcFd >= 0) {
+            state.counters["llc_misses/op"] = benchmark::Counter(read(llcFd) / keys, benchmark::Counter::kAvgThreads);
+        }
+        if (l1dFd >= 0) {
+            state.counters["l1d_misses/op"] = benchmark::Counter(read(l1dFd) / keys, benchmark::Counter::kAvgThreads);
+        }
+    }
+};
+
+// Filter size for a benchmark argument: 2^n bits, plus one word unless pow2
+size_t filterBits(int64_t log2Bits, bool pow2) {
+    size_t bits = size_t(1) << log2Bits;
+    return pow2 ? bits : bits + 64;
+}
+
+// Deterministic key of exactly length bytes; the tag keeps the pools disjoint
+string makeKey(char tag, size_t index, size_t length) {
+    string key(1, tag);
+    key += to_string(index);
+    mt19937_64 gen(index * 0x9e3779b97f4a7c15ULL + static_cast<unsigned char>(tag));
+    while (key.size() < length) key.push_back(static_cast<char>('a' + gen() % 26));
+    key.resize(length);
+    return key;
+}
+
+// Keys a filter is built from ("inserted") and keys it never saw ("absent")
+struct KeyPools {
+    vector<string> inserted;
+    vector<string> absent;
+};
+
+const KeyPools& keyPools(size_t length) {
+    static mutex lock;
+    static vector<unique_ptr<KeyPools>> byLength;
+    lock_guard<mutex> guard(lock);
+    if (byLength.size() <= length) byLength.resize(length + 1);
+    if (!byLength[length]) {
+        // The leading tag differs, so the pools never share a key
+        unique_ptr<KeyPools> pools(new KeyPools());
+        for (size_t i = 0; i < kPoolKeys; i++) {
+            pools->inserted.push_back(makeKey('i', i, length));
+            pools->absent.push_back(makeKey('a', i, length));
+        }
+        byLength[length] = move(pools);
+    }
+    return *byLength[length];
+}
+
+// Items a filter holds at its design load, where half of its bits are set: n = m ln 2 / k
+size_t designItems(size_t bits, unsigned int numHashes) {
+    return static_cast<size_t>(bits * log(2.0) / max(1u, numHashes));
+}
+
+// Inserted-pool keys a loaded filter holds; small filters take only a prefix of the pool
+size_t insertedKeys(size_t bits, unsigned int numHashes) {
+    return max<size_t>(1, min(kPoolKeys, designItems(bits, numHashes)));
+}
+
+// hitPercent% of queries from the first inserted keys of the pool, the rest from the
+// absent pool, shuffled
+vector<string_view> makeQueries(const KeyPools& pools, int64_t hitPercent, size_t inserted) {
+    vector<string_view> queries;
+    queries.reserve(kPoolKeys);
+    mt19937_64 gen(static_cast<uint64_t>(hitPercent) + 1);
+    uniform_int_distribution<int64_t> percent(0, 99);
+    for (size_t i = 0; i < kPoolKeys; i++) {
+        queries.push_back(percent(gen) < hitPercent ? pools.inserted[i % inserted] : pools.absent[i]);
+    }
+    shuffle(queries.begin(), queries.end(), gen);
+    return queries;
+}
+
+// A filter holding insertedKeys() pool keys, topped up with integer keys to its design
+// load. Built once per geometry and key
+// length and reused by every benchmark (and thread) that asks for the same one; only
+// the most recent is kept so large sweeps do not hold every size at once.
+template <typename F>
+F& loadedFilter(size_t bits, unsigned int numHashes, size_t keyLength) {
+    static mutex lock;
+    static unique_ptr<F> filter;
+    static size_t cachedBits = 0;
+    static unsigned int cachedHashes = 0;
+    static size_t cachedLength = 0;
+
+    lock_guard<mutex> guard(lock);
+    if (!filter || cachedBits != bits || cachedHashes != numHashes || cachedLength != keyLength) {
+        filter.reset();
+        filter.reset(new F(bits, numHashes));
+        const vector<string>& keys = keyPools(keyLength).inserted;
+        size_t inserted = insertedKeys(bits, numHashes);
+        for (size_t i = 0; i < inserted; i++) filter->insert(keys[i]);
+        size_t total = designItems(bits, numHashes);
+        for (uint64_t i = inserted; i < total; i++) filter->insert(i | (uint64_t(1) << 63));
+        cachedBits = bits;
+        cachedHashes = numHashes;
+        cachedLength = keyLength;
+    }
+    return *filter;
+}
+
+// The loaded filter for a lookup benchmark's arguments, and its shuffled queries
+template <typename F>
+F& lookupTarget(const benchmark::State& state, bool pow2, vector<string_view>& queries) {
+    size_t bits = filterBits(state.range(0), pow2);
+    unsigned int numHashes = static_cast<unsigned int>(state.range(1));
+    size_t keyLength = static_cast<size_t>(state.range(2));
+    F& filter = loadedFilter<F>(bits, numHashes, keyLength);
+    queries = makeQueries(keyPools(keyLength), state.range(3), insertedKeys(bits, numHashes));
+    return filter;
+}
+
+void reportRates(benchmark::State& state, double keys, double positives) {
+    state.SetItemsProcessed(static_cast<int64_t>(keys));
+    state.counters["time/op"] = benchmark::Counter(keys, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+    if (positives >= 0 && keys > 0) {
+        state.counters["hit_rate"] = benchmark::Counter(positives / keys, benchmark::Counter::kAvgThreads);
+    }
+}
+
+// Args: log2 bits, k, key length
+template <typename F, bool Pow2 = false>
+void BM_Insert(benchmark::State& state) {
+    size_t bits = filterBits(state.range(0), Pow2);
+    unsigned int numHashes = static_cast<unsigned int>(state.range(1));
+    const vector<string>& keys = keyPools(static_cast<size_t>(state.range(2))).inserted;
+    vector<string_view> views(keys.begin(), keys.end());
+    F filter(bits, numHashes);
+
+    CacheMissCounters counters;
+    size_t i = 0;
+    counters.start();
+    for (auto _ : state) {
+        filter.insert(views[i]);
+        i = (i + 1) & (kPoolKeys - 1);
+    }
+    double keysDone = static_cast<double>(state.iterations());
+    counters.report(state, keysDone);
+    reportRates(state, keysDone, -1);
+}
+
+template <typename F, bool Pow2 = false>
+void BM_InsertBatch(benchmark::State& state) {
+    size_t bits = filterBits(state.range(0), Pow2);
+    unsigned int numHashes = static_cast<unsigned int>(state.range(1));
+    const vector<string>& keys = keyPools(static_cast<size_t>(state.range(2))).inserted;
+    vector<string_view> views(keys.begin(), keys.end());
+    F filter(bits, numHashes);
+
+    CacheMissCounters counters;
+    size_t base = 0;
+    counters.start();
+    for (auto _ : state) {
+        filter.insertBatch(views.data() + base, kBatchKeys);
+        base = (base + kBatchKeys) & (kPoolKeys - 1);
+    }
+    double keysDone = static_cast<double>(state.iterations()) * kBatchKeys;
+    counters.report(state, keysDone);
+    reportRates(state, keysDone, -1);
+}
+
+// Args: log2 bits, k, key length, hit percentage
+template <typename F, bool Pow2 = false>
+void BM_Lookup(benchmark::State& state) {
+    vector<string_view> queries;
+    const F& filter = lookupTarget<F>(state, Pow2, queries);
+
+    CacheMissCounters counters;
+    size_t i = 0;
+    size_t positives = 0;
+    counters.start();
+    for (auto _ : state) {
+        bool present = filter.mightContain(queries[i]);
+        benchmark::DoNotOptimize(present);
+        positives += present;
+        i = (i + 1) & (kPoolKeys - 1);
+    }
+    double keysDone = static_cast<double>(state.iterations());
+    counters.report(state, keysDone);
+    reportRates(state, keysDone, static_cast<double>(positives));
+}
+
+template <typename F, bool Pow2 = false>
+void BM_LookupBatch(benchmark::State& state) {
+    vector<string_view> queries;
+    const F& filter = lookupTarget<F>(state, Pow2, queries);
+    unique_ptr<bool[]> results(new bool[kBatchKeys]);
+
+    CacheMissCounters counters;
+    size_t base = 0;
+    size_t positives = 0;
+    counters.start();
+    for (auto _ : state) {
+        filter.mightContainBatch(queries.data() + base, kBatchKeys, results.get());
+        benchmark::DoNotOptimize(results.get());
+        benchmark::ClobberMemory();
+        positives += count(results.get(), results.get() + kBatchKeys, true);
+        base = (base + kBatchKeys) & (kPoolKeys - 1);
+    }
+    double keysDone = static_cast<double>(state.iterations()) * kBatchKeys;
+    counters.report(state, keysDone);
+    reportRates(state, keysDone, static_cast<double>(positives));
+}
+
+// Every thread inserts into one shared lock-free filter. Args: log2 bits, k, key length
+void BM_ConcurrentInsert(benchmark::State& state) {
+    // Re-inserting the keys the shared filter already holds keeps it at design load for
+    // the lookup benchmarks that reuse it; the atomic read-modify-writes are the same
+    size_t bits = filterBits(state.range(0), false);
+    unsigned int numHashes = static_cast<unsigned int>(state.range(1));
+    size_t keyLength = static_cast<size_t>(state.range(2));
+    ConcurrentBloomFilter& filter = loadedFilter<ConcurrentBloomFilter>(bits, numHashes, keyLength);
+    const vector<string>& keys = keyPools(keyLength).inserted;
+    size_t inserted = insertedKeys(bits, numHashes);
+    vector<string_view> views(keys.begin(), keys.begin() + inserted);
+
+    // Threads walk the keys from different offsets so they do not write the same words in lockstep
+    CacheMissCounters counters;
+    size_t i = (static_cast<size_t>(state.thread_index()) * 7919) % inserted;
+    counters.start();
+    for (auto _ : state) {
+        filter.insert(views[i]);
+        if (++i == inserted) i = 0;
+    }
+    double keysDone = static_cast<double>(state.iterations());
+    counters.report(state, keysDone);
+    reportRates(state, keysDone, -1);
+}
+
+// Every thread queries one shared filter. Args: log2 bits, k, key length, hit percentage
+void BM_ConcurrentLookup(benchmark::State& state) {
+    vector<string_view> queries;
+    const ConcurrentBloomFilter& filter = lookupTarget<ConcurrentBloomFilter>(state, false, queries);
+
+    CacheMissCounters counters;
+    size_t i = (static_cast<size_t>(state.thread_index()) * 7919) & (kPoolKeys - 1);
+    size_t positives = 0;
+    counters.start();
+    for (auto _ : state) {
+        bool present = filter.mightContain(queries[i]);
+        benchmark::DoNotOptimize(present);
+        positives += present;
+        i = (i + 1) & (kPoolKeys - 1);
+    }
+    double keysDone = static_cast<double>(state.iterations());
+    counters.report(state, keysDone);
+    reportRates(state, keysDone, static_cast<double>(positives));
+}
+
+// Keys in a per-request filter, and its false positive rate in ppm
+constexpr size_t kSmallFilterKeys = 256;
+constexpr uint32_t kSmallFilterPpm = 10000;
+
+// A throwaway filter per request: build one for kSmallFilterKeys keys, insert them and
+// query each once. Times construction as well, which is what dominates at this size.
+// Args: key length
+template <bool Fixed>
+void BM_SmallFilter(benchmark::State& state) {
+    const vector<string>& keys = keyPools(static_cast<size_t>(state.range(0))).inserted;
+    vector<string_view> views(keys.begin(), keys.end());
+
+    size_t base = 0;
+    size_t positives = 0;
+    for (auto _ : state) {
+        const string_view* batch = views.data() + base;
+        if constexpr (Fixed) {
+            StaticBloomFilter<kSmallFilterKeys, kSmallFilterPpm> filter;
+            for (size_t i = 0; i < kSmallFilterKeys; i++) filter.insert(batch[i]);
+            for (size_t i = 0; i < kSmallFilterKeys; i++) positives += filter.mightContain(batch[i ^ 1]);
+            benchmark::DoNotOptimize(filter);
+        } else {
+            BloomFilter filter = BloomFilter::createOptimal(kSmallFilterKeys, kSmallFilterPpm / 1e6);
+            for (size_t i = 0; i < kSmallFilterKeys; i++) filter.insert(batch[i]);
+            for (size_t i = 0; i < kSmallFilterKeys; i++) positives += filter.mightContain(batch[i ^ 1]);
+            benchmark::DoNotOptimize(filter);
+        }
+        base = (base + kSmallFilterKeys) & (kPoolKeys - 1);
+    }
+    double keysDone = static_cast<double>(state.iterations()) * kSmallFilterKeys;
+    reportRates(state, keysDone, static_cast<double>(positives));
+}
+
+// 4 KiB (L1) to 128 MiB (DRAM on most hosts)
+const vector<int64_t> kLog2Sizes = {15, 18, 21, 24, 27, 30};
+const vector<int64_t> kHashCounts = {3, 7, 12};
+const vector<int64_t> kKeyLengths = {8, 16, 64, 256};
+const vector<int64_t> kHitPercents = {0, 50, 100};
+
+// Default point the single-dimension sweeps vary around
+constexpr int64_t kDefaultLog2Size = 24;
+constexpr int64_t kDefaultHashes = 7;
+constexpr int64_t kDefaultKeyLength = 16;
+constexpr int64_t kDefaultHitPercent = 50;
+
+// Size x k at the default key length, then key length alone
+void insertSweep(benchmark::internal::Benchmark* b) {
+    b->ArgNames({"log2bits", "k", "keylen"});
+    for (int64_t log2Size : kLog2Sizes) {
+        for (int64_t k : kHashCounts) b->Args({log2Size, k, kDefaultKeyLength});
+    }
+    for (int64_t length : kKeyLengths) {
+        if (length != kDefaultKeyLength) b->Args({kDefaultLog2Size, kDefaultHashes, length});
+    }
+}
+
+// Size x k at the default key length and hit ratio, then key length and hit ratio alone
+void lookupSweep(benchmark::internal::Benchmark* b) {
+    b->ArgNames({"log2bits", "k", "keylen", "hit%"});
+    for (int64_t log2Size : kLog2Sizes) {
+        for (int64_t k : kHashCounts) b->Args({log2Size, k, kDefaultKeyLength, kDefaultHitPercent});
+    }
+    for (int64_t length : kKeyLengths) {
+        if (length != kDefaultKeyLength) b->Args({kDefaultLog2Size, kDefaultHashes, length, kDefaultHitPercent});
+    }
+    for (int64_t hit : kHitPercents) {
+        if (hit != kDefaultHitPercent) b->Args({kDefaultLog2Size, kDefaultHashes, kDefaultKeyLength, hit});
+    }
+}
+
+// Size alone at the defaults, for the variants compared against the standard filter
+void sizeSweep(benchmark::internal::Benchmark* b) {
+    b->ArgNames({"log2bits", "k", "keylen", "hit%"});
+    for (int64_t log2Size : kLog2Sizes) b->Args({log2Size, kDefaultHashes, kDefaultKeyLength, kDefaultHitPercent});
+}
+
+int maxThreads() {
+    return static_cast<int>(max(1u, thread::hardware_concurrency()));
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(BM_Insert, BloomFilter)->Apply(insertSweep);
+BENCHMARK_TEMPLATE(BM_InsertBatch, BloomFilter)->Apply(insertSweep);
+BENCHMARK_TEMPLATE(BM_Lookup, BloomFilter)->Apply(lookupSweep);
+BENCHMARK_TEMPLATE(BM_LookupBatch, BloomFilter)->Apply(lookupSweep);
+
+// Mask reduction instead of modulo
+BENCHMARK_TEMPLATE(BM_Lookup, BloomFilter, true)->Apply(sizeSweep);
+BENCHMARK_TEMPLATE(BM_LookupBatch, BloomFilter, true)->Apply(sizeSweep);
+
+BENCHMARK_TEMPLATE(BM_Lookup, BlockedBloomFilter)->Apply(sizeSweep);
+BENCHMARK_TEMPLATE(BM_LookupBatch, BlockedBloomFilter)->Apply(sizeSweep);
+BENCHMARK_TEMPLATE(BM_Lookup, FastBloomFilter)->Apply(sizeSweep);
+BENCHMARK_TEMPLATE(BM_LookupBatch, FastBloomFilter)->Apply(sizeSweep);
+
+// Per-request filters: heap-allocated runtime geometry vs StaticBloomFilter
+BENCHMARK_TEMPLATE(BM_SmallFilter, false)->ArgName("keylen")->Arg(kDefaultKeyLength);
+BENCHMARK_TEMPLATE(BM_SmallFilter, true)->ArgName("keylen")->Arg(kDefaultKeyLength);
+
+BENCHMARK(BM_ConcurrentInsert)
+    ->ArgNames({"log2bits", "k", "keylen"})
+    ->Args({kDefaultLog2Size, kDefaultHashes, kDefaultKeyLength})
+    ->Args({27, kDefaultHashes, kDefaultKeyLength})
+    ->ThreadRange(1, maxThreads())
+    ->UseRealTime();
+BENCHMARK(BM_ConcurrentLookup)
+    ->ArgNames({"log2bits", "k", "keylen", "hit%"})
+    ->Args({kDefaultLog2Size, kDefaultHashes, kDefaultKeyLength, kDefaultHitPercent})
+    ->Args({27, kDefaultHashes, kDefaultKeyLength, kDefaultHitPercent})
+    ->ThreadRange(1, maxThreads())
+    ->UseRealTime();
+
+BENCHMARK_MAIN();
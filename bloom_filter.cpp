@@ -3,73 +3,100 @@
     #include <random>
     #include <chrono>
     #include <iomanip>
+    #include <cstring>
+    #include <stdexcept>
+    #include "atomic_file.h"
+    #include "latency_profile.h"
+    #include "mapped_file.h"
+    #include "word_ops.h"
 
     using namespace std;
 
     BloomFilter::BloomFilter(size_t filterSize, unsigned int numHashFunctions) 
-        : size(filterSize), numHashes(numHashFunctions), bitArray(filterSize, false) {
-        initializeHashFunctions();
+        : bitArray(filterSize), size(filterSize), numHashes(numHashFunctions), setBits(0), setBitsCounted(true) {
+        initializeProbeKernels();
     }
 
-    BloomFilter BloomFilter::createOptimal(size_t expectedItems, double falsePositiveRate) {
-        size_t optimalSize = static_cast<size_t>(
+    BloomFilter::BloomFilter(BitStorage storage, unsigned int numHashFunctions)
+        : bitArray(move(storage)), size(bitArray.size()), numHashes(numHashFunctions),
+          setBits(0), setBitsCounted(false) {
+        initializeProbeKernels();
+    }
+
+    BloomFilter BloomFilter::createOptimal(size_t expectedItems, double falsePositiveRate, bool roundToPowerOfTwo) {
+        size_t optimalSize;
+        unsigned int optimalHashes;
+        computeOptimalParameters(expectedItems, falsePositiveRate, roundToPowerOfTwo, optimalSize, optimalHashes);
+        
+        return BloomFilter(optimalSize, optimalHashes);
+    }
+
+    void BloomFilter::computeOptimalParameters(size_t expectedItems, double falsePositiveRate, bool roundToPowerOfTwo,
+                                               size_t& optimalSize, unsigned int& optimalHashes) {
+        optimalSize = static_cast<size_t>(
             ceil(-1.0 * expectedItems * log(falsePositiveRate) / (log(2) * log(2)))
         );
-        unsigned int optimalHashes = static_cast<unsigned int>(
+        optimalHashes = static_cast<unsigned int>(
             ceil((optimalSize / static_cast<double>(expectedItems)) * log(2))
         );
         if (optimalHashes < 1) optimalHashes = 1;
         if (optimalSize < 8) optimalSize = 8;
-        
-        return BloomFilter(optimalSize, optimalHashes);
+        // Rounding up keeps k, so the extra bits only lower the FPR
+        if (roundToPowerOfTwo) optimalSize = roundUpToPowerOfTwo(optimalSize);
     }
 
-    void BloomFilter::initializeHashFunctions() {
-        hashFunctions.clear();
-        for (unsigned int i = 0; i < numHashes; i++) {
-            hashFunctions.push_back([this, i](const string& key) {
-                return this->combinedHash(key, i);
-            });
+    void BloomFilter::initializeProbeKernels() {
+        // Power-of-two sizes index with a mask; same bit positions as modulo
+        if (isPowerOfTwo(size)) {
+            kernels = &selectProbeKernels<Djb2SdbmHash, MaskReduction>(numHashes);
+        } else {
+            kernels = &selectProbeKernels<Djb2SdbmHash, ModuloReduction>(numHashes);
         }
     }
-    
-    // djb2 hashing algo
-    size_t BloomFilter::hashFunction1(const string& key) const {
-        unsigned long hash = 5381;
-        for (char c : key) {
-            hash = ((hash << 5) + hash) + c;
-        }
-        return hash % size;
+
+    void BloomFilter::recountSetBits() {
+        setBits = popcountWords(bitArray.data(), bitArray.numWords());
+        setBitsCounted = true;
     }
-    // sdbm hashing algo
-    size_t BloomFilter::hashFunction2(const string& key) const {
-        unsigned long hash = 0;
-        for (char c : key) {
-            hash = c + (hash << 6) + (hash << 16) - hash;
-        }
-        return hash % size;
+
+    void BloomFilter::insert(string_view element) {
+        BLOOM_PROFILE_SCOPE(ProfiledOp::Insert);
+        setBits += kernels->insert(bitArray.data(), size, numHashes, element.data(), element.size());
     }
 
-    size_t BloomFilter::combinedHash(const string& key, int seed) const {
-        size_t hash1 = hashFunction1(key);
-        size_t hash2 = hashFunction2(key);
-        return (hash1 + seed * hash2) % size;
+    void BloomFilter::insert(const void* data, size_t len) {
+        BLOOM_PROFILE_SCOPE(ProfiledOp::Insert);
+        setBits += kernels->insert(bitArray.data(), size, numHashes, static_cast<const char*>(data), len);
     }
 
+    void BloomFilter::insert(uint64_t key) {
+        BLOOM_PROFILE_SCOPE(ProfiledOp::Insert);
+        setBits += kernels->insertHashed(bitArray.data(), size, numHashes, Djb2SdbmHash::hashKey(key));
+    }
 
-    void BloomFilter::insert(const string& element) {
-        for (const auto& hashFunc : hashFunctions) {
-            size_t index = hashFunc(element);
-            bitArray[index] = true;
-        }
+    bool BloomFilter::mightContain(string_view element) const {
+        BLOOM_PROFILE_SCOPE(ProfiledOp::Contains);
+        return kernels->contains(bitArray.data(), size, numHashes, element.data(), element.size());
     }
 
-    bool BloomFilter::mightContain(const string& element) const {
-        for (const auto& hashFunc : hashFunctions) {
-            size_t index = hashFunc(element);
-            if (!bitArray[index]) return false;
-        }
-        return true;
+    bool BloomFilter::mightContain(const void* data, size_t len) const {
+        BLOOM_PROFILE_SCOPE(ProfiledOp::Contains);
+        return kernels->contains(bitArray.data(), size, numHashes, static_cast<const char*>(data), len);
+    }
+
+    bool BloomFilter::mightContain(uint64_t key) const {
+        BLOOM_PROFILE_SCOPE(ProfiledOp::Contains);
+        return kernels->containsHashed(bitArray.data(), size, numHashes, Djb2SdbmHash::hashKey(key));
+    }
+
+    void BloomFilter::insertBatch(const string_view* elements, size_t count) {
+        BLOOM_PROFILE_SCOPE(ProfiledOp::InsertBatch);
+        setBits += kernels->insertBatch(bitArray.data(), size, numHashes, elements, count);
+    }
+
+    void BloomFilter::mightContainBatch(const string_view* elements, size_t count, bool* results) const {
+        BLOOM_PROFILE_SCOPE(ProfiledOp::ContainsBatch);
+        kernels->containsBatch(bitArray.data(), size, numHashes, elements, count, results);
     }
 
     double BloomFilter::getCurrentFalsePositiveRate(size_t insertedItems) const {
@@ -88,34 +115,103 @@
     }
 
     void BloomFilter::clear() {
-        fill(bitArray.begin(), bitArray.end(), false);
+        bitArray.reset();
+        setBits = 0;
+        setBitsCounted = true;
     }
 
-    
-
-    bool BloomFilter::saveToFile(const string& filename) const {
-        ofstream outFile(filename, ios::binary);
-        
-        if (!outFile.is_open()) {
+    bool BloomFilter::unionWith(const BloomFilter& other) {
+        if (size != other.size || numHashes != other.numHashes) {
             return false;
         }
         
-        outFile.write(reinterpret_cast<const char*>(&size), sizeof(size));
-        outFile.write(reinterpret_cast<const char*>(&numHashes), sizeof(numHashes));
+        orWords(bitArray.data(), other.bitArray.data(), bitArray.numWords());
+        recountSetBits();
+        return true;
+    }
+
+    bool BloomFilter::intersectWith(const BloomFilter& other) {
+        if (size != other.size || numHashes != other.numHashes) {
+            return false;
+        }
         
-        vector<unsigned char> packedBits((size + 7) / 8, 0);
+        andWords(bitArray.data(), other.bitArray.data(), bitArray.numWords());
+        recountSetBits();
+        return true;
+    }
+
+    size_t BloomFilter::countSetBits() const {
+        return setBitsCounted ? setBits : popcountWords(bitArray.data(), bitArray.numWords());
+    }
+
+    double BloomFilter::getFillRatio() const {
+        return size ? static_cast<double>(countSetBits()) / size : 0.0;
+    }
+
+    double BloomFilter::getFalsePositiveRateFromFill() const {
+        return pow(getFillRatio(), numHashes);
+    }
+
+    double BloomFilter::estimateCardinality() const {
+        return estimateItemsFromBits(size, numHashes, countSetBits());
+    }
+
+    FilterDelta BloomFilter::diffSince(const BloomFilter& base) const {
+        if (size != base.size || numHashes != base.numHashes) {
+            throw invalid_argument("diffSince needs a base filter of the same size and hash count");
+        }
         
-        for (size_t i = 0; i < size; i++) {
-            if (bitArray[i]) {
-                packedBits[i / 8] |= (1 << (i % 8));
+        FilterDelta delta(size, numHashes);
+        const uint64_t* words = bitArray.data();
+        const uint64_t* baseWords = base.bitArray.data();
+        for (size_t i = 0; i < bitArray.numWords(); i++) {
+            for (uint64_t added = words[i] & ~baseWords[i]; added; added &= added - 1) {
+                delta.appendBit(uint64_t(i) * 64 + __builtin_ctzll(added));
             }
         }
+        return delta;
+    }
+
+    bool BloomFilter::applyDelta(const FilterDelta& delta) {
+        if (delta.getSizeBits() != size || delta.getNumHashes() != numHashes) {
+            return false;
+        }
         
-        outFile.write(reinterpret_cast<const char*>(packedBits.data()), packedBits.size());
-        
+        uint64_t* words = bitArray.data();
+        size_t added = 0;
+        delta.forEachWord([words, &added](size_t index, uint64_t bits) {
+            added += __builtin_popcountll(bits & ~words[index]);
+            words[index] |= bits;
+        });
+        setBits += added;
         return true;
     }
 
+    bool BloomFilter::writeTo(ostream& out, bool compress) const {
+        return writeFilterFile(out, FilterKind::Standard, Djb2SdbmHash::id, size, numHashes, bitArray, compress);
+    }
+
+    BloomFilter* BloomFilter::readFrom(istream& in) {
+        FilterFileHeader header;
+        if (!readFilterHeader(in, header) || !isCompatibleHeader(header)) {
+            return nullptr;
+        }
+        
+        BloomFilter* loadedFilter = new BloomFilter(header.sizeBits, header.numHashes);
+        if (!readFilterPayload(in, header, loadedFilter->bitArray)) {
+            delete loadedFilter;
+            return nullptr;
+        }
+        loadedFilter->recountSetBits();
+        return loadedFilter;
+    }
+
+    bool BloomFilter::saveToFile(const string& filename, bool compress) const {
+        return writeFileAtomically(filename, [this, compress](ostream& out) {
+            return writeTo(out, compress);
+        });
+    }
+
     BloomFilter* BloomFilter::loadFromFile(const string& filename) {
         ifstream inFile(filename, ios::binary);
         
@@ -123,31 +219,57 @@
             return nullptr;
         }
         
+        if (peekFilterMagic(inFile)) {
+            return readFrom(inFile);
+        }
+        
+        // Original layout: size, numHashes, byte-packed bits
         size_t loadedSize;
         unsigned int loadedNumHashes;
         
         inFile.read(reinterpret_cast<char*>(&loadedSize), sizeof(loadedSize));
         inFile.read(reinterpret_cast<char*>(&loadedNumHashes), sizeof(loadedNumHashes));
         
-        if (inFile.fail()) {
+        // The packed bits must all be there before any of them is allocated
+        if (inFile.fail() || loadedSize == 0 || loadedNumHashes == 0 ||
+            !streamHolds(inFile, loadedSize / 8 + (loadedSize % 8 != 0))) {
             return nullptr;
         }
         
         BloomFilter* loadedFilter = new BloomFilter(loadedSize, loadedNumHashes);
         
-        vector<unsigned char> packedBits((loadedSize + 7) / 8, 0);
-        inFile.read(reinterpret_cast<char*>(packedBits.data()), packedBits.size());
-        
-        if (inFile.fail()) {
+        if (!loadedFilter->bitArray.readPacked(inFile)) {
             delete loadedFilter;
             return nullptr;
         }
         
-        for (size_t i = 0; i < loadedSize; i++) {
-            if (packedBits[i / 8] & (1 << (i % 8))) {
-                loadedFilter->bitArray[i] = true;
-            }
+        loadedFilter->recountSetBits();
+        return loadedFilter;
+    }
+
+    BloomFilter* BloomFilter::openMapped(const string& filename, bool verifyChecksum) {
+        shared_ptr<MappedFile> mapping = MappedFile::open(filename);
+        if (!mapping || mapping->size() < kFilterHeaderBytes) {
+            return nullptr;
         }
         
-        return loadedFilter;
+        FilterFileHeader header;
+        memcpy(&header, mapping->data(), sizeof(header));
+        if (!validateFilterHeader(header) || !isCompatibleHeader(header)) {
+            return nullptr;
+        }
+        if (!validateMappedRecord(mapping->data(), mapping->size(), header, verifyChecksum)) {
+            return nullptr;
+        }
+        
+        unsigned char* payload = mapping->mutableData() + kFilterHeaderBytes;
+        
+        // Probe the mapped pages in place; the storage keeps the mapping alive
+        BitStorage storage = BitStorage::view(reinterpret_cast<uint64_t*>(payload), header.sizeBits, mapping);
+        return new BloomFilter(move(storage), header.numHashes);
+    }
+
+    bool BloomFilter::isCompatibleHeader(const FilterFileHeader& header) {
+        return header.kind == static_cast<uint32_t>(FilterKind::Standard) &&
+               header.hashPolicy == static_cast<uint32_t>(Djb2SdbmHash::id);
     }
@@ -1,41 +1,81 @@
 #ifndef BLOOM_FILTER_H
 #define BLOOM_FILTER_H
 
-#include <vector>
-#include <functional>
+#include "bit_storage.h"
+#include "filter_delta.h"
+#include "filter_format.h"
+#include "probe_engine.h"
 #include <string>
+#include <string_view>
 #include <cmath>
 #include <fstream>
 
+template <size_t ExpectedItems, uint32_t FprPpm>
+class StaticBloomFilter;
+
 class BloomFilter {
 private:
-    std::vector<bool> bitArray;
+    BitStorage bitArray;
     size_t size;
     unsigned int numHashes;
     
-    // Simple hash functions for demonstration
-    std::vector<std::function<size_t(const std::string&)>> hashFunctions;
+    // Bits set, kept up to date by every insert; a mapped filter counts on demand
+    // until something recounts it (setBitsCounted false)
+    size_t setBits;
+    bool setBitsCounted;
+    
+    // Insert/lookup kernels specialized for numHashes and size (djb2 + sdbm double hashing)
+    const ProbeKernels* kernels;
+    
+    // Select the probe kernels for the current number of hash functions
+    void initializeProbeKernels();
+    
+    // Count the set bits from scratch (after loads and bulk word operations)
+    void recountSetBits();
+    
+    // Adopt existing storage (used by openMapped)
+    BloomFilter(BitStorage storage, unsigned int numHashFunctions);
     
-    // Initialize hash functions
-    void initializeHashFunctions();
+    // True if a versioned file header describes a filter this class can read
+    static bool isCompatibleHeader(const FilterFileHeader& header);
     
-    // Helper methods for creating hash functions
-    size_t hashFunction1(const std::string& key) const;
-    size_t hashFunction2(const std::string& key) const;
-    size_t combinedHash(const std::string& key, int seed) const;
+    // Builds snapshots straight into the bit array
+    friend class CountingBloomFilter;
+    template <size_t ExpectedItems, uint32_t FprPpm>
+    friend class StaticBloomFilter;
 
 public:
     // Constructor with specified size and number of hash functions
     BloomFilter(size_t filterSize, unsigned int numHashFunctions);
     
-    // Static method that calculates optimal parameters based on expected items and false positive rate
-    static BloomFilter createOptimal(size_t expectedItems, double falsePositiveRate);
+    // Static method that calculates optimal parameters based on expected items and false positive rate.
+    // roundToPowerOfTwo grows the size to the next power of two so indices reduce with a mask.
+    static BloomFilter createOptimal(size_t expectedItems, double falsePositiveRate, bool roundToPowerOfTwo = false);
+    
+    // Optimal size and hash count for expected items and false positive rate (shared by the variants)
+    static void computeOptimalParameters(size_t expectedItems, double falsePositiveRate, bool roundToPowerOfTwo,
+                                         size_t& optimalSize, unsigned int& optimalHashes);
     
     // Insert an element into the bloom filter
-    void insert(const std::string& element);
+    void insert(std::string_view element);
+    
+    // Insert len raw bytes; same bits as the string_view overload for the same bytes
+    void insert(const void* data, size_t len);
+    
+    // Insert an integer key, hashed as its 8 little-endian bytes by a fixed-length
+    // fast path (same bits as inserting those bytes)
+    void insert(uint64_t key);
     
     // Check if an element might be in the set
-    bool mightContain(const std::string& element) const;
+    bool mightContain(std::string_view element) const;
+    bool mightContain(const void* data, size_t len) const;
+    bool mightContain(uint64_t key) const;
+    
+    // Insert many elements; hashing and memory misses of a window of keys overlap
+    void insertBatch(const std::string_view* elements, size_t count);
+    
+    // Check many elements at once; results[i] is set for elements[i]
+    void mightContainBatch(const std::string_view* elements, size_t count, bool* results) const;
     
     // Get current false positive probability based on items inserted
     double getCurrentFalsePositiveRate(size_t insertedItems) const;
@@ -49,14 +89,53 @@ public:
     // Reset the filter
     void clear();
     
+    // OR another filter of the same size and hash count into this one
+    bool unionWith(const BloomFilter& other);
+    
+    // AND another filter of the same size and hash count into this one. The result
+    // answers yes for every key in both sets, but its false positive rate is higher than
+    // a filter built from the intersection alone.
+    bool intersectWith(const BloomFilter& other);
+    
+    // Number of bits set; O(1), from the running count
+    size_t countSetBits() const;
+    
+    // Fraction of the bits that are set
+    double getFillRatio() const;
+    
+    // False positive rate implied by the measured fill, (set bits / size)^k
+    double getFalsePositiveRateFromFill() const;
+    
+    // Items the filter holds, estimated from its fill (Swamidass-Baldi); accurate to a
+    // few percent until the filter is well past its design capacity
+    double estimateCardinality() const;
+    
+    // Bits set here but not in base, an earlier version of this filter (same size and
+    // hash count, otherwise std::invalid_argument is thrown)
+    FilterDelta diffSince(const BloomFilter& base) const;
+    
+    // OR a delta produced by diffSince into this filter; false if the geometry differs
+    bool applyDelta(const FilterDelta& delta);
+    
     // Print the current state of the bit array (useful for debugging)
     void printFilter() const;
     
-    // Save filter state to a file
-    bool saveToFile(const std::string& filename) const;
+    // Save filter state to a file in the versioned format; with compress, a compressed
+    // snapshot is written when it is smaller (loadable, but not mappable)
+    bool saveToFile(const std::string& filename, bool compress = false) const;
     
-    // Load filter state from a file
+    // Write one versioned record at the stream's position / read one back (nullptr on
+    // failure); used to put several filters in one file
+    bool writeTo(std::ostream& out, bool compress = false) const;
+    static BloomFilter* readFrom(std::istream& in);
+    
+    // Load filter state from a file (versioned or original format)
     static BloomFilter* loadFromFile(const std::string& filename);
+    
+    // Map a versioned filter file and query it in place: near-zero startup, and every
+    // process mapping the file shares one copy of its pages. Local inserts only touch
+    // private copy-on-write pages. Checksum verification reads the whole payload, so it is opt-in.
+    static BloomFilter* openMapped(const std::string& filename, bool verifyChecksum = false);
 };
 
 #endif // BLOOM_FILTER_H
\ No newline at end of file
@@ -0,0 +1,73 @@
+#include "checksum.h"
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define BLOOM_X86_64 1
+#endif
+
+namespace {
+
+constexpr uint32_t kPolynomial = 0x82F63B78u; // reflected Castagnoli polynomial
+
+struct Crc32cTable {
+    uint32_t entries[256];
+
+    Crc32cTable() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc >> 1) ^ ((crc & 1) ? kPolynomial : 0);
+            }
+            entries[i] = crc;
+        }
+    }
+};
+
+uint32_t crc32cSoftware(uint32_t crc, const unsigned char* p, size_t length) {
+    static const Crc32cTable table;
+    for (size_t i = 0; i < length; i++) {
+        crc = table.entries[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef BLOOM_X86_64
+
+__attribute__((target("sse4.2")))
+uint32_t crc32cHardware(uint32_t crc, const unsigned char* p, size_t length) {
+    uint64_t value = crc;
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        value = _mm_crc32_u64(value, word);
+        p += 8;
+        length -= 8;
+    }
+    uint32_t result = static_cast<uint32_t>(value);
+    while (length > 0) {
+        result = _mm_crc32_u8(result, *p);
+        p++;
+        length--;
+    }
+    return result;
+}
+
+bool hasHardwareCrc() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+
+#endif // BLOOM_X86_64
+
+} // namespace
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t length) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+#ifdef BLOOM_X86_64
+    static const bool hardware = hasHardwareCrc();
+    if (hardware) return ~crc32cHardware(crc, p, length);
+#endif
+    return ~crc32cSoftware(crc, p, length);
+}
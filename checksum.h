@@ -0,0 +1,12 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC32C (Castagnoli), as used by iSCSI/ext4. Uses the SSE4.2 crc32 instruction
+// when the CPU has it and a table-driven fallback otherwise.
+// Pass the previous return value as crc to checksum data in pieces; start with 0.
+uint32_t crc32c(uint32_t crc, const void* data, size_t length);
+
+#endif // CHECKSUM_H
@@ -0,0 +1,922 @@
+#include "cli_commands.h"
+#include "bloom_filter.h"
+#include "concurrent_bloom_filter.h"
+#include "filter_server.h"
+#include "key_set.h"
+#include "latency_profile.h"
+#include "line_reader.h"
+#include "parallel_build.h"
+#include "sharded_bloom_filter.h"
+#include "static_filter.h"
+#include "string_arena.h"
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+// Output is handed to stdout in blocks of about this size
+constexpr size_t kOutputBufferBytes = 1 << 20;
+
+// Accumulates output and writes it to a FILE* in large blocks
+class OutputBuffer {
+private:
+    FILE* stream;
+    string buffer;
+    bool failed;
+
+public:
+    explicit OutputBuffer(FILE* out) : stream(out), failed(false) {
+        buffer.reserve(kOutputBufferBytes + 4096);
+    }
+
+    ~OutputBuffer() { flush(); }
+
+    void append(string_view text) {
+        buffer.append(text.data(), text.size());
+        if (buffer.size() >= kOutputBufferBytes) flush();
+    }
+
+    void append(char c) {
+        buffer.push_back(c);
+        if (buffer.size() >= kOutputBufferBytes) flush();
+    }
+
+    // False if any write failed
+    bool flush() {
+        if (!buffer.empty()) {
+            if (fwrite(buffer.data(), 1, buffer.size(), stream) != buffer.size()) failed = true;
+            buffer.clear();
+        }
+        if (fflush(stream) != 0) failed = true;
+        return !failed;
+    }
+};
+
+// Parsed "--name value", "--name=value" and boolean "--flag" options, plus positional
+// arguments. Options not declared by the command are errors.
+class CommandLine {
+private:
+    map<string, string> values;
+    set<string> flags;
+    vector<string> positional;
+    string problem;
+
+public:
+    CommandLine(int argc, char** argv, int first, const set<string>& valueNames, const set<string>& flagNames) {
+        for (int i = first; i < argc && problem.empty(); i++) {
+            string arg = argv[i];
+            if (arg.size() < 3 || arg.compare(0, 2, "--") != 0) {
+                positional.push_back(arg);
+                continue;
+            }
+            string name = arg.substr(2);
+            string value;
+            size_t equals = name.find('=');
+            bool inlineValue = equals != string::npos;
+            if (inlineValue) {
+                value = name.substr(equals + 1);
+                name.resize(equals);
+            }
+            if (flagNames.count(name) && !inlineValue) {
+                flags.insert(name);
+            } else if (valueNames.count(name)) {
+                if (!inlineValue) {
+                    if (i + 1 >= argc) {
+                        problem = "--" + name + " needs a value";
+                        break;
+                    }
+                    value = argv[++i];
+                }
+                values[name] = value;
+            } else {
+                problem = "unknown option --" + name;
+            }
+        }
+    }
+
+    // Empty if the arguments parsed
+    const string& error() const { return problem; }
+
+    bool has(const string& name) const { return values.count(name) || flags.count(name); }
+
+    string get(const string& name, const string& fallback = "") const {
+        auto it = values.find(name);
+        return it == values.end() ? fallback : it->second;
+    }
+
+    const vector<string>& arguments() const { return positional; }
+};
+
+bool parseCount(const string& text, size_t& value) {
+    if (text.empty() || text[0] == '-') return false;
+    char* end = nullptr;
+    unsigned long long parsed = strtoull(text.c_str(), &end, 10);
+    if (*end != '\0') return false;
+    value = static_cast<size_t>(parsed);
+    return true;
+}
+
+bool parseRate(const string& text, double& value) {
+    if (text.empty()) return false;
+    char* end = nullptr;
+    value = strtod(text.c_str(), &end);
+    return *end == '\0';
+}
+
+// Reads a numeric option into value, leaving it unchanged if the option is absent
+bool countOption(const CommandLine& args, const string& name, size_t& value) {
+    if (!args.has(name)) return true;
+    if (parseCount(args.get(name), value)) return true;
+    cerr << "--" << name << " expects a non-negative integer, got '" << args.get(name) << "'" << endl;
+    return false;
+}
+
+bool rateOption(const CommandLine& args, const string& name, double& value) {
+    if (!args.has(name)) return true;
+    if (parseRate(args.get(name), value)) return true;
+    cerr << "--" << name << " expects a number, got '" << args.get(name) << "'" << endl;
+    return false;
+}
+
+// Filters can only be sized for a rate strictly between 0 and 1
+bool checkRate(const string& name, double value) {
+    if (value > 0 && value < 1) return true;
+    cerr << "--" << name << " must be greater than 0 and less than 1, got " << value << endl;
+    return false;
+}
+
+bool checkPositive(const CommandLine& args, const string& name, size_t value) {
+    if (!args.has(name) || value >= 1) return true;
+    cerr << "--" << name << " must be at least 1" << endl;
+    return false;
+}
+
+// "-" reads standard input
+bool isStdin(const string& input) {
+    return input == "-";
+}
+
+bool forEachInputBatch(const string& input, const LineBatchSink& sink) {
+    return isStdin(input) ? forEachLineBatch(cin, sink) : forEachLineBatch(input, sink);
+}
+
+// Element lists written before the binary format are one element per line
+unique_ptr<KeySet> loadElementList(const string& filterFile) {
+    string elementListFile = filterFile + ".elements";
+    unique_ptr<KeySet> keys(KeySet::loadFromFile(elementListFile));
+    if (!keys) keys.reset(KeySet::loadFromListFile(elementListFile));
+    return keys;
+}
+
+FilterHandle loadFilterOrReport(const string& filename, bool mapped) {
+    FilterHandle filter = FilterHandle::loadFromFile(filename, mapped);
+    if (!filter) cerr << "Error loading filter from file: " << filename << endl;
+    return filter;
+}
+
+// Insert every line of input, through the parallel builder where the type has one
+bool insertInput(FilterHandle& filter, const string& input, unsigned int numThreads, KeySet* keys,
+                 size_t& added, bool& full) {
+    added = 0;
+    full = false;
+    if (numThreads != 1 && !isStdin(input)) {
+        if (BloomFilter* standard = filter.get<BloomFilter>()) {
+            return parallelInsertFromFile(input, *standard, numThreads, added, keys);
+        }
+        if (ConcurrentBloomFilter* concurrent = filter.get<ConcurrentBloomFilter>()) {
+            return parallelInsertFromFile(input, *concurrent, numThreads, added, keys);
+        }
+        if (ShardedBloomFilter* sharded = filter.get<ShardedBloomFilter>()) {
+            return parallelInsertFromFile(input, *sharded, numThreads, added, keys);
+        }
+    }
+    return forEachInputBatch(input, [&](const string_view* lines, size_t count) {
+        if (!filter.insertBatch(lines, count)) full = true;
+        if (keys) {
+            for (size_t i = 0; i < count; i++) keys->insert(lines[i]);
+        }
+        added += count;
+    });
+}
+
+// StaticFilter needs every key up front, so it is built rather than inserted into
+FilterHandle buildStatic(const string& input, KeySet* keys, size_t& added) {
+    StringArena arena;
+    vector<string_view> lines;
+    bool ok = forEachInputBatch(input, [&](const string_view* batch, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            lines.push_back(arena.intern(batch[i]));
+            if (keys) keys->insert(batch[i]);
+        }
+    });
+    added = lines.size();
+    if (!ok) return FilterHandle();
+    return FilterHandle(unique_ptr<StaticFilter>(StaticFilter::build(lines.data(), lines.size())), "static");
+}
+
+int commandBuild(const CommandLine& args) {
+    string input = args.get("input");
+    string output = args.get("output");
+    if (input.empty() || output.empty()) {
+        cerr << "build needs --input and --output" << endl;
+        return 2;
+    }
+
+    string typeName = args.get("type", "standard");
+    bool isStatic = typeName == "static";
+    FilterVariant variant = FilterVariant::Standard;
+    if (!isStatic && !FilterHandle::parseVariant(typeName, variant)) {
+        cerr << "Unknown filter type: " << typeName << endl;
+        return 2;
+    }
+
+    size_t expected = 0;
+    size_t filterSize = 0;
+    size_t numHashes = 0;
+    size_t numThreads = 0;
+    size_t numShards = 0;
+    double falsePositiveRate = 0.01;
+    if (!countOption(args, "expected", expected) || !countOption(args, "size", filterSize) ||
+        !countOption(args, "hashes", numHashes) || !countOption(args, "threads", numThreads) ||
+        !countOption(args, "shards", numShards) || !rateOption(args, "fpr", falsePositiveRate)) {
+        return 2;
+    }
+    if (!checkRate("fpr", falsePositiveRate) || !checkPositive(args, "expected", expected) ||
+        !checkPositive(args, "size", filterSize) || !checkPositive(args, "hashes", numHashes)) {
+        return 2;
+    }
+    if (args.has("shards") && (variant != FilterVariant::Sharded || !isPowerOfTwo(numShards))) {
+        cerr << "--shards applies to sharded filters and must be a power of two" << endl;
+        return 2;
+    }
+    bool manual = args.has("size") || args.has("hashes");
+    if (manual && (!args.has("size") || !args.has("hashes"))) {
+        cerr << "--size and --hashes go together" << endl;
+        return 2;
+    }
+    if (manual && variant != FilterVariant::Standard && variant != FilterVariant::Concurrent) {
+        cerr << "--size/--hashes apply to standard and concurrent filters only" << endl;
+        return 2;
+    }
+
+    unique_ptr<KeySet> keys(args.has("keys") ? new KeySet() : nullptr);
+    FilterHandle filter;
+    size_t added = 0;
+    bool full = false;
+
+    try {
+        if (isStatic) {
+            filter = buildStatic(input, keys.get(), added);
+            if (!filter) {
+                cerr << "Error reading " << input << " or building the static filter" << endl;
+                return 1;
+            }
+        } else {
+            if (manual) {
+                if (variant == FilterVariant::Concurrent) {
+                    filter = FilterHandle(make_unique<ConcurrentBloomFilter>(filterSize, static_cast<unsigned int>(numHashes)),
+                                          "concurrent");
+                } else {
+                    filter = FilterHandle(make_unique<BloomFilter>(filterSize, static_cast<unsigned int>(numHashes)),
+                                          "standard");
+                }
+            } else {
+                if (!args.has("expected")) {
+                    // Size for the input itself; a stream cannot be read twice
+                    if (isStdin(input)) {
+                        cerr << "Reading from stdin needs --expected or --size/--hashes" << endl;
+                        return 2;
+                    }
+                    if (!forEachLineBatch(input, [&expected](const string_view*, size_t count) { expected += count; })) {
+                        cerr << "Error opening file: " << input << endl;
+                        return 1;
+                    }
+                    expected = max<size_t>(expected, 1);
+                }
+                if (variant == FilterVariant::Sharded && numShards) {
+                    filter = FilterHandle(unique_ptr<ShardedBloomFilter>(new ShardedBloomFilter(
+                        ShardedBloomFilter::createOptimal(expected, falsePositiveRate,
+                                                          static_cast<unsigned int>(numShards), args.has("pow2")))),
+                        "sharded");
+                } else {
+                    filter = FilterHandle::createOptimal(variant, expected, falsePositiveRate, args.has("pow2"));
+                }
+            }
+            if (!filter.supportsSave()) {
+                cerr << filter.name() << " filters have no file format and cannot be built to a file" << endl;
+                return 2;
+            }
+            if (!insertInput(filter, input, static_cast<unsigned int>(numThreads), keys.get(), added, full)) {
+                cerr << "Error reading file: " << input << endl;
+                return 1;
+            }
+        }
+    } catch (const exception& e) {
+        cerr << "Error creating filter: " << e.what() << endl;
+        return 2;
+    }
+
+    if (full) {
+        cerr << "Warning: the filter is full; not every key could be stored" << endl;
+    }
+    if (!filter.saveToFile(output, args.has("compress"))) {
+        cerr << "Error saving filter to file: " << output << endl;
+        return 1;
+    }
+    if (keys && !keys->saveToFile(output + ".elements")) {
+        cerr << "Error saving element list to " << output << ".elements" << endl;
+        return 1;
+    }
+
+    cout << filter.name() << " filter: " << added << " keys, " << filter.getSize() << " bits";
+    if (filter.getNumHashes()) cout << ", " << filter.getNumHashes() << " hashes";
+    cout << " -> " << output << endl;
+    return 0;
+}
+
+// query output: 0/1 per key, key<TAB>0/1, or only the keys that might be present / are absent
+enum class QueryFormat {
+    Bool,
+    Tsv,
+    Hits,
+    Misses
+};
+
+bool parseQueryFormat(const string& name, QueryFormat& format) {
+    if (name == "bool") format = QueryFormat::Bool;
+    else if (name == "tsv") format = QueryFormat::Tsv;
+    else if (name == "hits") format = QueryFormat::Hits;
+    else if (name == "misses") format = QueryFormat::Misses;
+    else return false;
+    return true;
+}
+
+int commandQuery(const CommandLine& args) {
+    string filterFile = args.get("filter");
+    if (filterFile.empty()) {
+        cerr << "query needs --filter" << endl;
+        return 2;
+    }
+    QueryFormat format;
+    if (!parseQueryFormat(args.get("format", "bool"), format)) {
+        cerr << "Unknown format: " << args.get("format") << " (bool, tsv, hits or misses)" << endl;
+        return 2;
+    }
+
+    FilterHandle filter = loadFilterOrReport(filterFile, args.has("mmap"));
+    if (!filter) return 1;
+
+    OutputBuffer out(stdout);
+    unique_ptr<bool[]> results(new bool[kLineBatch]);
+    size_t queried = 0;
+    size_t positives = 0;
+    string input = args.get("input", "-");
+
+    bool ok = forEachInputBatch(input, [&](const string_view* keys, size_t count) {
+        filter.mightContainBatch(keys, count, results.get());
+        for (size_t i = 0; i < count; i++) {
+            bool present = results[i];
+            positives += present;
+            switch (format) {
+                case QueryFormat::Bool:
+                    out.append(present ? "1\n" : "0\n");
+                    break;
+                case QueryFormat::Tsv:
+                    out.append(keys[i]);
+                    out.append(present ? "\t1\n" : "\t0\n");
+                    break;
+                case QueryFormat::Hits:
+                case QueryFormat::Misses:
+                    if (present == (format == QueryFormat::Hits)) {
+                        out.append(keys[i]);
+                        out.append('\n');
+                    }
+                    break;
+            }
+        }
+        queried += count;
+    });
+
+    if (!out.flush()) {
+        cerr << "Error writing results" << endl;
+        return 1;
+    }
+    if (!ok) {
+        cerr << "Error reading keys from " << (isStdin(input) ? "stdin" : input) << endl;
+        return 1;
+    }
+    if (args.has("summary")) {
+        cerr << queried << " keys queried, " << positives << " might be present" << endl;
+    }
+    return 0;
+}
+
+// Keys per mightContainBatch call in the latency probe
+constexpr size_t kLatencyProbeBatch = 64;
+
+// Times numLookups single lookups and as many keys again in batches, then prints the
+// percentiles of each. Keys alternate between the element list (when there is one) and
+// keys that were never inserted, so both full and early-exit probes are measured.
+void printLatencyProfile(const FilterHandle& filter, const KeySet* elements, size_t numLookups) {
+    vector<string> probeKeys;
+    probeKeys.reserve(numLookups);
+    if (elements) {
+        elements->forEach([&](string_view key) {
+            if (probeKeys.size() < numLookups / 2) probeKeys.emplace_back(key);
+        });
+    }
+    while (probeKeys.size() < numLookups) probeKeys.push_back("latency-probe-" + to_string(probeKeys.size()));
+    shuffle(probeKeys.begin(), probeKeys.end(), mt19937_64(42));
+    vector<string_view> views(probeKeys.begin(), probeKeys.end());
+
+    resetLatencyProfile();
+    size_t positives = 0;
+    for (string_view key : views) positives += filter.mightContain(key);
+    bool results[kLatencyProbeBatch];
+    for (size_t start = 0; start < views.size(); start += kLatencyProbeBatch) {
+        filter.mightContainBatch(views.data() + start, min(kLatencyProbeBatch, views.size() - start), results);
+    }
+
+    cout << "latency_lookups: " << views.size() << " (" << positives << " positive, batches of "
+         << kLatencyProbeBatch << ")\n";
+    for (const LatencySummary& summary : latencySummaries()) {
+        string prefix = string("latency_") + profiledOpName(summary.op);
+        cout << prefix << "_samples: " << summary.samples << "\n"
+             << fixed << setprecision(1)
+             << prefix << "_p50_ns: " << summary.p50Ns << "\n"
+             << prefix << "_p99_ns: " << summary.p99Ns << "\n"
+             << prefix << "_p999_ns: " << summary.p999Ns << "\n"
+             << prefix << "_max_ns: " << summary.maxNs << "\n"
+             << defaultfloat;
+    }
+}
+
+int commandStats(const CommandLine& args) {
+    string filterFile = args.get("filter");
+    if (filterFile.empty()) {
+        cerr << "stats needs --filter" << endl;
+        return 2;
+    }
+    size_t latencyLookups = 0;
+    size_t sampleInterval = 1;
+    if (!countOption(args, "latency", latencyLookups) || !countOption(args, "sample", sampleInterval)) {
+        return 2;
+    }
+    if (args.has("latency") && !kProfilingEnabled) {
+        cerr << "--latency needs a build with -DBLOOM_ENABLE_PROFILING" << endl;
+        return 2;
+    }
+    FilterHandle filter = loadFilterOrReport(filterFile, args.has("mmap"));
+    if (!filter) return 1;
+
+    if (args.has("prometheus")) {
+        writePrometheus(cout, filter.metrics(), {{"file", filterFile}});
+        cout << flush;
+        return 0;
+    }
+
+    cout << "file: " << filterFile << "\n";
+    cout << "file_bytes: " << lineFileSize(filterFile) << "\n";
+    cout << "type: " << filter.name() << "\n";
+    cout << "size_bits: " << filter.getSize() << "\n";
+    cout << "size_bytes: " << (filter.getSize() + 7) / 8 << "\n";
+    if (filter.getNumHashes()) {
+        cout << "hashes: " << filter.getNumHashes() << "\n";
+    }
+    FilterMetrics metrics = filter.metrics();
+    if (metrics.hasFill) {
+        cout << "set_bits: " << metrics.setBits << "\n";
+        cout << "fill_ratio: " << setprecision(6) << metrics.fillRatio << "\n";
+        cout << "fill_fpr: " << setprecision(6) << metrics.estimatedFpr << "\n";
+    }
+    double estimate = filter.estimateCardinality();
+    if (estimate >= 0) {
+        cout << "estimated_elements: " << llround(estimate) << "\n";
+    }
+    unique_ptr<KeySet> keys = loadElementList(filterFile);
+    if (keys) {
+        cout << "elements: " << keys->size() << "\n";
+        cout << "estimated_fpr: " << setprecision(6) << filter.getFalsePositiveRate(keys->size()) << "\n";
+    } else if (estimate >= 0) {
+        cout << "elements: unknown (no element list)\n";
+        cout << "estimated_fpr: " << setprecision(6)
+             << filter.getFalsePositiveRate(static_cast<size_t>(llround(estimate))) << "\n";
+    } else {
+        cout << "elements: unknown (no element list)\n";
+    }
+    if (latencyLookups) {
+        setProfilingSampleInterval(static_cast<uint32_t>(min<size_t>(sampleInterval, UINT32_MAX)));
+        printLatencyProfile(filter, keys.get(), latencyLookups);
+    }
+    cout << flush;
+    return 0;
+}
+
+int commandBench(const CommandLine& args) {
+    size_t numOperations = 100000;
+    size_t expected = 100000;
+    double falsePositiveRate = 0.01;
+    if (!countOption(args, "ops", numOperations) || !countOption(args, "expected", expected) ||
+        !rateOption(args, "fpr", falsePositiveRate)) {
+        return 2;
+    }
+    if (!checkRate("fpr", falsePositiveRate) || !checkPositive(args, "expected", expected)) {
+        return 2;
+    }
+
+    FilterHandle filter;
+    if (args.has("filter")) {
+        filter = loadFilterOrReport(args.get("filter"), false);
+        if (!filter) return 1;
+    } else {
+        FilterVariant variant = FilterVariant::Standard;
+        string typeName = args.get("type", "standard");
+        if (!FilterHandle::parseVariant(typeName, variant)) {
+            cerr << "Unknown filter type: " << typeName << endl;
+            return 2;
+        }
+        try {
+            filter = FilterHandle::createOptimal(variant, expected, falsePositiveRate, args.has("pow2"));
+        } catch (const exception& e) {
+            cerr << "Error creating filter: " << e.what() << endl;
+            return 2;
+        }
+    }
+
+    cout << "Benchmarking " << filter.name() << " filter (" << filter.getSize() << " bits), "
+         << numOperations << " operations" << endl;
+    if (!runQuickBenchmark(filter, numOperations, cout)) {
+        cerr << "Benchmarking needs an insertable filter; " << filter.name() << " filters are build-once." << endl;
+        return 1;
+    }
+    return 0;
+}
+
+int commandMerge(const CommandLine& args) {
+    string output = args.get("output");
+    const vector<string>& inputs = args.arguments();
+    if (output.empty() || inputs.size() < 2) {
+        cerr << "merge needs --output and at least two input filters" << endl;
+        return 2;
+    }
+
+    bool intersect = args.has("intersect");
+    FilterHandle merged = loadFilterOrReport(inputs[0], false);
+    if (!merged) return 1;
+    unique_ptr<KeySet> keys = loadElementList(inputs[0]);
+
+    for (size_t i = 1; i < inputs.size(); i++) {
+        FilterHandle next = loadFilterOrReport(inputs[i], false);
+        if (!next) return 1;
+        if (!(intersect ? merged.intersectWith(next) : merged.unionWith(next))) {
+            cerr << "Cannot merge " << inputs[i] << " (" << next.name() << ", " << next.getSize() << " bits) into "
+                 << inputs[0] << " (" << merged.name() << ", " << merged.getSize()
+                 << " bits): the type and geometry must match and the type must support merging" << endl;
+            return 1;
+        }
+        // The merged element list is only exact if every input had one
+        if (keys) {
+            unique_ptr<KeySet> nextKeys = loadElementList(inputs[i]);
+            if (!nextKeys) {
+                keys.reset();
+            } else if (intersect) {
+                unique_ptr<KeySet> common(new KeySet());
+                keys->forEach([&](string_view key) {
+                    if (nextKeys->contains(key)) common->insert(key);
+                });
+                keys = move(common);
+            } else {
+                nextKeys->forEach([&keys](string_view key) { keys->insert(key); });
+            }
+        }
+    }
+
+    if (!merged.saveToFile(output, args.has("compress"))) {
+        cerr << "Error saving filter to file: " << output << endl;
+        return 1;
+    }
+    if (keys && !keys->saveToFile(output + ".elements")) {
+        cerr << "Error saving element list to " << output << ".elements" << endl;
+        return 1;
+    }
+    cout << (intersect ? "Intersected " : "Merged ") << inputs.size() << " " << merged.name()
+         << " filters -> " << output;
+    if (keys) cout << " (" << keys->size() << " elements)";
+    cout << endl;
+    return 0;
+}
+
+// Identity of a file's current contents; an atomic replace changes the inode
+struct FileStamp {
+    dev_t device = 0;
+    ino_t inode = 0;
+    off_t size = 0;
+    time_t modified = 0;
+    long modifiedNanos = 0;
+
+    static FileStamp of(const string& filename) {
+        FileStamp stamp;
+        struct stat info;
+        if (stat(filename.c_str(), &info) == 0) {
+            stamp.device = info.st_dev;
+            stamp.inode = info.st_ino;
+            stamp.size = info.st_size;
+            stamp.modified = info.st_mtim.tv_sec;
+            stamp.modifiedNanos = info.st_mtim.tv_nsec;
+        }
+        return stamp;
+    }
+
+    bool operator!=(const FileStamp& other) const {
+        return device != other.device || inode != other.inode || size != other.size ||
+               modified != other.modified || modifiedNanos != other.modifiedNanos;
+    }
+};
+
+int commandServe(const CommandLine& args) {
+    FilterServerOptions options;
+    options.filterFile = args.get("filter");
+    options.host = args.get("host", options.host);
+    size_t port = options.port;
+    size_t numThreads = 1;
+    size_t watchSeconds = 0;
+    if (options.filterFile.empty()) {
+        cerr << "serve needs --filter" << endl;
+        return 2;
+    }
+    if (!countOption(args, "port", port) || !countOption(args, "threads", numThreads) ||
+        !countOption(args, "watch", watchSeconds)) {
+        return 2;
+    }
+    if (port > 65535) {
+        cerr << "--port must be at most 65535" << endl;
+        return 2;
+    }
+    options.port = static_cast<uint16_t>(port);
+    options.threads = static_cast<unsigned int>(numThreads);
+    options.allowPathReload = args.has("allow-path-reload");
+
+    // Signals are taken synchronously below; block them before the workers inherit the mask
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    FilterServer server(options);
+    if (!server.start()) {
+        cerr << "Error starting server: " << server.error() << endl;
+        return 1;
+    }
+    shared_ptr<const FilterHandle> served = server.filter();
+    cerr << "Serving " << served->name() << " filter " << options.filterFile << " on " << options.host << ":"
+         << server.port() << " (SIGHUP reloads";
+    if (watchSeconds) cerr << ", checked for changes every " << watchSeconds << "s";
+    cerr << ")" << endl;
+
+    FileStamp stamp = FileStamp::of(options.filterFile);
+    while (true) {
+        int signal;
+        if (watchSeconds) {
+            timespec timeout = {static_cast<time_t>(watchSeconds), 0};
+            signal = sigtimedwait(&signals, nullptr, &timeout);
+        } else {
+            signal = sigwaitinfo(&signals, nullptr);
+        }
+        if (signal == SIGINT || signal == SIGTERM) break;
+
+        bool changed = false;
+        if (signal < 0) {
+            // Timed out: reload only if the file was replaced or rewritten
+            FileStamp now = FileStamp::of(options.filterFile);
+            changed = now != stamp;
+            if (!changed) continue;
+            stamp = now;
+        }
+        if (server.reload()) {
+            cerr << "Reloaded " << options.filterFile << " (generation " << server.filterGeneration() << ")" << endl;
+        } else {
+            cerr << "Reload of " << options.filterFile << " failed; still serving the previous filter" << endl;
+        }
+    }
+
+    server.stop();
+    cerr << "Server stopped" << endl;
+    return 0;
+}
+
+struct Command {
+    const char* name;
+    const char* usage;
+    set<string> values;
+    set<string> flags;
+    int (*run)(const CommandLine&);
+};
+
+const vector<Command>& commands() {
+    static const vector<Command> table = {
+        {"build",
+         "build --input FILE|- --output FILE [--type standard|blocked|concurrent|scalable|cuckoo|static|sharded]\n"
+         "        [--expected N] [--fpr RATE] [--pow2] [--size BITS --hashes K] [--threads N]\n"
+         "        [--shards N] [--compress] [--keys]",
+         {"input", "output", "type", "expected", "fpr", "size", "hashes", "threads", "shards"},
+         {"pow2", "compress", "keys"},
+         commandBuild},
+        {"query",
+         "query --filter FILE [--input FILE|-] [--mmap] [--format bool|tsv|hits|misses] [--summary]",
+         {"filter", "input", "format"},
+         {"mmap", "summary"},
+         commandQuery},
+        {"stats",
+         "stats --filter FILE [--mmap] [--prometheus] [--latency N [--sample N]]",
+         {"filter", "latency", "sample"},
+         {"mmap", "prometheus"},
+         commandStats},
+        {"bench",
+         "bench [--filter FILE | --type NAME --expected N --fpr RATE --pow2] [--ops N]",
+         {"filter", "type", "expected", "fpr", "ops"},
+         {"pow2"},
+         commandBench},
+        {"merge",
+         "merge --output FILE [--compress] [--intersect] INPUT INPUT...",
+         {"output"},
+         {"compress", "intersect"},
+         commandMerge},
+        {"serve",
+         "serve --filter FILE [--host ADDR] [--port N] [--threads N] [--watch SECONDS]\n"
+         "        [--allow-path-reload]",
+         {"filter", "host", "port", "threads", "watch"},
+         {"allow-path-reload"},
+         commandServe},
+    };
+    return table;
+}
+
+void printUsage(ostream& out) {
+    out << "Usage: bloom_filter_checker                (interactive menu)\n"
+        << "       bloom_filter_checker <command> [options]\n\n";
+    for (const Command& command : commands()) {
+        out << "  " << command.usage << "\n";
+    }
+    out << "\nLists are one key per line; empty lines are skipped. --threads 0 uses every core.\n"
+        << "--keys saves an exact element list next to the filter (FILE.elements).\n"
+        << "sharded filters put one shard per NUMA node unless --shards says otherwise.\n"
+        << "query writes one result per non-empty input line (bool: 1 might be present, 0 absent).\n"
+        << "merge ORs the inputs; --intersect ANDs them (keys in every input stay present).\n"
+        << "stats --prometheus prints the filter's metrics in the Prometheus text format.\n"
+        << "stats --latency N times N lookups, one and a batch at a time, and prints p50/p99/p999\n"
+        << "      (timing one call in every --sample, default 1; needs -DBLOOM_ENABLE_PROFILING).\n"
+        << "serve answers batched binary queries (see filter_server.h); SIGHUP reloads the file.\n"
+        << "      GET /metrics on the same port returns its metrics for Prometheus.\n"
+        << "      --allow-path-reload lets a client's Reload frame name another file to serve.\n";
+}
+
+} // namespace
+
+int runCommand(int argc, char** argv) {
+    string name = argc > 1 ? argv[1] : "";
+    if (name == "help" || name == "--help" || name == "-h") {
+        printUsage(cout);
+        return 0;
+    }
+    for (const Command& command : commands()) {
+        if (name != command.name) continue;
+        CommandLine args(argc, argv, 2, command.values, command.flags);
+        if (!args.error().empty()) {
+            cerr << name << ": " << args.error() << "\nUsage: " << command.usage << endl;
+            return 2;
+        }
+        if (!args.arguments().empty() && command.run != commandMerge) {
+            cerr << name << ": unexpected argument '" << args.arguments()[0] << "'\nUsage: " << command.usage << endl;
+            return 2;
+        }
+        try {
+            return command.run(args);
+        } catch (const exception& e) {
+            // A corrupt filter file can make a loader ask for more memory than there is
+            cerr << name << ": " << e.what() << endl;
+            return 1;
+        }
+    }
+    cerr << "Unknown command: " << name << "\n\n";
+    printUsage(cerr);
+    return 2;
+}
+
+bool runQuickBenchmark(const FilterHandle& filter, size_t numOperations, ostream& out) {
+    FilterHandle testFilter = filter.emptyLike();
+    FilterHandle batchFilter = filter.emptyLike();
+    if (!testFilter || !batchFilter) {
+        return false;
+    }
+
+    out << "\nGenerating random test data..." << endl;
+    // Inserted keys, and keys that were never inserted (the prefixes keep them disjoint)
+    vector<string> testData;
+    vector<string> missData;
+
+    random_device rd;
+    mt19937 gen(rd());
+    uniform_int_distribution<> lenDist(5, 20);
+    uniform_int_distribution<> charDist(97, 122);
+
+    auto randomKey = [&](const string& prefix) {
+        int len = lenDist(gen);
+        string randomStr = prefix;
+        for (int j = 0; j < len; j++) {
+            randomStr.push_back(static_cast<char>(charDist(gen)));
+        }
+        randomStr += ".txt";
+        return randomStr;
+    };
+    for (size_t i = 0; i < numOperations; i++) {
+        testData.push_back(randomKey("bench_"));
+        missData.push_back(randomKey("miss_"));
+    }
+
+    vector<string_view> batch(testData.begin(), testData.end());
+    vector<string_view> missBatch(missData.begin(), missData.end());
+    unique_ptr<bool[]> results(new bool[numOperations]);
+
+    using Clock = chrono::steady_clock;
+    auto secondsSince = [](Clock::time_point start) {
+        return chrono::duration<double>(Clock::now() - start).count();
+    };
+
+    out << "Starting benchmark..." << endl;
+
+    // Filters are created above, so only the operations themselves are timed
+    auto start = Clock::now();
+    for (const auto& item : testData) {
+        testFilter.insert(item);
+    }
+    double insertSeconds = secondsSince(start);
+
+    start = Clock::now();
+    batchFilter.insertBatch(batch.data(), batch.size());
+    double batchInsertSeconds = secondsSince(start);
+
+    // Every result is counted so the lookups cannot be optimized away
+    auto timeSingleLookups = [&](const vector<string>& keys, size_t& positives) {
+        positives = 0;
+        auto lookupStart = Clock::now();
+        for (const auto& item : keys) {
+            positives += testFilter.mightContain(item);
+        }
+        return secondsSince(lookupStart);
+    };
+    auto timeBatchLookups = [&](const vector<string_view>& keys, size_t& positives) {
+        auto lookupStart = Clock::now();
+        batchFilter.mightContainBatch(keys.data(), keys.size(), results.get());
+        double seconds = secondsSince(lookupStart);
+        positives = static_cast<size_t>(count(results.get(), results.get() + keys.size(), true));
+        return seconds;
+    };
+
+    size_t hitPositives, missPositives, batchHitPositives, batchMissPositives;
+    double hitSeconds = timeSingleLookups(testData, hitPositives);
+    double missSeconds = timeSingleLookups(missData, missPositives);
+    double batchHitSeconds = timeBatchLookups(batch, batchHitPositives);
+    double batchMissSeconds = timeBatchLookups(missBatch, batchMissPositives);
+
+    auto opsPerSecond = [numOperations](double seconds) {
+        return seconds > 0 ? numOperations / seconds : 0.0;
+    };
+    auto printRow = [&](const string& operation, double single, double batched) {
+        out << setw(15) << operation << setprecision(6) << setw(18) << single
+            << setw(18) << batched << setprecision(0) << setw(18)
+            << opsPerSecond(single) << opsPerSecond(batched) << endl;
+    };
+
+    ios::fmtflags savedFlags = out.flags();
+    streamsize savedPrecision = out.precision();
+    out << "\n" << left << setw(15) << "Operation" << setw(18) << "Single (s)" << setw(18) << "Batch (s)"
+        << setw(18) << "Single (ops/s)" << "Batch (ops/s)" << endl;
+    out << fixed;
+    printRow("Insert", insertSeconds, batchInsertSeconds);
+    printRow("Lookup (hit)", hitSeconds, batchHitSeconds);
+    printRow("Lookup (miss)", missSeconds, batchMissSeconds);
+    out.flags(savedFlags);
+    out.precision(savedPrecision);
+
+    out << "Hits found: " << hitPositives << " single, " << batchHitPositives << " batch of " << numOperations << endl;
+    out << "False positives among misses: " << missPositives << " single, " << batchMissPositives << " batch" << endl;
+    return true;
+}
@@ -0,0 +1,24 @@
+#ifndef CLI_COMMANDS_H
+#define CLI_COMMANDS_H
+
+#include "filter_handle.h"
+#include <cstddef>
+#include <ostream>
+
+// Non-interactive mode: bloom_filter_checker <command> [options]
+//   build   build a filter from a list file (or stdin) and save it
+//   query   stream keys from stdin (or a file) and write one result per key
+//   stats   describe a saved filter
+//   bench   time inserts and lookups without prompts
+//   merge   OR (or AND) several filters of one type and geometry into one
+//   serve   answer batched lookups over TCP (see FilterServer)
+// Results go to stdout through large buffers; messages go to stderr. Returns the
+// process exit status: 0 on success, 1 on failure, 2 on a usage error.
+int runCommand(int argc, char** argv);
+
+// Time single and batched inserts and lookups (hits and misses) of numOperations
+// random keys on empty copies of filter, writing a table to out. False if the filter
+// type cannot be copied empty, e.g. a build-once StaticFilter.
+bool runQuickBenchmark(const FilterHandle& filter, size_t numOperations, std::ostream& out);
+
+#endif // CLI_COMMANDS_H
@@ -0,0 +1,215 @@
+#include "concurrent_bloom_filter.h"
+#include "atomic_file.h"
+#include "bloom_filter.h"
+#include "filter_format.h"
+#include "latency_profile.h"
+#include "probe_engine.h"
+#include "word_ops.h"
+#include <cmath>
+#include <fstream>
+#include <new>
+
+using namespace std;
+
+ConcurrentBloomFilter::ConcurrentBloomFilter(size_t filterSize, unsigned int numHashFunctions)
+    : bitArray(filterSize), size(filterSize), numHashes(numHashFunctions), powerOfTwo(isPowerOfTwo(filterSize)) {
+}
+
+ConcurrentBloomFilter ConcurrentBloomFilter::createOptimal(size_t expectedItems, double falsePositiveRate, bool roundToPowerOfTwo) {
+    size_t optimalSize;
+    unsigned int optimalHashes;
+    BloomFilter::computeOptimalParameters(expectedItems, falsePositiveRate, roundToPowerOfTwo, optimalSize, optimalHashes);
+    return ConcurrentBloomFilter(optimalSize, optimalHashes);
+}
+
+void ConcurrentBloomFilter::recountSetBits() {
+    setBits.store(popcountWords(bitArray.data(), bitArray.numWords()));
+}
+
+void ConcurrentBloomFilter::insertHashed(const HashPair& hp) {
+    size_t added = 0;
+    auto setBit = [this, &added](size_t index) {
+        added += bitArray.set(index);
+        return true;
+    };
+    if (powerOfTwo) {
+        ProbeEngine<Djb2SdbmHash, MaskReduction, 0>::forEachIndex(hp, size, numHashes, setBit);
+    } else {
+        ProbeEngine<Djb2SdbmHash, ModuloReduction, 0>::forEachIndex(hp, size, numHashes, setBit);
+    }
+    // Once a filter fills up most inserts change nothing and skip the counter
+    if (added) setBits.add(added);
+}
+
+bool ConcurrentBloomFilter::containsHashed(const HashPair& hp) const {
+    auto testBit = [this](size_t index) {
+        return bitArray.test(index);
+    };
+    if (powerOfTwo) {
+        return ProbeEngine<Djb2SdbmHash, MaskReduction, 0>::forEachIndex(hp, size, numHashes, testBit);
+    }
+    return ProbeEngine<Djb2SdbmHash, ModuloReduction, 0>::forEachIndex(hp, size, numHashes, testBit);
+}
+
+void ConcurrentBloomFilter::insert(string_view element) {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::Insert);
+    insertHashed(Djb2SdbmHash::hash(element.data(), element.size()));
+}
+
+void ConcurrentBloomFilter::insert(const void* data, size_t len) {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::Insert);
+    insertHashed(Djb2SdbmHash::hash(static_cast<const char*>(data), len));
+}
+
+void ConcurrentBloomFilter::insert(uint64_t key) {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::Insert);
+    insertHashed(Djb2SdbmHash::hashKey(key));
+}
+
+bool ConcurrentBloomFilter::mightContain(string_view element) const {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::Contains);
+    return containsHashed(Djb2SdbmHash::hash(element.data(), element.size()));
+}
+
+bool ConcurrentBloomFilter::mightContain(const void* data, size_t len) const {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::Contains);
+    return containsHashed(Djb2SdbmHash::hash(static_cast<const char*>(data), len));
+}
+
+bool ConcurrentBloomFilter::mightContain(uint64_t key) const {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::Contains);
+    return containsHashed(Djb2SdbmHash::hashKey(key));
+}
+
+double ConcurrentBloomFilter::getCurrentFalsePositiveRate(size_t insertedItems) const {
+    if (insertedItems == 0) return 0.0;
+    double exponent = -1.0 * numHashes * insertedItems / size;
+    return pow(1.0 - exp(exponent), numHashes);
+}
+
+bool ConcurrentBloomFilter::unionWith(const ConcurrentBloomFilter& other) {
+    if (size != other.size || numHashes != other.numHashes) return false;
+    orWords(bitArray.data(), other.bitArray.data(), bitArray.numWords());
+    recountSetBits();
+    return true;
+}
+
+bool ConcurrentBloomFilter::intersectWith(const ConcurrentBloomFilter& other) {
+    if (size != other.size || numHashes != other.numHashes) return false;
+    andWords(bitArray.data(), other.bitArray.data(), bitArray.numWords());
+    recountSetBits();
+    return true;
+}
+
+size_t ConcurrentBloomFilter::countSetBits() const {
+    return setBits.load();
+}
+
+double ConcurrentBloomFilter::getFillRatio() const {
+    return size ? static_cast<double>(countSetBits()) / size : 0.0;
+}
+
+double ConcurrentBloomFilter::getFalsePositiveRateFromFill() const {
+    return pow(getFillRatio(), numHashes);
+}
+
+double ConcurrentBloomFilter::estimateCardinality() const {
+    return estimateItemsFromBits(size, numHashes, countSetBits());
+}
+
+size_t ConcurrentBloomFilter::getSize() const {
+    return size;
+}
+
+unsigned int ConcurrentBloomFilter::getNumHashes() const {
+    return numHashes;
+}
+
+void ConcurrentBloomFilter::clear() {
+    bitArray.reset();
+    setBits.store(0);
+}
+
+bool ConcurrentBloomFilter::applyDelta(const FilterDelta& delta) {
+    if (delta.getSizeBits() != size || delta.getNumHashes() != numHashes) {
+        return false;
+    }
+
+    size_t added = 0;
+    delta.forEachWord([this, &added](size_t index, uint64_t bits) {
+        added += __builtin_popcountll(bitArray.orWord(index, bits));
+    });
+    setBits.add(added);
+    return true;
+}
+
+bool ConcurrentBloomFilter::saveToFile(const string& filename, bool compress) const {
+    return writeFileAtomically(filename, [this, compress](ostream& out) {
+        return writeFilterFile(out, FilterKind::Standard, Djb2SdbmHash::id, size, numHashes, bitArray, compress);
+    });
+}
+
+future<bool> ConcurrentBloomFilter::snapshotAsync(const string& filename, bool compress) const {
+    return async(launch::async, [this, filename, compress] {
+        // Copy first: the compressed writer makes two passes over the words, and both
+        // must see the same bits
+        BitStorage snapshot;
+        try {
+            snapshot = BitStorage(size);
+        } catch (const bad_alloc&) {
+            return false;
+        }
+        for (size_t i = 0; i < bitArray.numWords(); i++) snapshot.storeWord(i, bitArray.word(i));
+        return writeFileAtomically(filename, [this, &snapshot, compress](ostream& out) {
+            return writeFilterFile(out, FilterKind::Standard, Djb2SdbmHash::id, size, numHashes, snapshot, compress);
+        });
+    });
+}
+
+ConcurrentBloomFilter* ConcurrentBloomFilter::loadFromFile(const string& filename) {
+    ifstream inFile(filename, ios::binary);
+
+    if (!inFile.is_open()) {
+        return nullptr;
+    }
+
+    if (peekFilterMagic(inFile)) {
+        FilterFileHeader header;
+        if (!readFilterHeader(inFile, header) ||
+            header.kind != static_cast<uint32_t>(FilterKind::Standard) ||
+            header.hashPolicy != static_cast<uint32_t>(Djb2SdbmHash::id)) {
+            return nullptr;
+        }
+
+        ConcurrentBloomFilter* loadedFilter = new ConcurrentBloomFilter(header.sizeBits, header.numHashes);
+        if (!readFilterPayload(inFile, header, loadedFilter->bitArray)) {
+            delete loadedFilter;
+            return nullptr;
+        }
+        loadedFilter->recountSetBits();
+        return loadedFilter;
+    }
+
+    // Original layout: size, numHashes, byte-packed bits
+    size_t loadedSize;
+    unsigned int loadedNumHashes;
+
+    inFile.read(reinterpret_cast<char*>(&loadedSize), sizeof(loadedSize));
+    inFile.read(reinterpret_cast<char*>(&loadedNumHashes), sizeof(loadedNumHashes));
+
+    // The packed bits must all be there before any of them is allocated
+    if (inFile.fail() || loadedSize == 0 || loadedNumHashes == 0 ||
+        !streamHolds(inFile, loadedSize / 8 + (loadedSize % 8 != 0))) {
+        return nullptr;
+    }
+
+    ConcurrentBloomFilter* loadedFilter = new ConcurrentBloomFilter(loadedSize, loadedNumHashes);
+
+    if (!loadedFilter->bitArray.readPacked(inFile)) {
+        delete loadedFilter;
+        return nullptr;
+    }
+
+    loadedFilter->recountSetBits();
+    return loadedFilter;
+}
@@ -0,0 +1,98 @@
+#ifndef CONCURRENT_BLOOM_FILTER_H
+#define CONCURRENT_BLOOM_FILTER_H
+
+#include "bit_storage.h"
+#include "filter_delta.h"
+#include "hash_policy.h"
+#include "sharded_counter.h"
+#include <future>
+#include <string>
+#include <string_view>
+
+// Thread-safe Bloom filter.
+// insert() sets bits with relaxed atomic fetch_or and mightContain() uses relaxed
+// loads, so any number of writer and reader threads can share one filter without a
+// mutex. A key is visible to readers once the inserting call returns. Bit positions
+// and the file format are identical to BloomFilter, so files can be saved by one
+// class and loaded by the other.
+class ConcurrentBloomFilter {
+private:
+    AtomicBitStorage bitArray;
+    size_t size;
+    unsigned int numHashes;
+    bool powerOfTwo;
+
+    // Bits set, counted by the inserting threads on shards of their own
+    ShardedCounter setBits;
+
+    void recountSetBits();
+
+    void insertHashed(const HashPair& hp);
+    bool containsHashed(const HashPair& hp) const;
+
+public:
+    // Constructor with specified size and number of hash functions
+    ConcurrentBloomFilter(size_t filterSize, unsigned int numHashFunctions);
+
+    // Static method that calculates optimal parameters based on expected items and false positive rate
+    static ConcurrentBloomFilter createOptimal(size_t expectedItems, double falsePositiveRate, bool roundToPowerOfTwo = false);
+
+    // Insert an element; safe to call from many threads at once. Raw bytes and
+    // integer keys (hashed as their 8 little-endian bytes) set the same bits as in BloomFilter.
+    void insert(std::string_view element);
+    void insert(const void* data, size_t len);
+    void insert(uint64_t key);
+
+    // Check if an element might be in the set; lock-free
+    bool mightContain(std::string_view element) const;
+    bool mightContain(const void* data, size_t len) const;
+    bool mightContain(uint64_t key) const;
+
+    // Get current false positive probability based on items inserted
+    double getCurrentFalsePositiveRate(size_t insertedItems) const;
+
+    // Get size of the bit array
+    size_t getSize() const;
+
+    // Get number of hash functions
+    unsigned int getNumHashes() const;
+
+    // Reset the filter; callers must make sure no inserts run concurrently
+    void clear();
+
+    // OR / AND another filter of the same size and hash count into this one, word by
+    // word with relaxed atomics; inserts and queries may run concurrently. An insert
+    // racing intersectWith may lose bits that other does not have, and inserts racing
+    // either one may be left out of the recounted set-bit total. False on a mismatch.
+    bool unionWith(const ConcurrentBloomFilter& other);
+    bool intersectWith(const ConcurrentBloomFilter& other);
+
+    // Number of bits set (O(1), from the running count), the fill ratio and FPR it
+    // implies, and the item count estimated from it; see BloomFilter
+    size_t countSetBits() const;
+    double getFillRatio() const;
+    double getFalsePositiveRateFromFill() const;
+    double estimateCardinality() const;
+
+    // OR a delta from BloomFilter::diffSince into the live filter; queries and inserts
+    // may run concurrently and see each word either before or after its update.
+    // False if the geometry differs.
+    bool applyDelta(const FilterDelta& delta);
+
+    // Save filter state to a file (same format as BloomFilter::saveToFile)
+    bool saveToFile(const std::string& filename, bool compress = false) const;
+
+    // Save without stopping writers: a background thread copies the bits word by word
+    // into a private buffer (getSize() / 8 bytes, held until the write finishes) and
+    // then writes it exactly as saveToFile would. Bits only ever turn on, so the file
+    // holds every key inserted before the call, plus any subset of the inserts that
+    // race the copy; only clear() or intersectWith() running concurrently can leave a
+    // mix. The future yields false if the copy or the write fails; the filter must
+    // outlive it.
+    std::future<bool> snapshotAsync(const std::string& filename, bool compress = false) const;
+
+    // Load filter state from a file written by either filter class
+    static ConcurrentBloomFilter* loadFromFile(const std::string& filename);
+};
+
+#endif // CONCURRENT_BLOOM_FILTER_H
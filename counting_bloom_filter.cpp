@@ -0,0 +1,157 @@
+#include "counting_bloom_filter.h"
+#include "bloom_filter.h"
+#include "probe_engine.h"
+#include <cmath>
+
+using namespace std;
+
+namespace {
+
+constexpr unsigned int kCountersPerWord = 64 / CountingBloomFilter::kCounterBits;
+
+// Low bit of every nibble that holds a non-zero counter
+inline uint64_t nonZeroNibbles(uint64_t word) {
+    word |= word >> 1;
+    word |= word >> 2;
+    return word & 0x1111111111111111ULL;
+}
+
+// Gather bits 0, 4, ..., 60 into the low 16 bits
+inline uint64_t packNibbleFlags(uint64_t flags) {
+    flags = (flags | (flags >> 3)) & 0x0303030303030303ULL;
+    flags = (flags | (flags >> 6)) & 0x000F000F000F000FULL;
+    flags = (flags | (flags >> 12)) & 0x000000FF000000FFULL;
+    flags = (flags | (flags >> 24)) & 0x000000000000FFFFULL;
+    return flags;
+}
+
+} // namespace
+
+CountingBloomFilter::CountingBloomFilter(size_t filterSize, unsigned int numHashFunctions)
+    : counters(filterSize * kCounterBits), size(filterSize), numHashes(numHashFunctions),
+      powerOfTwo(isPowerOfTwo(filterSize)) {
+}
+
+CountingBloomFilter CountingBloomFilter::createOptimal(size_t expectedItems, double falsePositiveRate, bool roundToPowerOfTwo) {
+    size_t optimalSize;
+    unsigned int optimalHashes;
+    BloomFilter::computeOptimalParameters(expectedItems, falsePositiveRate, roundToPowerOfTwo, optimalSize, optimalHashes);
+    return CountingBloomFilter(optimalSize, optimalHashes);
+}
+
+template <typename Visit>
+bool CountingBloomFilter::forEachIndex(const HashPair& hp, Visit visit) const {
+    if (powerOfTwo) {
+        return ProbeEngine<Djb2SdbmHash, MaskReduction, 0>::forEachIndex(hp, size, numHashes, visit);
+    }
+    return ProbeEngine<Djb2SdbmHash, ModuloReduction, 0>::forEachIndex(hp, size, numHashes, visit);
+}
+
+void CountingBloomFilter::insertHashed(const HashPair& hp) {
+    uint64_t* words = counters.data();
+    forEachIndex(hp, [words](size_t index) {
+        uint64_t& word = words[index / kCountersPerWord];
+        unsigned int shift = (index % kCountersPerWord) * kCounterBits;
+        if (((word >> shift) & kMaxCount) != kMaxCount) word += uint64_t(1) << shift;
+        return true;
+    });
+}
+
+bool CountingBloomFilter::removeHashed(const HashPair& hp) {
+    if (!containsHashed(hp)) return false;
+
+    uint64_t* words = counters.data();
+    forEachIndex(hp, [words](size_t index) {
+        uint64_t& word = words[index / kCountersPerWord];
+        unsigned int shift = (index % kCountersPerWord) * kCounterBits;
+        uint64_t count = (word >> shift) & kMaxCount;
+        // Saturated counters have lost track of their true count; leave them set.
+        // A counter already at zero means a repeated probe of this key emptied it.
+        if (count != kMaxCount && count != 0) word -= uint64_t(1) << shift;
+        return true;
+    });
+    return true;
+}
+
+bool CountingBloomFilter::containsHashed(const HashPair& hp) const {
+    return forEachIndex(hp, [this](size_t index) {
+        return counterAt(index) != 0;
+    });
+}
+
+void CountingBloomFilter::insert(string_view element) {
+    insertHashed(Djb2SdbmHash::hash(element.data(), element.size()));
+}
+
+void CountingBloomFilter::insert(const void* data, size_t len) {
+    insertHashed(Djb2SdbmHash::hash(static_cast<const char*>(data), len));
+}
+
+void CountingBloomFilter::insert(uint64_t key) {
+    insertHashed(Djb2SdbmHash::hashKey(key));
+}
+
+bool CountingBloomFilter::remove(string_view element) {
+    return removeHashed(Djb2SdbmHash::hash(element.data(), element.size()));
+}
+
+bool CountingBloomFilter::remove(const void* data, size_t len) {
+    return removeHashed(Djb2SdbmHash::hash(static_cast<const char*>(data), len));
+}
+
+bool CountingBloomFilter::remove(uint64_t key) {
+    return removeHashed(Djb2SdbmHash::hashKey(key));
+}
+
+bool CountingBloomFilter::mightContain(string_view element) const {
+    return containsHashed(Djb2SdbmHash::hash(element.data(), element.size()));
+}
+
+bool CountingBloomFilter::mightContain(const void* data, size_t len) const {
+    return containsHashed(Djb2SdbmHash::hash(static_cast<const char*>(data), len));
+}
+
+bool CountingBloomFilter::mightContain(uint64_t key) const {
+    return containsHashed(Djb2SdbmHash::hashKey(key));
+}
+
+unsigned int CountingBloomFilter::counterAt(size_t index) const {
+    uint64_t word = counters.data()[index / kCountersPerWord];
+    return (word >> ((index % kCountersPerWord) * kCounterBits)) & kMaxCount;
+}
+
+double CountingBloomFilter::getCurrentFalsePositiveRate(size_t insertedItems) const {
+    if (insertedItems == 0) return 0.0;
+    double exponent = -1.0 * numHashes * insertedItems / size;
+    return pow(1.0 - exp(exponent), numHashes);
+}
+
+size_t CountingBloomFilter::getSize() const {
+    return size;
+}
+
+unsigned int CountingBloomFilter::getNumHashes() const {
+    return numHashes;
+}
+
+void CountingBloomFilter::clear() {
+    counters.reset();
+}
+
+BloomFilter CountingBloomFilter::toBloomFilter() const {
+    BloomFilter snapshot(size, numHashes);
+    uint64_t* bits = snapshot.bitArray.data();
+    const uint64_t* words = counters.data();
+    const size_t counterWords = counters.numWords();
+
+    // Four counter words reduce to one bit word; branch-free so the loop vectorizes
+    for (size_t i = 0; i < snapshot.bitArray.numWords(); i++) {
+        uint64_t bitWord = 0;
+        for (size_t j = 0; j < 4 && i * 4 + j < counterWords; j++) {
+            bitWord |= packNibbleFlags(nonZeroNibbles(words[i * 4 + j])) << (j * kCountersPerWord);
+        }
+        bits[i] = bitWord;
+    }
+    snapshot.recountSetBits();
+    return snapshot;
+}
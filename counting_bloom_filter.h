@@ -0,0 +1,78 @@
+#ifndef COUNTING_BLOOM_FILTER_H
+#define COUNTING_BLOOM_FILTER_H
+
+#include "bit_storage.h"
+#include "hash_policy.h"
+#include <string>
+#include <string_view>
+
+class BloomFilter;
+
+// Bloom filter with a 4-bit counter per position, so keys can be removed.
+// Counters are packed 16 to a 64-bit word, which keeps the array at 4x the size of a
+// BloomFilter and lets whole words be reduced at once when exporting. A counter that
+// reaches 15 saturates and is never decremented again: that costs a little accuracy
+// after heavy churn but can never produce a false negative. Bit positions match
+// BloomFilter, so toBloomFilter() gives a 1-bit snapshot with identical answers.
+class CountingBloomFilter {
+private:
+    BitStorage counters;
+    size_t size;
+    unsigned int numHashes;
+    bool powerOfTwo;
+
+    template <typename Visit>
+    bool forEachIndex(const HashPair& hp, Visit visit) const;
+
+    void insertHashed(const HashPair& hp);
+    bool removeHashed(const HashPair& hp);
+    bool containsHashed(const HashPair& hp) const;
+
+public:
+    static constexpr unsigned int kCounterBits = 4;
+    static constexpr unsigned int kMaxCount = (1u << kCounterBits) - 1;
+
+    // Constructor with specified size and number of hash functions
+    CountingBloomFilter(size_t filterSize, unsigned int numHashFunctions);
+
+    // Static method that calculates optimal parameters based on expected items and false positive rate
+    static CountingBloomFilter createOptimal(size_t expectedItems, double falsePositiveRate, bool roundToPowerOfTwo = false);
+
+    // Insert an element into the filter. Raw bytes and integer keys (hashed as their
+    // 8 little-endian bytes) use the same positions as in BloomFilter.
+    void insert(std::string_view element);
+    void insert(const void* data, size_t len);
+    void insert(uint64_t key);
+
+    // Remove a previously inserted element. Returns false (and changes nothing) if the
+    // element is definitely not in the filter. Removing a key that was never inserted
+    // but happens to test positive can introduce false negatives for other keys.
+    bool remove(std::string_view element);
+    bool remove(const void* data, size_t len);
+    bool remove(uint64_t key);
+
+    // Check if an element might be in the set
+    bool mightContain(std::string_view element) const;
+    bool mightContain(const void* data, size_t len) const;
+    bool mightContain(uint64_t key) const;
+
+    // Counter value at a position (for diagnostics)
+    unsigned int counterAt(size_t index) const;
+
+    // Get current false positive probability based on items inserted
+    double getCurrentFalsePositiveRate(size_t insertedItems) const;
+
+    // Get size (number of counters)
+    size_t getSize() const;
+
+    // Get number of hash functions
+    unsigned int getNumHashes() const;
+
+    // Reset every counter
+    void clear();
+
+    // Plain BloomFilter with a bit set wherever a counter is non-zero
+    BloomFilter toBloomFilter() const;
+};
+
+#endif // COUNTING_BLOOM_FILTER_H
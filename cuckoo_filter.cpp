@@ -0,0 +1,269 @@
+#include "cuckoo_filter.h"
+#include "atomic_file.h"
+#include "filter_format.h"
+#include "hash_policy.h"
+#include "probe_engine.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <memory>
+
+using namespace std;
+
+namespace {
+
+constexpr uint64_t kLaneOnes = 0x0001000100010001ULL;
+constexpr uint64_t kLaneHighs = 0x8000800080008000ULL;
+constexpr uint64_t kVictimUsed = uint64_t(1) << 63;
+constexpr double kTargetLoad = 0.95;
+
+// High bit of the lowest lane that is zero is always exact; higher flags may be
+// borrow artefacts, so callers only ever use "any" or the lowest set flag
+inline uint64_t zeroLanes(uint64_t word) {
+    return (word - kLaneOnes) & ~word & kLaneHighs;
+}
+
+inline uint64_t matchingLanes(uint64_t word, uint16_t fingerprint) {
+    return zeroLanes(word ^ (fingerprint * kLaneOnes));
+}
+
+inline unsigned int lowestLane(uint64_t lanes) {
+    return __builtin_ctzll(lanes) / CuckooFilter::kFingerprintBits;
+}
+
+inline uint64_t mixFingerprint(uint64_t h) {
+    h *= 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    return h ^ (h >> 32);
+}
+
+bool isCuckooHeader(const FilterFileHeader& header) {
+    if (header.kind != static_cast<uint32_t>(FilterKind::Cuckoo) ||
+        header.hashPolicy != static_cast<uint32_t>(WyHash::id) ||
+        header.sizeBits % BitStorage::kBitsPerWord != 0) {
+        return false;
+    }
+    // At least one bucket plus the victim word
+    return header.sizeBits / BitStorage::kBitsPerWord >= 2;
+}
+
+} // namespace
+
+CuckooFilter::CuckooFilter(size_t numBuckets)
+    : CuckooFilter(BitStorage((max<size_t>(numBuckets, 1) + 1) * BitStorage::kBitsPerWord)) {
+}
+
+CuckooFilter::CuckooFilter(BitStorage storage)
+    : buckets(move(storage)), numBuckets(buckets.numWords() - 1), itemCount(0), kickState(0x2545f4914f6cdd1dULL),
+      victimUsed(false), victimFingerprint(0), victimBucket(0) {
+}
+
+CuckooFilter CuckooFilter::createOptimal(size_t expectedItems) {
+    size_t slotsNeeded = static_cast<size_t>(ceil(expectedItems / kTargetLoad));
+    return CuckooFilter((slotsNeeded + kSlotsPerBucket - 1) / kSlotsPerBucket);
+}
+
+void CuckooFilter::locate(const char* key, size_t len, size_t& bucket, uint16_t& fingerprint) const {
+    uint64_t h = WyHash::hash64(key, len);
+    bucket = FastRangeReduction::reduce(h, numBuckets);
+    // The bucket comes from the high bits, the fingerprint from the low ones.
+    // Zero marks an empty slot, so fingerprints are never zero.
+    fingerprint = static_cast<uint16_t>(h);
+    if (fingerprint == 0) fingerprint = 1;
+}
+
+size_t CuckooFilter::alternateBucket(size_t bucket, uint16_t fingerprint) const {
+    // (t - bucket) mod numBuckets is its own inverse, so either bucket finds the other
+    // without requiring a power-of-two table
+    size_t t = FastRangeReduction::reduce(mixFingerprint(fingerprint), numBuckets);
+    return t >= bucket ? t - bucket : t + numBuckets - bucket;
+}
+
+bool CuckooFilter::insertFingerprint(size_t bucket, uint16_t fingerprint) {
+    uint64_t& word = buckets.data()[bucket];
+    uint64_t empty = zeroLanes(word);
+    if (!empty) return false;
+    word |= uint64_t(fingerprint) << (lowestLane(empty) * kFingerprintBits);
+    return true;
+}
+
+bool CuckooFilter::removeFingerprint(size_t bucket, uint16_t fingerprint) {
+    uint64_t& word = buckets.data()[bucket];
+    uint64_t match = matchingLanes(word, fingerprint);
+    if (!match) return false;
+    word &= ~(uint64_t(0xffff) << (lowestLane(match) * kFingerprintBits));
+    return true;
+}
+
+void CuckooFilter::storeVictim() {
+    uint64_t descriptor = 0;
+    if (victimUsed) descriptor = kVictimUsed | (uint64_t(victimBucket) << kFingerprintBits) | victimFingerprint;
+    buckets.storeWord(numBuckets, descriptor);
+}
+
+bool CuckooFilter::insert(string_view element) {
+    if (victimUsed) return false;
+
+    size_t bucket;
+    uint16_t fingerprint;
+    locate(element.data(), element.size(), bucket, fingerprint);
+
+    if (insertFingerprint(bucket, fingerprint)) {
+        itemCount++;
+        return true;
+    }
+    bucket = alternateBucket(bucket, fingerprint);
+    for (unsigned int kick = 0; kick < kMaxKicks; kick++) {
+        if (insertFingerprint(bucket, fingerprint)) {
+            itemCount++;
+            return true;
+        }
+        // Evict a pseudo-random slot and carry its fingerprint to its other bucket
+        kickState ^= kickState << 13;
+        kickState ^= kickState >> 7;
+        kickState ^= kickState << 17;
+        unsigned int shift = (kickState % kSlotsPerBucket) * kFingerprintBits;
+        uint64_t& word = buckets.data()[bucket];
+        uint16_t evicted = static_cast<uint16_t>(word >> shift);
+        word = (word & ~(uint64_t(0xffff) << shift)) | (uint64_t(fingerprint) << shift);
+        fingerprint = evicted;
+        bucket = alternateBucket(bucket, fingerprint);
+    }
+
+    // Keep the homeless fingerprint so no earlier key turns into a false negative
+    victimUsed = true;
+    victimFingerprint = fingerprint;
+    victimBucket = bucket;
+    storeVictim();
+    itemCount++;
+    return false;
+}
+
+bool CuckooFilter::remove(string_view element) {
+    size_t bucket;
+    uint16_t fingerprint;
+    locate(element.data(), element.size(), bucket, fingerprint);
+    size_t alternate = alternateBucket(bucket, fingerprint);
+
+    if (removeFingerprint(bucket, fingerprint) || removeFingerprint(alternate, fingerprint)) {
+        itemCount--;
+        // The freed slot may give the victim a home again
+        if (victimUsed && (insertFingerprint(victimBucket, victimFingerprint) ||
+                           insertFingerprint(alternateBucket(victimBucket, victimFingerprint), victimFingerprint))) {
+            victimUsed = false;
+            storeVictim();
+        }
+        return true;
+    }
+    if (victimUsed && victimFingerprint == fingerprint && (victimBucket == bucket || victimBucket == alternate)) {
+        victimUsed = false;
+        storeVictim();
+        itemCount--;
+        return true;
+    }
+    return false;
+}
+
+bool CuckooFilter::containsFingerprint(size_t bucket, size_t alternate, uint16_t fingerprint) const {
+    const uint64_t* words = buckets.data();
+    if (matchingLanes(words[bucket], fingerprint) | matchingLanes(words[alternate], fingerprint)) return true;
+    return victimUsed && victimFingerprint == fingerprint && (victimBucket == bucket || victimBucket == alternate);
+}
+
+bool CuckooFilter::mightContain(string_view element) const {
+    size_t bucket;
+    uint16_t fingerprint;
+    locate(element.data(), element.size(), bucket, fingerprint);
+    return containsFingerprint(bucket, alternateBucket(bucket, fingerprint), fingerprint);
+}
+
+void CuckooFilter::mightContainBatch(const string_view* elements, size_t count, bool* results) const {
+    size_t primaries[kBatchWindow], alternates[kBatchWindow];
+    uint16_t fingerprints[kBatchWindow];
+    const uint64_t* words = buckets.data();
+
+    for (size_t base = 0; base < count; base += kBatchWindow) {
+        size_t n = min(kBatchWindow, count - base);
+        for (size_t j = 0; j < n; j++) {
+            locate(elements[base + j].data(), elements[base + j].size(), primaries[j], fingerprints[j]);
+            alternates[j] = alternateBucket(primaries[j], fingerprints[j]);
+            __builtin_prefetch(words + primaries[j], 0);
+            __builtin_prefetch(words + alternates[j], 0);
+        }
+        for (size_t j = 0; j < n; j++) {
+            results[base + j] = containsFingerprint(primaries[j], alternates[j], fingerprints[j]);
+        }
+    }
+}
+
+double CuckooFilter::getCurrentFalsePositiveRate() const {
+    // Each of the two buckets compares against its occupied slots
+    double occupied = 2.0 * kSlotsPerBucket * getLoadFactor();
+    return 1.0 - pow(1.0 - 1.0 / ((1u << kFingerprintBits) - 1), occupied);
+}
+
+size_t CuckooFilter::getItemCount() const {
+    return itemCount;
+}
+
+size_t CuckooFilter::getSize() const {
+    return numBuckets * 64;
+}
+
+double CuckooFilter::getLoadFactor() const {
+    return static_cast<double>(itemCount) / (numBuckets * kSlotsPerBucket);
+}
+
+bool CuckooFilter::isFull() const {
+    return victimUsed;
+}
+
+void CuckooFilter::clear() {
+    buckets.reset();
+    itemCount = 0;
+    victimUsed = false;
+}
+
+bool CuckooFilter::saveToFile(const string& filename) const {
+    return writeFileAtomically(filename, [this](ostream& out) {
+        return writeFilterFile(out, FilterKind::Cuckoo, WyHash::id, buckets.size(), 2, buckets);
+    });
+}
+
+CuckooFilter* CuckooFilter::loadFromFile(const string& filename) {
+    ifstream inFile(filename, ios::binary);
+
+    if (!inFile.is_open()) {
+        return nullptr;
+    }
+
+    FilterFileHeader header;
+    if (!readFilterHeader(inFile, header) || !isCuckooHeader(header)) {
+        return nullptr;
+    }
+
+    unique_ptr<CuckooFilter> loaded(new CuckooFilter(BitStorage(header.sizeBits)));
+    if (!readFilterPayload(inFile, header, loaded->buckets)) {
+        return nullptr;
+    }
+
+    uint64_t descriptor = loaded->buckets.word(loaded->numBuckets);
+    loaded->victimUsed = (descriptor & kVictimUsed) != 0;
+    loaded->victimFingerprint = static_cast<uint16_t>(descriptor);
+    loaded->victimBucket = static_cast<size_t>((descriptor & ~kVictimUsed) >> kFingerprintBits);
+    if (loaded->victimUsed && (loaded->victimFingerprint == 0 || loaded->victimBucket >= loaded->numBuckets)) {
+        return nullptr;
+    }
+
+    // Recount occupied slots; a lane is non-zero exactly when it holds a fingerprint
+    size_t occupied = loaded->victimUsed ? 1 : 0;
+    for (size_t i = 0; i < loaded->numBuckets; i++) {
+        uint64_t word = loaded->buckets.word(i);
+        for (unsigned int lane = 0; lane < kSlotsPerBucket; lane++) {
+            occupied += ((word >> (lane * kFingerprintBits)) & 0xffff) != 0;
+        }
+    }
+    loaded->itemCount = occupied;
+    return loaded.release();
+}
@@ -0,0 +1,130 @@
+#include "filter_delta.h"
+#include "atomic_file.h"
+#include "checksum.h"
+#include "filter_format.h"
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+
+namespace {
+
+constexpr char kDeltaMagic[8] = {'B', 'L', 'O', 'O', 'M', 'D', 'L', 'T'};
+constexpr uint32_t kDeltaVersion = 1;
+
+struct DeltaFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t numHashes;
+    uint64_t sizeBits;
+    uint64_t bitCount;
+    uint64_t encodedBytes;
+    uint32_t checksum;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(DeltaFileHeader) == 48, "delta header layout is part of the file format");
+
+} // namespace
+
+FilterDelta::FilterDelta(uint64_t filterSize, uint32_t numHashFunctions)
+    : sizeBits(filterSize), numHashes(numHashFunctions), bitCount(0), lastBit(0) {
+}
+
+void FilterDelta::appendBit(uint64_t position) {
+    uint64_t gap = bitCount == 0 ? position : position - lastBit;
+    do {
+        uint8_t byte = gap & 0x7f;
+        gap >>= 7;
+        encoded.push_back(gap ? byte | 0x80 : byte);
+    } while (gap);
+    lastBit = position;
+    bitCount++;
+}
+
+bool FilterDelta::validate(uint64_t& last) const {
+    uint64_t position = 0;
+    size_t i = 0;
+    for (uint64_t n = 0; n < bitCount; n++) {
+        uint64_t gap = 0;
+        for (unsigned shift = 0;; shift += 7) {
+            if (i >= encoded.size() || shift > 63) return false;
+            uint8_t byte = encoded[i++];
+            gap |= uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) break;
+        }
+        // Positions strictly increase after the first and stay inside the filter
+        if (n > 0 && gap == 0) return false;
+        if (gap >= sizeBits || (n > 0 && position >= sizeBits - gap)) return false;
+        position = n == 0 ? gap : position + gap;
+    }
+    last = position;
+    return i == encoded.size();
+}
+
+bool FilterDelta::writeTo(ostream& out) const {
+    DeltaFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kDeltaMagic, sizeof(kDeltaMagic));
+    header.version = kDeltaVersion;
+    header.numHashes = numHashes;
+    header.sizeBits = sizeBits;
+    header.bitCount = bitCount;
+    header.encodedBytes = encoded.size();
+    header.checksum = crc32c(0, encoded.data(), encoded.size());
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(encoded.data()), encoded.size());
+    return !out.fail();
+}
+
+bool FilterDelta::readFrom(istream& in, FilterDelta& delta) {
+    DeltaFileHeader header;
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (in.fail() || memcmp(header.magic, kDeltaMagic, sizeof(kDeltaMagic)) != 0 ||
+        header.version != kDeltaVersion || header.sizeBits == 0) {
+        return false;
+    }
+    // Each bit is set at most once, and its gap takes at least one byte and at most ten
+    if (header.bitCount > header.sizeBits || header.encodedBytes < header.bitCount ||
+        header.encodedBytes / 10 + (header.encodedBytes % 10 != 0) > header.bitCount) {
+        return false;
+    }
+    // The gaps must all be there before they are allocated
+    if (!streamHolds(in, header.encodedBytes)) {
+        return false;
+    }
+
+    FilterDelta loaded(header.sizeBits, header.numHashes);
+    loaded.encoded.resize(header.encodedBytes);
+    in.read(reinterpret_cast<char*>(loaded.encoded.data()), header.encodedBytes);
+    if (in.fail() || crc32c(0, loaded.encoded.data(), loaded.encoded.size()) != header.checksum) {
+        return false;
+    }
+    loaded.bitCount = header.bitCount;
+    if (!loaded.validate(loaded.lastBit)) return false;
+
+    delta = move(loaded);
+    return true;
+}
+
+bool FilterDelta::saveToFile(const string& filename) const {
+    return writeFileAtomically(filename, [this](ostream& out) {
+        return writeTo(out);
+    });
+}
+
+FilterDelta* FilterDelta::loadFromFile(const string& filename) {
+    ifstream inFile(filename, ios::binary);
+
+    if (!inFile.is_open()) {
+        return nullptr;
+    }
+
+    FilterDelta* delta = new FilterDelta();
+    if (!readFrom(inFile, *delta)) {
+        delete delta;
+        return nullptr;
+    }
+    return delta;
+}
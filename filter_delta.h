@@ -0,0 +1,83 @@
+#ifndef FILTER_DELTA_H
+#define FILTER_DELTA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Bits a filter gained since an earlier version of itself.
+// Only the newly set bit positions are kept, each as a LEB128 varint gap from the
+// previous one, so a few thousand inserts into a multi-gigabyte filter cost a few
+// bytes per new bit. Deltas only ever add bits, which is all a Bloom filter does,
+// so applying one is a word-wise OR and applying it twice is harmless.
+//
+// File layout: "BLOOMDLT", uint32 version, uint32 numHashes, uint64 sizeBits,
+// uint64 bitCount, uint64 encoded bytes, uint32 CRC32C of the encoded bytes,
+// then the encoded gaps.
+class FilterDelta {
+private:
+    uint64_t sizeBits;
+    uint32_t numHashes;
+    uint64_t bitCount;
+    uint64_t lastBit;
+    std::vector<uint8_t> encoded;
+
+    // True if the encoded gaps stay inside sizeBits and match bitCount; reports the last position
+    bool validate(uint64_t& last) const;
+
+public:
+    FilterDelta(uint64_t filterSize = 0, uint32_t numHashFunctions = 0);
+
+    // Record a newly set bit; positions must be appended in increasing order
+    void appendBit(uint64_t position);
+
+    // Visit the changed words in increasing order as visit(wordIndex, newBits)
+    template <typename Visit>
+    void forEachWord(Visit visit) const {
+        uint64_t position = 0;
+        size_t currentWord = SIZE_MAX;
+        uint64_t bits = 0;
+        for (size_t i = 0, n = 0; n < bitCount; n++) {
+            uint64_t gap = 0;
+            for (unsigned shift = 0;; shift += 7) {
+                uint8_t byte = encoded[i++];
+                gap |= uint64_t(byte & 0x7f) << shift;
+                if (!(byte & 0x80)) break;
+            }
+            position = n == 0 ? gap : position + gap;
+
+            size_t word = static_cast<size_t>(position >> 6);
+            if (word != currentWord) {
+                if (currentWord != SIZE_MAX) visit(currentWord, bits);
+                currentWord = word;
+                bits = 0;
+            }
+            bits |= uint64_t(1) << (position & 63);
+        }
+        if (currentWord != SIZE_MAX) visit(currentWord, bits);
+    }
+
+    uint64_t getSizeBits() const { return sizeBits; }
+    uint32_t getNumHashes() const { return numHashes; }
+
+    // Number of new bits carried
+    uint64_t getBitCount() const { return bitCount; }
+
+    // Encoded size in bytes (what goes over the wire, less a fixed header)
+    size_t getEncodedBytes() const { return encoded.size(); }
+
+    bool empty() const { return bitCount == 0; }
+
+    // Serialize to / parse from a stream; readFrom verifies the checksum and encoding
+    bool writeTo(std::ostream& out) const;
+    static bool readFrom(std::istream& in, FilterDelta& delta);
+
+    // Save to a file (atomically replaced) / load from one; nullptr on failure
+    bool saveToFile(const std::string& filename) const;
+    static FilterDelta* loadFromFile(const std::string& filename);
+};
+
+#endif // FILTER_DELTA_H
@@ -0,0 +1,345 @@
+#include "filter_format.h"
+#include "checksum.h"
+#include <cstring>
+
+using namespace std;
+
+namespace {
+
+// Container tags in a compressed snapshot
+constexpr uint8_t kContainerEmpty = 0;
+constexpr uint8_t kContainerArray = 1;
+constexpr uint8_t kContainerBitmap = 2;
+
+// Set bits staged per write/read call for array containers
+constexpr size_t kArrayBatch = 512;
+
+inline uint64_t toLittleEndian(uint64_t word) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap64(word);
+#else
+    return word;
+#endif
+}
+
+inline uint16_t toLittleEndian16(uint16_t value) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap16(value);
+#else
+    return value;
+#endif
+}
+
+size_t countBits(const uint64_t* words, size_t count) {
+    size_t bits = 0;
+    for (size_t i = 0; i < count; i++) bits += __builtin_popcountll(words[i]);
+    return bits;
+}
+
+// An array container pays 2 bytes per set bit against 8 per word for a bitmap
+bool prefersArray(size_t setBits, size_t count) {
+    return 2 + 2 * setBits < count * sizeof(uint64_t);
+}
+
+// CRC of a header with its checksum field treated as zero
+uint32_t headerChecksum(const FilterFileHeader& header) {
+    FilterFileHeader copy = header;
+    copy.checksum = 0;
+    return crc32c(0, &copy, sizeof(copy));
+}
+
+// CRC of the chunk table itself, stored right after it
+uint32_t tableChecksum(const vector<uint32_t>& chunkCrcs) {
+    return crc32c(0, chunkCrcs.data(), chunkCrcs.size() * sizeof(uint32_t));
+}
+
+} // namespace
+
+FilterFileHeader makeFilterHeader(FilterKind kind, uint64_t sizeBits, uint32_t numHashes,
+                                  HashPolicyId hashPolicy, uint64_t payloadBytes, uint32_t flags) {
+    FilterFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kFilterMagic, sizeof(kFilterMagic));
+    header.version = kFilterFormatVersion;
+    header.kind = static_cast<uint32_t>(kind);
+    header.sizeBits = sizeBits;
+    header.numHashes = numHashes;
+    header.hashPolicy = static_cast<uint32_t>(hashPolicy);
+    header.payloadBytes = payloadBytes;
+    header.flags = flags;
+    header.chunkBytes = kFilterChunkBytes;
+    header.checksum = headerChecksum(header);
+    return header;
+}
+
+bool hasFilterMagic(const void* data, size_t length) {
+    return length >= sizeof(kFilterMagic) && memcmp(data, kFilterMagic, sizeof(kFilterMagic)) == 0;
+}
+
+bool writeFilterHeader(ostream& out, const FilterFileHeader& header) {
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    return !out.fail();
+}
+
+bool readFilterHeader(istream& in, FilterFileHeader& header) {
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (in.fail()) return false;
+    return validateFilterHeader(header) && streamHolds(in, header.payloadBytes);
+}
+
+bool validateFilterHeader(const FilterFileHeader& header) {
+    if (!hasFilterMagic(header.magic, sizeof(header.magic))) return false;
+    if (header.version == 0 || header.version > kFilterFormatVersion) return false;
+    if (header.sizeBits == 0) return false;
+    if (header.flags & ~kFilterKnownFlags) return false;
+    bool bloomKind = header.kind == static_cast<uint32_t>(FilterKind::Standard) ||
+                     header.kind == static_cast<uint32_t>(FilterKind::Blocked) ||
+                     header.kind == static_cast<uint32_t>(FilterKind::Sharded);
+    if (bloomKind && header.numHashes == 0) return false;
+    if (header.flags & kFilterFlagCompressed) {
+        if (header.version < 2) return false;
+        // Every container takes at least its tag byte and at most a tag plus its words
+        uint64_t containers = (header.sizeBits + kSnapshotContainerBits - 1) / kSnapshotContainerBits;
+        if (header.payloadBytes < containers) return false;
+        if (header.payloadBytes > (header.sizeBits + 63) / 64 * 8 + containers) return false;
+    } else if (header.payloadBytes != (header.sizeBits + 63) / 64 * 8) {
+        // The raw payload always holds whole 64-bit words
+        return false;
+    }
+    if (header.version >= 2) {
+        if (header.chunkBytes == 0 || header.chunkBytes % sizeof(uint64_t) != 0) return false;
+        if (header.checksum != headerChecksum(header)) return false;
+    }
+    return true;
+}
+
+bool streamHolds(istream& in, uint64_t bytes) {
+    streampos start = in.tellg();
+    if (start == streampos(-1)) return false;
+    in.seekg(0, ios::end);
+    streampos end = in.tellg();
+    in.seekg(start);
+    if (end == streampos(-1) || in.fail()) return false;
+    return static_cast<uint64_t>(end - start) >= bytes;
+}
+
+bool peekFilterMagic(istream& in) {
+    streampos start = in.tellg();
+    char magic[sizeof(kFilterMagic)];
+    in.read(magic, sizeof(magic));
+    bool found = !in.fail() && hasFilterMagic(magic, sizeof(magic));
+    in.clear();
+    in.seekg(start);
+    return found;
+}
+
+size_t filterChunkCount(const FilterFileHeader& header) {
+    if (header.version < 2) return 0;
+    return (header.payloadBytes + header.chunkBytes - 1) / header.chunkBytes;
+}
+
+uint64_t filterRecordBytes(const FilterFileHeader& header) {
+    uint64_t bytes = kFilterHeaderBytes + header.payloadBytes;
+    if (header.version >= 2) bytes += (filterChunkCount(header) + 1) * sizeof(uint32_t);
+    return bytes;
+}
+
+bool writeChunkTable(ostream& out, const vector<uint32_t>& chunkCrcs) {
+    uint32_t crc = tableChecksum(chunkCrcs);
+    out.write(reinterpret_cast<const char*>(chunkCrcs.data()), chunkCrcs.size() * sizeof(uint32_t));
+    out.write(reinterpret_cast<const char*>(&crc), sizeof(crc));
+    return !out.fail();
+}
+
+bool readChunkTable(istream& in, const FilterFileHeader& header, vector<uint32_t>& chunkCrcs) {
+    streampos payload = in.tellg();
+    if (payload == streampos(-1)) return false;
+
+    // A record cut short by a crash or a partial copy is caught here, before the payload
+    in.seekg(0, ios::end);
+    streampos end = in.tellg();
+    uint64_t remaining = static_cast<uint64_t>(end - payload);
+    if (remaining < filterRecordBytes(header) - kFilterHeaderBytes) return false;
+
+    chunkCrcs.assign(filterChunkCount(header), 0);
+    uint32_t storedCrc = 0;
+    in.seekg(payload + static_cast<streamoff>(header.payloadBytes));
+    in.read(reinterpret_cast<char*>(chunkCrcs.data()), chunkCrcs.size() * sizeof(uint32_t));
+    in.read(reinterpret_cast<char*>(&storedCrc), sizeof(storedCrc));
+    in.seekg(payload);
+    if (in.fail()) return false;
+    return storedCrc == tableChecksum(chunkCrcs);
+}
+
+bool validateMappedRecord(const unsigned char* record, size_t length, const FilterFileHeader& header,
+                          bool verifyPayload) {
+    if (length < filterRecordBytes(header)) return false;
+    // A compressed payload has to be decoded before it can be probed
+    if (header.flags & kFilterFlagCompressed) return false;
+    const unsigned char* payload = record + kFilterHeaderBytes;
+
+    if (header.version == 1) {
+        return !verifyPayload || crc32c(0, payload, header.payloadBytes) == header.checksum;
+    }
+
+    // The table is small, so it is always checked; the chunks only on request
+    vector<uint32_t> chunkCrcs(filterChunkCount(header));
+    uint32_t storedCrc;
+    memcpy(chunkCrcs.data(), payload + header.payloadBytes, chunkCrcs.size() * sizeof(uint32_t));
+    memcpy(&storedCrc, payload + header.payloadBytes + chunkCrcs.size() * sizeof(uint32_t), sizeof(storedCrc));
+    if (storedCrc != tableChecksum(chunkCrcs)) return false;
+    if (!verifyPayload) return true;
+
+    for (size_t chunk = 0; chunk < chunkCrcs.size(); chunk++) {
+        uint64_t offset = uint64_t(chunk) * header.chunkBytes;
+        size_t bytes = static_cast<size_t>(min<uint64_t>(header.chunkBytes, header.payloadBytes - offset));
+        if (crc32c(0, payload + offset, bytes) != chunkCrcs[chunk]) return false;
+    }
+    return true;
+}
+
+ChunkedPayloadWriter::ChunkedPayloadWriter(ostream& output, uint32_t bytesPerChunk)
+    : out(output), chunkBytes(bytesPerChunk), chunkFill(0), crc(0) {
+}
+
+bool ChunkedPayloadWriter::write(const void* data, size_t length) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    while (length > 0) {
+        size_t part = min<size_t>(length, chunkBytes - chunkFill);
+        out.write(reinterpret_cast<const char*>(bytes), part);
+        crc = crc32c(crc, bytes, part);
+        chunkFill += static_cast<uint32_t>(part);
+        if (chunkFill == chunkBytes) {
+            chunkCrcs.push_back(crc);
+            chunkFill = 0;
+            crc = 0;
+        }
+        bytes += part;
+        length -= part;
+    }
+    return !out.fail();
+}
+
+bool ChunkedPayloadWriter::finish() {
+    if (chunkFill > 0) {
+        chunkCrcs.push_back(crc);
+        chunkFill = 0;
+        crc = 0;
+    }
+    return writeChunkTable(out, chunkCrcs);
+}
+
+ChunkedPayloadReader::ChunkedPayloadReader(istream& input, const FilterFileHeader& fileHeader)
+    : in(input), header(fileHeader), offset(0), crc(0), chunk(0) {
+}
+
+bool ChunkedPayloadReader::open() {
+    return readChunkTable(in, header, chunkCrcs);
+}
+
+bool ChunkedPayloadReader::read(void* data, size_t length) {
+    if (length > header.payloadBytes - offset) return false;
+    unsigned char* bytes = static_cast<unsigned char*>(data);
+    while (length > 0) {
+        uint64_t chunkEnd = min<uint64_t>(uint64_t(chunk + 1) * header.chunkBytes, header.payloadBytes);
+        size_t part = static_cast<size_t>(min<uint64_t>(length, chunkEnd - offset));
+        in.read(reinterpret_cast<char*>(bytes), part);
+        if (in.fail()) return false;
+        crc = crc32c(crc, bytes, part);
+        offset += part;
+        if (offset == chunkEnd) {
+            if (crc != chunkCrcs[chunk]) return false;
+            chunk++;
+            crc = 0;
+        }
+        bytes += part;
+        length -= part;
+    }
+    return true;
+}
+
+bool ChunkedPayloadReader::finish() {
+    if (offset != header.payloadBytes) return false;
+    in.seekg(static_cast<streamoff>((chunkCrcs.size() + 1) * sizeof(uint32_t)), ios::cur);
+    return !in.fail();
+}
+
+size_t snapshotContainerBytes(const uint64_t* words, size_t count) {
+    size_t setBits = countBits(words, count);
+    if (setBits == 0) return 1;
+    if (prefersArray(setBits, count)) return 1 + 2 + 2 * setBits;
+    return 1 + count * sizeof(uint64_t);
+}
+
+bool writeSnapshotContainer(ChunkedPayloadWriter& out, const uint64_t* words, size_t count) {
+    size_t setBits = countBits(words, count);
+    if (setBits == 0) {
+        return out.write(&kContainerEmpty, 1);
+    }
+
+    if (prefersArray(setBits, count)) {
+        uint16_t header = toLittleEndian16(static_cast<uint16_t>(setBits));
+        if (!out.write(&kContainerArray, 1) || !out.write(&header, sizeof(header))) return false;
+
+        uint16_t offsets[kArrayBatch];
+        size_t staged = 0;
+        for (size_t i = 0; i < count; i++) {
+            for (uint64_t word = words[i]; word; word &= word - 1) {
+                offsets[staged++] = toLittleEndian16(static_cast<uint16_t>(i * 64 + __builtin_ctzll(word)));
+                if (staged == kArrayBatch) {
+                    if (!out.write(offsets, sizeof(offsets))) return false;
+                    staged = 0;
+                }
+            }
+        }
+        return out.write(offsets, staged * sizeof(uint16_t));
+    }
+
+    if (!out.write(&kContainerBitmap, 1)) return false;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    uint64_t swapped[kSnapshotContainerWords];
+    for (size_t i = 0; i < count; i++) swapped[i] = toLittleEndian(words[i]);
+    return out.write(swapped, count * sizeof(uint64_t));
+#else
+    return out.write(words, count * sizeof(uint64_t));
+#endif
+}
+
+bool readSnapshotContainer(ChunkedPayloadReader& in, uint64_t* words, size_t count) {
+    uint8_t tag;
+    if (!in.read(&tag, 1)) return false;
+
+    switch (tag) {
+    case kContainerEmpty:
+        memset(words, 0, count * sizeof(uint64_t));
+        return true;
+
+    case kContainerArray: {
+        uint16_t setBits;
+        if (!in.read(&setBits, sizeof(setBits))) return false;
+        setBits = toLittleEndian16(setBits);
+        memset(words, 0, count * sizeof(uint64_t));
+
+        uint16_t offsets[kArrayBatch];
+        for (size_t done = 0; done < setBits;) {
+            size_t batch = min<size_t>(kArrayBatch, setBits - done);
+            if (!in.read(offsets, batch * sizeof(uint16_t))) return false;
+            for (size_t i = 0; i < batch; i++) {
+                size_t bit = toLittleEndian16(offsets[i]);
+                if (bit >= count * 64) return false;
+                words[bit >> 6] |= uint64_t(1) << (bit & 63);
+            }
+            done += batch;
+        }
+        return true;
+    }
+
+    case kContainerBitmap:
+        if (!in.read(words, count * sizeof(uint64_t))) return false;
+        for (size_t i = 0; i < count; i++) words[i] = toLittleEndian(words[i]);
+        return true;
+
+    default:
+        return false;
+    }
+}
@@ -0,0 +1,294 @@
+#ifndef FILTER_FORMAT_H
+#define FILTER_FORMAT_H
+
+#include "hash_policy.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <type_traits>
+#include <vector>
+
+// Versioned on-disk filter format.
+//
+//   offset 0                 FilterFileHeader (64 bytes, little-endian)
+//   offset 64                bit array as 64-bit little-endian words (payloadBytes bytes)
+//   offset 64 + payloadBytes (v2) CRC32C of each chunkBytes slice of the payload,
+//                            followed by the CRC32C of that table
+//
+// The payload starts on a 64-byte boundary, so a page-aligned mmap of the file can
+// be probed in place. Version 1 files carry a single payload CRC in the header and no
+// chunk table; they are still readable. Files without the magic are the original layout
+// (size_t size, unsigned int numHashes, packed bits) and are still readable too.
+// Records are self-delimiting, so several filters can be written back to back.
+//
+// With kFilterFlagCompressed (v2 only) the payload is a compressed snapshot instead of
+// raw words: the bit array is cut into 65536-bit containers and each is written as
+//   uint8 0                      empty container
+//   uint8 1, uint16 n, n x uint16 sorted offsets of the set bits
+//   uint8 2, raw words           bitmap container
+// whichever is smallest. Chunk CRCs then cover the encoded bytes. Compressed files are
+// for shipping and loading; they cannot be probed in place through a mapping.
+
+constexpr char kFilterMagic[8] = {'B', 'L', 'O', 'O', 'M', 'F', 'L', 'T'};
+constexpr uint32_t kFilterFormatVersion = 2;
+constexpr size_t kFilterHeaderBytes = 64;
+// Payload bytes covered by one chunk checksum
+constexpr uint32_t kFilterChunkBytes = 1u << 20;
+
+// Which structure the payload belongs to
+enum class FilterKind : uint32_t {
+    Standard = 0,
+    Blocked = 1,
+    // Manifest of a ScalableBloomFilter; its stages follow as Standard records
+    Scalable = 2,
+    // StaticFilter: parameter block plus 8-bit binary fuse fingerprints
+    BinaryFuse8 = 3,
+    // CuckooFilter: 4 x 16-bit buckets plus a victim descriptor word
+    Cuckoo = 4,
+    // Manifest of a ShardedBloomFilter (shard count, bits per shard); its shards follow
+    // as further Sharded records, one bit array each
+    Sharded = 5
+};
+
+// Header flag bits
+constexpr uint32_t kFilterFlagCompressed = 1u << 0;
+constexpr uint32_t kFilterKnownFlags = kFilterFlagCompressed;
+
+// Compressed snapshot containers
+constexpr size_t kSnapshotContainerWords = 1024;
+constexpr size_t kSnapshotContainerBits = kSnapshotContainerWords * 64;
+
+struct FilterFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t kind;
+    uint64_t sizeBits;
+    uint32_t numHashes;
+    uint32_t hashPolicy;
+    uint64_t payloadBytes;
+    uint32_t checksum;      // v1: CRC32C of the payload; v2: CRC32C of this header with checksum zeroed
+    uint32_t flags;         // kFilterFlag* bits
+    uint32_t chunkBytes;    // v2: payload bytes per chunk checksum
+    uint8_t reserved[12];
+};
+
+static_assert(sizeof(FilterFileHeader) == kFilterHeaderBytes, "header must stay 64 bytes");
+
+// Header for a filter of the given geometry, sealed with its own checksum
+FilterFileHeader makeFilterHeader(FilterKind kind, uint64_t sizeBits, uint32_t numHashes,
+                                  HashPolicyId hashPolicy, uint64_t payloadBytes, uint32_t flags = 0);
+
+// True if the buffer starts with the format magic
+bool hasFilterMagic(const void* data, size_t length);
+
+// Write the header at the stream's current position
+bool writeFilterHeader(std::ostream& out, const FilterFileHeader& header);
+
+// Read and validate a header (magic, version, sane sizes), and check that the stream
+// still holds the payload it announces, so no reader allocates for a truncated file
+bool readFilterHeader(std::istream& in, FilterFileHeader& header);
+
+// Validate a header already in memory, e.g. at the start of a mapping. Bloom kinds must
+// probe at least once; with no probes every key would look present.
+bool validateFilterHeader(const FilterFileHeader& header);
+
+// True if at least bytes remain after the stream's current position, which is restored.
+// False for a stream that cannot seek.
+bool streamHolds(std::istream& in, uint64_t bytes);
+
+// True if the next bytes of the stream are the format magic; the position is restored
+bool peekFilterMagic(std::istream& in);
+
+// Number of chunk checksums following a v2 payload (0 for v1)
+size_t filterChunkCount(const FilterFileHeader& header);
+
+// Bytes the whole record occupies, header through chunk table
+uint64_t filterRecordBytes(const FilterFileHeader& header);
+
+// Write the chunk table and its own checksum after the payload
+bool writeChunkTable(std::ostream& out, const std::vector<uint32_t>& chunkCrcs);
+
+// Read the chunk table that follows a payload of header.payloadBytes bytes starting at
+// the current position, without consuming the payload. Fails on a short or corrupt table.
+bool readChunkTable(std::istream& in, const FilterFileHeader& header, std::vector<uint32_t>& chunkCrcs);
+
+// Check a record that sits in memory (e.g. a mapping of `length` bytes at `record`):
+// the length must cover the whole record, and with verifyPayload every chunk CRC is checked
+bool validateMappedRecord(const unsigned char* record, size_t length, const FilterFileHeader& header,
+                          bool verifyPayload);
+
+// Byte stream over a v2 payload that tracks chunk boundaries, so payloads whose size
+// is not a whole number of words (compressed snapshots) get the same chunk CRCs
+class ChunkedPayloadWriter {
+private:
+    std::ostream& out;
+    uint32_t chunkBytes;
+    uint32_t chunkFill;
+    uint32_t crc;
+    std::vector<uint32_t> chunkCrcs;
+
+public:
+    ChunkedPayloadWriter(std::ostream& output, uint32_t bytesPerChunk);
+
+    bool write(const void* data, size_t length);
+
+    // Close the last chunk and write the chunk table
+    bool finish();
+};
+
+class ChunkedPayloadReader {
+private:
+    std::istream& in;
+    const FilterFileHeader& header;
+    std::vector<uint32_t> chunkCrcs;
+    uint64_t offset;
+    uint32_t crc;
+    size_t chunk;
+
+public:
+    ChunkedPayloadReader(std::istream& input, const FilterFileHeader& fileHeader);
+
+    // Load and check the chunk table; must succeed before read()
+    bool open();
+
+    // Read the next length payload bytes, failing at the first chunk whose CRC mismatches
+    bool read(void* data, size_t length);
+
+    // True once the whole payload has been consumed; steps over the chunk table
+    bool finish();
+};
+
+// Encoded size of one container of count words (count <= kSnapshotContainerWords)
+size_t snapshotContainerBytes(const uint64_t* words, size_t count);
+
+// Encode one container
+bool writeSnapshotContainer(ChunkedPayloadWriter& out, const uint64_t* words, size_t count);
+
+// Decode one container into count words, overwriting all of them
+bool readSnapshotContainer(ChunkedPayloadReader& in, uint64_t* words, size_t count);
+
+// Visit the storage one container at a time as plain host-order words. Storage with a
+// plain word array is handed out in place; anything else is staged a container at a time.
+template <typename Storage, typename Visit>
+bool forEachSnapshotContainer(const Storage& storage, Visit visit) {
+    uint64_t staged[kSnapshotContainerWords];
+    for (size_t first = 0; first < storage.numWords(); first += kSnapshotContainerWords) {
+        size_t count = std::min(kSnapshotContainerWords, storage.numWords() - first);
+        const uint64_t* words;
+        if constexpr (std::is_same_v<decltype(storage.data()), const uint64_t*>) {
+            words = storage.data() + first;
+        } else {
+            for (size_t i = 0; i < count; i++) staged[i] = storage.word(first + i);
+            words = staged;
+        }
+        if (!visit(words, count)) return false;
+    }
+    return true;
+}
+
+// Bytes a compressed snapshot of storage would take
+template <typename Storage>
+uint64_t snapshotPayloadBytes(const Storage& storage) {
+    uint64_t bytes = 0;
+    forEachSnapshotContainer(storage, [&bytes](const uint64_t* words, size_t count) {
+        bytes += snapshotContainerBytes(words, count);
+        return true;
+    });
+    return bytes;
+}
+
+// Decode a compressed payload straight into storage
+template <typename Storage>
+bool readSnapshotPayload(std::istream& in, const FilterFileHeader& header, Storage& storage) {
+    ChunkedPayloadReader reader(in, header);
+    if (!reader.open()) return false;
+
+    uint64_t staged[kSnapshotContainerWords];
+    for (size_t first = 0; first < storage.numWords(); first += kSnapshotContainerWords) {
+        size_t count = std::min(kSnapshotContainerWords, storage.numWords() - first);
+        if constexpr (std::is_same_v<decltype(storage.data()), uint64_t*>) {
+            if (!readSnapshotContainer(reader, storage.data() + first, count)) return false;
+        } else {
+            if (!readSnapshotContainer(reader, staged, count)) return false;
+            for (size_t i = 0; i < count; i++) storage.storeWord(first + i, staged[i]);
+        }
+    }
+    // Drop any stray bits past the end so word-level operations stay exact
+    if (storage.size() % 64 != 0) {
+        size_t last = storage.numWords() - 1;
+        storage.storeWord(last, storage.word(last) & ((uint64_t(1) << (storage.size() % 64)) - 1));
+    }
+    return reader.finish();
+}
+
+// Write header, payload and chunk table. Storage provides numWords() and
+// writeWords(out, first, count, &crc); the payload is streamed one chunk at a time,
+// so nothing larger than a chunk is ever staged and the stream never has to seek.
+// With compress, a compressed snapshot is written instead whenever it comes out smaller.
+template <typename Storage>
+bool writeFilterFile(std::ostream& out, FilterKind kind, HashPolicyId hashPolicy,
+                     uint64_t sizeBits, uint32_t numHashes, const Storage& storage,
+                     bool compress = false) {
+    const uint64_t rawBytes = storage.numWords() * sizeof(uint64_t);
+    if (compress) {
+        // Sizing pass first, so the header can be written before the payload
+        uint64_t compressedBytes = snapshotPayloadBytes(storage);
+        if (compressedBytes < rawBytes) {
+            FilterFileHeader header = makeFilterHeader(kind, sizeBits, numHashes, hashPolicy,
+                                                       compressedBytes, kFilterFlagCompressed);
+            if (!writeFilterHeader(out, header)) return false;
+            ChunkedPayloadWriter writer(out, header.chunkBytes);
+            bool written = forEachSnapshotContainer(storage, [&writer](const uint64_t* words, size_t count) {
+                return writeSnapshotContainer(writer, words, count);
+            });
+            return written && writer.finish();
+        }
+    }
+
+    FilterFileHeader header = makeFilterHeader(kind, sizeBits, numHashes, hashPolicy, rawBytes);
+    if (!writeFilterHeader(out, header)) return false;
+
+    const size_t chunkWords = header.chunkBytes / sizeof(uint64_t);
+    std::vector<uint32_t> chunkCrcs;
+    chunkCrcs.reserve(filterChunkCount(header));
+    for (size_t first = 0; first < storage.numWords(); first += chunkWords) {
+        size_t count = std::min(chunkWords, storage.numWords() - first);
+        uint32_t crc = 0;
+        if (!storage.writeWords(out, first, count, &crc)) return false;
+        chunkCrcs.push_back(crc);
+    }
+    return writeChunkTable(out, chunkCrcs);
+}
+
+// Read the payload that follows a validated header, verifying each chunk as it arrives
+// so a corrupt file is rejected at the first bad chunk. Leaves the stream at the end of
+// the record.
+template <typename Storage>
+bool readFilterPayload(std::istream& in, const FilterFileHeader& header, Storage& storage) {
+    if (header.version == 1) {
+        uint32_t crc = 0;
+        if (!storage.readWords(in, 0, storage.numWords(), &crc)) return false;
+        return crc == header.checksum;
+    }
+    if (header.flags & kFilterFlagCompressed) {
+        return readSnapshotPayload(in, header, storage);
+    }
+
+    // The table is checked before any payload is read, so a torn file fails immediately
+    std::vector<uint32_t> chunkCrcs;
+    if (!readChunkTable(in, header, chunkCrcs)) return false;
+
+    const size_t chunkWords = header.chunkBytes / sizeof(uint64_t);
+    for (size_t first = 0, chunk = 0; first < storage.numWords(); first += chunkWords, chunk++) {
+        size_t count = std::min(chunkWords, storage.numWords() - first);
+        uint32_t crc = 0;
+        if (!storage.readWords(in, first, count, &crc) || crc != chunkCrcs[chunk]) return false;
+    }
+    // Step over the table to the end of the record
+    in.seekg(static_cast<std::streamoff>((chunkCrcs.size() + 1) * sizeof(uint32_t)), std::ios::cur);
+    return !in.fail();
+}
+
+#endif // FILTER_FORMAT_H
@@ -0,0 +1,140 @@
+#include "filter_handle.h"
+#include "basic_bloom_filter.h"
+#include "blocked_bloom_filter.h"
+#include "bloom_filter.h"
+#include "concurrent_bloom_filter.h"
+#include "counting_bloom_filter.h"
+#include "cuckoo_filter.h"
+#include "filter_format.h"
+#include "rotating_bloom_filter.h"
+#include "scalable_bloom_filter.h"
+#include "sharded_bloom_filter.h"
+#include "static_filter.h"
+#include <fstream>
+
+using namespace std;
+
+namespace {
+
+struct VariantName {
+    const char* name;
+    FilterVariant variant;
+};
+
+constexpr VariantName kVariantNames[] = {
+    {"standard", FilterVariant::Standard},
+    {"blocked", FilterVariant::Blocked},
+    {"concurrent", FilterVariant::Concurrent},
+    {"counting", FilterVariant::Counting},
+    {"scalable", FilterVariant::Scalable},
+    {"cuckoo", FilterVariant::Cuckoo},
+    {"fast", FilterVariant::Fast},
+    {"sharded", FilterVariant::Sharded},
+    {"rotating", FilterVariant::Rotating}
+};
+
+// Generations of a rotating filter made through createOptimal
+constexpr unsigned int kDefaultGenerations = 4;
+
+} // namespace
+
+FilterHandle FilterHandle::createOptimal(FilterVariant variant, size_t expectedItems, double falsePositiveRate,
+                                        bool roundToPowerOfTwo) {
+    switch (variant) {
+        case FilterVariant::Blocked:
+            return FilterHandle(make_unique<BlockedBloomFilter>(
+                BlockedBloomFilter::createOptimal(expectedItems, falsePositiveRate)), "blocked");
+        case FilterVariant::Concurrent:
+            return FilterHandle(unique_ptr<ConcurrentBloomFilter>(new ConcurrentBloomFilter(
+                ConcurrentBloomFilter::createOptimal(expectedItems, falsePositiveRate, roundToPowerOfTwo))),
+                "concurrent");
+        case FilterVariant::Counting:
+            return FilterHandle(make_unique<CountingBloomFilter>(
+                CountingBloomFilter::createOptimal(expectedItems, falsePositiveRate, roundToPowerOfTwo)), "counting");
+        case FilterVariant::Scalable:
+            return FilterHandle(make_unique<ScalableBloomFilter>(expectedItems, falsePositiveRate), "scalable");
+        case FilterVariant::Cuckoo:
+            return FilterHandle(make_unique<CuckooFilter>(CuckooFilter::createOptimal(expectedItems)), "cuckoo");
+        case FilterVariant::Fast:
+            return FilterHandle(make_unique<FastBloomFilter>(
+                FastBloomFilter::createOptimal(expectedItems, falsePositiveRate)), "fast");
+        case FilterVariant::Sharded:
+            return FilterHandle(unique_ptr<ShardedBloomFilter>(new ShardedBloomFilter(
+                ShardedBloomFilter::createOptimal(expectedItems, falsePositiveRate, 0, roundToPowerOfTwo))),
+                "sharded");
+        case FilterVariant::Rotating:
+            return FilterHandle(unique_ptr<RotatingBloomFilter>(new RotatingBloomFilter(
+                RotatingBloomFilter::createOptimal((expectedItems + kDefaultGenerations - 1) / kDefaultGenerations,
+                                                   falsePositiveRate, kDefaultGenerations))),
+                "rotating");
+        case FilterVariant::Standard:
+            break;
+    }
+    return FilterHandle(make_unique<BloomFilter>(
+        BloomFilter::createOptimal(expectedItems, falsePositiveRate, roundToPowerOfTwo)), "standard");
+}
+
+FilterMetrics FilterHandle::metrics() const {
+    FilterMetrics metrics;
+    metrics.type = typeName;
+    metrics.sizeBits = getSize();
+    metrics.numHashes = getNumHashes();
+    metrics.inserts = impl->inserts.load();
+    metrics.queries = impl->queries.load();
+    metrics.positives = impl->positives.load();
+    metrics.hasFill = impl->fillMetrics(metrics);
+    return metrics;
+}
+
+bool FilterHandle::parseVariant(const string& name, FilterVariant& variant) {
+    for (const VariantName& entry : kVariantNames) {
+        if (name == entry.name) {
+            variant = entry.variant;
+            return true;
+        }
+    }
+    return false;
+}
+
+FilterHandle FilterHandle::loadFromFile(const string& filename, bool mapped) {
+    ifstream inFile(filename, ios::binary);
+
+    if (!inFile.is_open()) {
+        return FilterHandle();
+    }
+
+    // Headerless files predate the other variants and are always standard filters
+    uint32_t kind = static_cast<uint32_t>(FilterKind::Standard);
+    if (peekFilterMagic(inFile)) {
+        FilterFileHeader header;
+        if (!readFilterHeader(inFile, header)) {
+            return FilterHandle();
+        }
+        kind = header.kind;
+    }
+    inFile.close();
+
+    switch (static_cast<FilterKind>(kind)) {
+        case FilterKind::Standard:
+            return FilterHandle(unique_ptr<BloomFilter>(mapped ? BloomFilter::openMapped(filename)
+                                                               : BloomFilter::loadFromFile(filename)),
+                                "standard");
+        case FilterKind::Blocked:
+            return FilterHandle(unique_ptr<BlockedBloomFilter>(mapped ? BlockedBloomFilter::openMapped(filename)
+                                                                      : BlockedBloomFilter::loadFromFile(filename)),
+                                "blocked");
+        case FilterKind::Scalable:
+            return FilterHandle(unique_ptr<ScalableBloomFilter>(ScalableBloomFilter::loadFromFile(filename)),
+                                "scalable");
+        case FilterKind::BinaryFuse8:
+            return FilterHandle(unique_ptr<StaticFilter>(mapped ? StaticFilter::openMapped(filename)
+                                                                : StaticFilter::loadFromFile(filename)),
+                                "static");
+        case FilterKind::Cuckoo:
+            return FilterHandle(unique_ptr<CuckooFilter>(CuckooFilter::loadFromFile(filename)), "cuckoo");
+        case FilterKind::Sharded:
+            return FilterHandle(unique_ptr<ShardedBloomFilter>(ShardedBloomFilter::loadFromFile(filename)),
+                                "sharded");
+    }
+    return FilterHandle();
+}
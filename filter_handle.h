@@ -0,0 +1,445 @@
+#ifndef FILTER_HANDLE_H
+#define FILTER_HANDLE_H
+
+#include "filter_metrics.h"
+#include "sharded_counter.h"
+#include "word_ops.h"
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+// Variants that can be created empty, numbered as in the interactive menu
+enum class FilterVariant {
+    Standard = 1,
+    Blocked,
+    Concurrent,
+    Counting,
+    Scalable,
+    Cuckoo,
+    Fast,
+    Sharded,
+    Rotating
+};
+
+// Owning, type-erased handle to any filter variant (BloomFilter, BlockedBloomFilter,
+// ConcurrentBloomFilter, CountingBloomFilter, ScalableBloomFilter, CuckooFilter,
+// StaticFilter, ShardedBloomFilter, RotatingBloomFilter, BasicBloomFilter<...>), so the CLI and benchmarks can drive whichever
+// one a workload needs through one interface.
+//
+// The batch calls are the only virtual boundary on the hot path: one indirect call
+// covers a whole batch, and inside it the concrete filter's inlined probes run.
+// insert()/mightContain() are batches of one. Variants without a native batch API
+// are looped over inside the model, still behind a single virtual call.
+class FilterHandle {
+private:
+    struct Concept {
+        virtual ~Concept() = default;
+        virtual bool insertBatch(const std::string_view* elements, size_t count) = 0;
+        virtual void mightContainBatch(const std::string_view* elements, size_t count, bool* results) const = 0;
+
+        // Cold-path metadata and management
+        virtual size_t getSize() const = 0;
+        virtual unsigned int getNumHashes() const = 0;
+        virtual double getFalsePositiveRate(size_t insertedItems) const = 0;
+        virtual bool supportsInsert() const = 0;
+        virtual bool supportsSave() const = 0;
+        virtual bool clear() = 0;
+        virtual bool unionWith(const Concept& other) = 0;
+        virtual bool intersectWith(const Concept& other) = 0;
+        virtual double estimateCardinality() const = 0;
+        // Fill the metrics the filter itself knows (size and fill); false if it has no fill
+        virtual bool fillMetrics(FilterMetrics& metrics) const = 0;
+        virtual bool saveToFile(const std::string& filename, bool compress) const = 0;
+        virtual std::unique_ptr<Concept> emptyLike() const = 0;
+        virtual void* get(const void* typeTag) const = 0;
+
+        // Keys through insertBatch / mightContainBatch and the positive answers;
+        // sharded, since many threads may query one handle
+        ShardedCounter inserts;
+        mutable ShardedCounter queries;
+        mutable ShardedCounter positives;
+    };
+
+    template <typename F>
+    struct Model;
+
+    std::unique_ptr<Concept> impl;
+    std::string typeName;
+
+    FilterHandle(std::unique_ptr<Concept> model, std::string name)
+        : impl(std::move(model)), typeName(std::move(name)) {
+    }
+
+    // One tag object per filter type, compared by address in get<F>()
+    template <typename F>
+    static const void* typeTag() {
+        static const char tag = 0;
+        return &tag;
+    }
+
+public:
+    FilterHandle() = default;
+
+    // Take ownership of a filter; name is shown to users ("standard", "cuckoo", ...)
+    template <typename F>
+    FilterHandle(std::unique_ptr<F> filter, std::string name);
+
+    explicit operator bool() const { return impl != nullptr; }
+    const std::string& name() const { return typeName; }
+
+    // Returns false if some element could not be inserted (a full cuckoo table, or a
+    // variant that cannot be modified)
+    bool insertBatch(const std::string_view* elements, size_t count) {
+        impl->inserts.add(count);
+        return impl->insertBatch(elements, count);
+    }
+
+    void mightContainBatch(const std::string_view* elements, size_t count, bool* results) const {
+        impl->mightContainBatch(elements, count, results);
+        size_t positive = 0;
+        for (size_t i = 0; i < count; i++) positive += results[i];
+        impl->queries.add(count);
+        if (positive) impl->positives.add(positive);
+    }
+
+    bool insert(std::string_view element) { return insertBatch(&element, 1); }
+
+    bool mightContain(std::string_view element) const {
+        bool result;
+        mightContainBatch(&element, 1, &result);
+        return result;
+    }
+
+    size_t getSize() const { return impl->getSize(); }
+
+    // 0 for variants that do not use k hash functions
+    unsigned int getNumHashes() const { return impl->getNumHashes(); }
+
+    double getFalsePositiveRate(size_t insertedItems) const { return impl->getFalsePositiveRate(insertedItems); }
+
+    // False for build-once variants such as StaticFilter
+    bool supportsInsert() const { return impl->supportsInsert(); }
+
+    // False for variants without a file format (counting, fast)
+    bool supportsSave() const { return impl->supportsSave(); }
+
+    // False if the variant cannot be cleared
+    bool clear() { return impl->clear(); }
+
+    // OR other into this filter; false unless both are the same type and geometry and
+    // the type supports merging
+    bool unionWith(const FilterHandle& other) { return impl->unionWith(*other.impl); }
+
+    // AND other into this filter, under the same conditions as unionWith
+    bool intersectWith(const FilterHandle& other) { return impl->intersectWith(*other.impl); }
+
+    // Items held, estimated from the bit array's fill; negative for variants that
+    // cannot estimate it (counting, scalable, cuckoo, static)
+    double estimateCardinality() const { return impl->estimateCardinality(); }
+
+    // Insert/query counters of this handle and the filter's measured fill, without
+    // scanning the bit array; see FilterMetrics and writePrometheus
+    FilterMetrics metrics() const;
+
+    // False on I/O failure or if the variant has no file format; compress is ignored
+    // by variants without compressed snapshots
+    bool saveToFile(const std::string& filename, bool compress = false) const {
+        return impl->saveToFile(filename, compress);
+    }
+
+    // A new, empty filter of the same type and geometry; empty handle if unsupported
+    FilterHandle emptyLike() const {
+        std::unique_ptr<Concept> model = impl->emptyLike();
+        return model ? FilterHandle(std::move(model), typeName) : FilterHandle();
+    }
+
+    // The concrete filter if it is an F, else nullptr
+    template <typename F>
+    F* get() {
+        return static_cast<F*>(impl->get(typeTag<F>()));
+    }
+
+    template <typename F>
+    const F* get() const {
+        return static_cast<const F*>(impl->get(typeTag<F>()));
+    }
+
+    // An empty filter of the given variant sized for expectedItems at falsePositiveRate;
+    // roundToPowerOfTwo applies to the variants that index with a mask. A rotating
+    // filter keeps expectedItems keys across its live generations. Throws
+    // std::invalid_argument for bad parameters, as the filter constructors do.
+    static FilterHandle createOptimal(FilterVariant variant, size_t expectedItems, double falsePositiveRate,
+                                      bool roundToPowerOfTwo = false);
+
+    // Variant for a name as returned by name() ("standard", "blocked", ...); false if unknown
+    static bool parseVariant(const std::string& name, FilterVariant& variant);
+
+    // Open any versioned filter file, picking the class from the header kind; files
+    // in the original headerless layout open as BloomFilter. mapped probes the file in
+    // place where the variant supports it. Empty handle on failure.
+    static FilterHandle loadFromFile(const std::string& filename, bool mapped = false);
+};
+
+namespace filter_handle_detail {
+
+template <typename F, typename = void>
+struct HasInsertBatch : std::false_type {};
+template <typename F>
+struct HasInsertBatch<F, std::void_t<decltype(std::declval<F&>().insertBatch(
+    std::declval<const std::string_view*>(), size_t()))>> : std::true_type {};
+
+template <typename F, typename = void>
+struct HasContainsBatch : std::false_type {};
+template <typename F>
+struct HasContainsBatch<F, std::void_t<decltype(std::declval<const F&>().mightContainBatch(
+    std::declval<const std::string_view*>(), size_t(), std::declval<bool*>()))>> : std::true_type {};
+
+template <typename F, typename = void>
+struct HasInsert : std::false_type {};
+template <typename F>
+struct HasInsert<F, std::void_t<decltype(std::declval<F&>().insert(std::declval<const std::string&>()))>>
+    : std::true_type {};
+
+template <typename F, typename = void>
+struct HasNumHashes : std::false_type {};
+template <typename F>
+struct HasNumHashes<F, std::void_t<decltype(std::declval<const F&>().getNumHashes())>> : std::true_type {};
+
+template <typename F, typename = void>
+struct HasFprForCount : std::false_type {};
+template <typename F>
+struct HasFprForCount<F, std::void_t<decltype(std::declval<const F&>().getCurrentFalsePositiveRate(size_t()))>>
+    : std::true_type {};
+
+template <typename F, typename = void>
+struct HasFprAtFill : std::false_type {};
+template <typename F>
+struct HasFprAtFill<F, std::void_t<decltype(std::declval<const F&>().getCurrentFalsePositiveRate())>>
+    : std::true_type {};
+
+template <typename F, typename = void>
+struct HasClear : std::false_type {};
+template <typename F>
+struct HasClear<F, std::void_t<decltype(std::declval<F&>().clear())>> : std::true_type {};
+
+// Variants whose geometry is more than size and k build their own empty copy
+template <typename F, typename = void>
+struct HasEmptyLike : std::false_type {};
+template <typename F>
+struct HasEmptyLike<F, std::void_t<decltype(std::declval<const F&>().emptyLike())>> : std::true_type {};
+
+template <typename F, typename = void>
+struct HasUnionWith : std::false_type {};
+template <typename F>
+struct HasUnionWith<F, std::void_t<decltype(std::declval<F&>().unionWith(std::declval<const F&>()))>>
+    : std::true_type {};
+
+template <typename F, typename = void>
+struct HasIntersectWith : std::false_type {};
+template <typename F>
+struct HasIntersectWith<F, std::void_t<decltype(std::declval<F&>().intersectWith(std::declval<const F&>()))>>
+    : std::true_type {};
+
+template <typename F, typename = void>
+struct HasEstimateCardinality : std::false_type {};
+template <typename F>
+struct HasEstimateCardinality<F, std::void_t<decltype(std::declval<const F&>().estimateCardinality())>>
+    : std::true_type {};
+
+template <typename F, typename = void>
+struct HasFillRatio : std::false_type {};
+template <typename F>
+struct HasFillRatio<F, std::void_t<decltype(std::declval<const F&>().getFalsePositiveRateFromFill())>>
+    : std::true_type {};
+
+template <typename F, typename = void>
+struct HasSave : std::false_type {};
+template <typename F>
+struct HasSave<F, std::void_t<decltype(std::declval<const F&>().saveToFile(std::string()))>> : std::true_type {};
+
+template <typename F, typename = void>
+struct HasCompressedSave : std::false_type {};
+template <typename F>
+struct HasCompressedSave<F, std::void_t<decltype(std::declval<const F&>().saveToFile(std::string(), true))>>
+    : std::true_type {};
+
+template <typename F, typename = void>
+struct TakesStringView : std::false_type {};
+template <typename F>
+struct TakesStringView<F, std::void_t<decltype(std::declval<const F&>().mightContain(std::declval<std::string_view>()))>>
+    : std::true_type {};
+
+// Keys reach the filter as the type its insert/mightContain takes
+template <typename F>
+auto asKey(std::string_view element) {
+    if constexpr (TakesStringView<F>::value) {
+        return element;
+    } else {
+        return std::string(element);
+    }
+}
+
+} // namespace filter_handle_detail
+
+template <typename F>
+struct FilterHandle::Model : FilterHandle::Concept {
+    std::unique_ptr<F> filter;
+
+    explicit Model(std::unique_ptr<F> owned) : filter(std::move(owned)) {}
+
+    bool insertBatch(const std::string_view* elements, size_t count) override {
+        using namespace filter_handle_detail;
+        if constexpr (HasInsertBatch<F>::value) {
+            filter->insertBatch(elements, count);
+            return true;
+        } else if constexpr (HasInsert<F>::value) {
+            bool allInserted = true;
+            for (size_t i = 0; i < count; i++) {
+                if constexpr (std::is_same_v<decltype(filter->insert(asKey<F>(elements[i]))), bool>) {
+                    allInserted &= filter->insert(asKey<F>(elements[i]));
+                } else {
+                    filter->insert(asKey<F>(elements[i]));
+                }
+            }
+            return allInserted;
+        } else {
+            return count == 0;
+        }
+    }
+
+    void mightContainBatch(const std::string_view* elements, size_t count, bool* results) const override {
+        using namespace filter_handle_detail;
+        if constexpr (HasContainsBatch<F>::value) {
+            // A single key skips the batch's hash window (and is profiled as a lookup)
+            if (count == 1) {
+                results[0] = filter->mightContain(asKey<F>(elements[0]));
+            } else {
+                filter->mightContainBatch(elements, count, results);
+            }
+        } else {
+            for (size_t i = 0; i < count; i++) {
+                results[i] = filter->mightContain(asKey<F>(elements[i]));
+            }
+        }
+    }
+
+    size_t getSize() const override { return filter->getSize(); }
+
+    unsigned int getNumHashes() const override {
+        if constexpr (filter_handle_detail::HasNumHashes<F>::value) {
+            return filter->getNumHashes();
+        } else {
+            return 0;
+        }
+    }
+
+    double getFalsePositiveRate(size_t insertedItems) const override {
+        using namespace filter_handle_detail;
+        if constexpr (HasFprForCount<F>::value) {
+            return filter->getCurrentFalsePositiveRate(insertedItems);
+        } else if constexpr (HasFprAtFill<F>::value) {
+            return filter->getCurrentFalsePositiveRate();
+        } else {
+            return filter->getFalsePositiveRate();
+        }
+    }
+
+    bool supportsInsert() const override {
+        using namespace filter_handle_detail;
+        return HasInsertBatch<F>::value || HasInsert<F>::value;
+    }
+
+    bool supportsSave() const override {
+        return filter_handle_detail::HasSave<F>::value;
+    }
+
+    bool clear() override {
+        if constexpr (filter_handle_detail::HasClear<F>::value) {
+            filter->clear();
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    bool unionWith(const Concept& other) override {
+        if constexpr (filter_handle_detail::HasUnionWith<F>::value) {
+            const F* from = static_cast<const F*>(other.get(FilterHandle::typeTag<F>()));
+            return from && filter->unionWith(*from);
+        } else {
+            return false;
+        }
+    }
+
+    bool intersectWith(const Concept& other) override {
+        if constexpr (filter_handle_detail::HasIntersectWith<F>::value) {
+            const F* from = static_cast<const F*>(other.get(FilterHandle::typeTag<F>()));
+            return from && filter->intersectWith(*from);
+        } else {
+            return false;
+        }
+    }
+
+    double estimateCardinality() const override {
+        if constexpr (filter_handle_detail::HasEstimateCardinality<F>::value) {
+            return filter->estimateCardinality();
+        } else {
+            return -1.0;
+        }
+    }
+
+    bool fillMetrics(FilterMetrics& metrics) const override {
+        using namespace filter_handle_detail;
+        if constexpr (HasFillRatio<F>::value) {
+            metrics.setBits = filter->countSetBits();
+            metrics.fillRatio = filter->getFillRatio();
+            metrics.estimatedItems = estimateItemsFromBits(filter->getSize(), filter->getNumHashes(), metrics.setBits);
+            metrics.estimatedFpr = filter->getFalsePositiveRateFromFill();
+            return true;
+        } else {
+            if constexpr (HasFprAtFill<F>::value) metrics.estimatedFpr = filter->getCurrentFalsePositiveRate();
+            return false;
+        }
+    }
+
+    bool saveToFile(const std::string& filename, bool compress) const override {
+        using namespace filter_handle_detail;
+        if constexpr (HasCompressedSave<F>::value) {
+            return filter->saveToFile(filename, compress);
+        } else if constexpr (HasSave<F>::value) {
+            return filter->saveToFile(filename);
+        } else {
+            return false;
+        }
+    }
+
+    std::unique_ptr<Concept> emptyLike() const override {
+        using namespace filter_handle_detail;
+        std::unique_ptr<F> empty;
+        if constexpr (HasEmptyLike<F>::value) {
+            empty = filter->emptyLike();
+        } else if constexpr (HasNumHashes<F>::value && std::is_constructible_v<F, size_t, unsigned int>) {
+            empty.reset(new F(filter->getSize(), filter->getNumHashes()));
+        } else if constexpr (HasClear<F>::value && std::is_copy_constructible_v<F>) {
+            empty.reset(new F(*filter));
+            empty->clear();
+        } else {
+            return nullptr;
+        }
+        return std::unique_ptr<Concept>(new Model(std::move(empty)));
+    }
+
+    void* get(const void* tag) const override {
+        return tag == FilterHandle::typeTag<F>() ? filter.get() : nullptr;
+    }
+};
+
+template <typename F>
+FilterHandle::FilterHandle(std::unique_ptr<F> filter, std::string name)
+    : impl(filter ? new Model<F>(std::move(filter)) : nullptr), typeName(std::move(name)) {
+}
+
+#endif // FILTER_HANDLE_H
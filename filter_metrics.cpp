@@ -0,0 +1,105 @@
+#include "filter_metrics.h"
+#include <iomanip>
+#include <limits>
+
+using namespace std;
+
+namespace {
+
+// Backslash, double quote and newline are the characters a label value must escape
+string escapeLabel(const string& value) {
+    string escaped;
+    escaped.reserve(value.size());
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            escaped.push_back('\\');
+            escaped.push_back(c);
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else {
+            escaped.push_back(c);
+        }
+    }
+    return escaped;
+}
+
+void writeFamily(ostream& out, const string& labels, const char* name, const char* kind, const char* help,
+                 double value) {
+    out << "# HELP " << name << " " << help << "\n"
+        << "# TYPE " << name << " " << kind << "\n"
+        << name << labels << " " << value << "\n";
+}
+
+} // namespace
+
+void writePrometheus(ostream& out, const FilterMetrics& metrics, const MetricLabels& extraLabels) {
+    string labels = "{type=\"" + escapeLabel(metrics.type) + "\"";
+    for (const auto& label : extraLabels) {
+        labels += "," + label.first + "=\"" + escapeLabel(label.second) + "\"";
+    }
+    labels += "}";
+
+    // Counters and bit counts are integers well inside a double's exact range
+    ios::fmtflags flags = out.flags();
+    streamsize precision = out.precision(numeric_limits<double>::max_digits10);
+    out.unsetf(ios::floatfield);
+
+    writeFamily(out, labels, "bloom_filter_size_bits", "gauge", "Size of the filter in bits.",
+                static_cast<double>(metrics.sizeBits));
+    if (metrics.numHashes) {
+        writeFamily(out, labels, "bloom_filter_hash_functions", "gauge", "Hash functions per key.",
+                    metrics.numHashes);
+    }
+    writeFamily(out, labels, "bloom_filter_inserts_total", "counter", "Keys inserted.",
+                static_cast<double>(metrics.inserts));
+    writeFamily(out, labels, "bloom_filter_queries_total", "counter", "Keys queried.",
+                static_cast<double>(metrics.queries));
+    writeFamily(out, labels, "bloom_filter_positives_total", "counter", "Queries answered might-be-present.",
+                static_cast<double>(metrics.positives));
+    writeFamily(out, labels, "bloom_filter_positive_ratio", "gauge", "Fraction of queries answered positive.",
+                metrics.positiveRate());
+    if (metrics.hasFill) {
+        writeFamily(out, labels, "bloom_filter_set_bits", "gauge", "Bits set in the filter.",
+                    static_cast<double>(metrics.setBits));
+        writeFamily(out, labels, "bloom_filter_fill_ratio", "gauge", "Fraction of the bits that are set.",
+                    metrics.fillRatio);
+        writeFamily(out, labels, "bloom_filter_estimated_items", "gauge", "Items held, estimated from the fill.",
+                    metrics.estimatedItems);
+    }
+    writeFamily(out, labels, "bloom_filter_estimated_fpr", "gauge", "False positive rate implied by the fill.",
+                metrics.estimatedFpr);
+
+    out.precision(precision);
+    out.flags(flags);
+}
+
+void writeLatencyPrometheus(ostream& out, const vector<LatencySummary>& summaries, const MetricLabels& extraLabels) {
+    if (summaries.empty()) return;
+    string labels;
+    for (const auto& label : extraLabels) {
+        labels += "," + label.first + "=\"" + escapeLabel(label.second) + "\"";
+    }
+
+    ios::fmtflags flags = out.flags();
+    streamsize precision = out.precision(numeric_limits<double>::max_digits10);
+    out.unsetf(ios::floatfield);
+
+    out << "# HELP bloom_filter_latency_nanoseconds Sampled call latency percentiles.\n"
+        << "# TYPE bloom_filter_latency_nanoseconds gauge\n";
+    for (const LatencySummary& summary : summaries) {
+        string op = string("{op=\"") + profiledOpName(summary.op) + "\"" + labels;
+        out << "bloom_filter_latency_nanoseconds" << op << ",quantile=\"0.5\"} " << summary.p50Ns << "\n"
+            << "bloom_filter_latency_nanoseconds" << op << ",quantile=\"0.99\"} " << summary.p99Ns << "\n"
+            << "bloom_filter_latency_nanoseconds" << op << ",quantile=\"0.999\"} " << summary.p999Ns << "\n"
+            << "bloom_filter_latency_nanoseconds" << op << ",quantile=\"1\"} " << summary.maxNs << "\n";
+    }
+    out << "# HELP bloom_filter_latency_samples_total Calls timed for the latency percentiles.\n"
+        << "# TYPE bloom_filter_latency_samples_total counter\n";
+    for (const LatencySummary& summary : summaries) {
+        out << "bloom_filter_latency_samples_total{op=\"" << profiledOpName(summary.op) << "\"" << labels << "} "
+            << summary.samples << "\n";
+    }
+
+    out.precision(precision);
+    out.flags(flags);
+}
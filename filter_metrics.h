@@ -0,0 +1,52 @@
+#ifndef FILTER_METRICS_H
+#define FILTER_METRICS_H
+
+#include "latency_profile.h"
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Point-in-time counters and fill of one filter, as gathered by FilterHandle::metrics().
+// Nothing here scans the bit array: the set-bit count is the filter's running total.
+// The exception is a filter opened with openMapped, which has no total yet and counts
+// its mapped words on each call (near-zero startup is the point of mapping).
+struct FilterMetrics {
+    std::string type;
+    size_t sizeBits = 0;
+    // 0 for variants that do not use k hash functions
+    unsigned int numHashes = 0;
+
+    // Keys passed to the handle's insert and query calls, and queries answered yes
+    uint64_t inserts = 0;
+    uint64_t queries = 0;
+    uint64_t positives = 0;
+
+    // False for variants without a plain bit array (counting, scalable, cuckoo, static);
+    // their estimatedFpr still comes from the variant's own model where it has one
+    bool hasFill = false;
+    uint64_t setBits = 0;
+    double fillRatio = 0.0;
+
+    // Items and false positive rate implied by the measured fill
+    double estimatedItems = 0.0;
+    double estimatedFpr = 0.0;
+
+    double positiveRate() const { return queries ? static_cast<double>(positives) / queries : 0.0; }
+};
+
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+// Write metrics in the Prometheus text exposition format (0.0.4), one bloom_filter_*
+// family per field. Every sample carries a type label plus extraLabels; label values
+// are escaped. Fill families are left out for variants without a fill.
+void writePrometheus(std::ostream& out, const FilterMetrics& metrics, const MetricLabels& extraLabels = {});
+
+// Write latency percentiles as bloom_filter_latency_nanoseconds{op,quantile} gauges and
+// bloom_filter_latency_samples_total{op}; nothing when summaries is empty
+void writeLatencyPrometheus(std::ostream& out, const std::vector<LatencySummary>& summaries,
+                            const MetricLabels& extraLabels = {});
+
+#endif // FILTER_METRICS_H
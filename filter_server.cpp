@@ -0,0 +1,614 @@
+#include "filter_server.h"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <string_view>
+
+using namespace std;
+
+namespace {
+
+// Bytes asked of the kernel per read()
+constexpr size_t kReadChunkBytes = 256 << 10;
+
+// Stop reading from a connection while this much of its output is unsent
+constexpr size_t kMaxPendingOutput = 8 << 20;
+
+constexpr int kMaxEvents = 256;
+
+// Largest HTTP request head accepted before the connection is dropped
+constexpr size_t kMaxHttpRequestBytes = 8 << 10;
+
+void appendBytes(vector<char>& out, const void* data, size_t length) {
+    const char* bytes = static_cast<const char*>(data);
+    out.insert(out.end(), bytes, bytes + length);
+}
+
+void appendHeader(vector<char>& out, FrameOp op, FrameStatus status, uint32_t count, uint32_t payloadBytes) {
+    FrameHeader header;
+    header.op = static_cast<uint8_t>(op);
+    header.status = static_cast<uint8_t>(status);
+    header.reserved = 0;
+    header.count = count;
+    header.payloadBytes = payloadBytes;
+    appendBytes(out, &header, sizeof(header));
+}
+
+void appendReloadReply(vector<char>& out, bool ok, uint64_t loadedGeneration) {
+    appendHeader(out, FrameOp::Reload, ok ? FrameStatus::Ok : FrameStatus::ReloadFailed, 0,
+                 sizeof(loadedGeneration));
+    appendBytes(out, &loadedGeneration, sizeof(loadedGeneration));
+}
+
+// One client socket and its unparsed input / unsent output
+struct Connection {
+    int fd;
+    // Names the connection to the reloader; unlike its address, never reused
+    uint64_t id;
+    // input[inputStart, inputEnd) is received but not yet answered; the buffer is not
+    // zero-filled, since every byte of it is written by recv first
+    unique_ptr<char[]> input;
+    size_t inputCapacity = 0;
+    size_t inputStart = 0;
+    size_t inputEnd = 0;
+    vector<char> output;
+    size_t outputStart = 0;
+    // Close once the output drains (after a BadRequest reply)
+    bool closing = false;
+    // A Reload frame is with the reloader; later frames wait for its reply
+    bool awaitingReload = false;
+    // Out of epoll and waiting to be freed once the current batch of events is handled
+    bool closed = false;
+    // Events currently registered with epoll
+    uint32_t events = 0;
+
+    Connection(int socket, uint64_t connectionId) : fd(socket), id(connectionId) {}
+    ~Connection() { close(fd); }
+
+    size_t pendingOutput() const { return output.size() - outputStart; }
+
+    // Room for at least bytes more input after inputEnd
+    void reserveInput(size_t bytes) {
+        if (inputCapacity - inputEnd >= bytes) return;
+        size_t unread = inputEnd - inputStart;
+        size_t capacity = max(inputCapacity, unread + bytes);
+        if (capacity > inputCapacity) capacity = max(capacity, inputCapacity * 2);
+        if (capacity == inputCapacity) {
+            memmove(input.get(), input.get() + inputStart, unread);
+        } else {
+            unique_ptr<char[]> grown(new char[capacity]);
+            if (unread) memcpy(grown.get(), input.get() + inputStart, unread);
+            input = move(grown);
+            inputCapacity = capacity;
+        }
+        inputStart = 0;
+        inputEnd = unread;
+    }
+};
+
+// Outcome of a Reload frame, handed back to the worker that received it
+struct FinishedReload {
+    uint64_t connectionId;
+    bool ok;
+    uint64_t generation;
+};
+
+} // namespace
+
+struct FilterServer::Worker {
+    int epollFd = -1;
+    int listenFd = -1;
+    // Signalled by stop() and whenever the reloader finishes one of this worker's frames
+    int wakeFd = -1;
+    vector<unique_ptr<Connection>> connections;
+    uint64_t nextConnectionId = 0;
+
+    // Written by the reloader and stop(), drained by the worker on wakeFd
+    mutex wakeLock;
+    vector<FinishedReload> finishedReloads;
+    bool stopRequested = false;
+
+    // Reused per query frame
+    vector<string_view> keys;
+    unique_ptr<bool[]> results;
+    size_t resultCapacity = 0;
+
+    ~Worker() {
+        if (epollFd >= 0) close(epollFd);
+        if (listenFd >= 0) close(listenFd);
+        if (wakeFd >= 0) close(wakeFd);
+    }
+};
+
+struct FilterServer::ReloadRequest {
+    Worker* worker;
+    uint64_t connectionId;
+    // Empty: the file being served
+    string path;
+};
+
+FilterServer::FilterServer(FilterServerOptions serverOptions)
+    : options(move(serverOptions)), boundPort(0), generation(0), stopping(false) {
+}
+
+FilterServer::~FilterServer() {
+    stop();
+}
+
+shared_ptr<const FilterHandle> FilterServer::openFilter(const string& filename) {
+    // Compressed snapshots cannot be mapped, so fall back to reading them
+    try {
+        FilterHandle handle = FilterHandle::loadFromFile(filename, true);
+        if (!handle) handle = FilterHandle::loadFromFile(filename, false);
+        if (!handle) return nullptr;
+        return make_shared<const FilterHandle>(move(handle));
+    } catch (const exception&) {
+        // A corrupt file can still ask for more memory than there is
+        return nullptr;
+    }
+}
+
+shared_ptr<const FilterHandle> FilterServer::filter() const {
+    lock_guard<mutex> guard(currentLock);
+    return current;
+}
+
+string FilterServer::metricsText() const {
+    ostringstream text;
+    writePrometheus(text, filter()->metrics());
+    writeLatencyPrometheus(text, latencySummaries());
+    text << "# HELP bloom_filter_generation Successful filter loads since the server started.\n"
+         << "# TYPE bloom_filter_generation gauge\n"
+         << "bloom_filter_generation " << filterGeneration() << "\n";
+    return text.str();
+}
+
+bool FilterServer::reload(const string& filename) {
+    lock_guard<mutex> guard(reloadLock);
+    string path = filename.empty() ? options.filterFile : filename;
+    shared_ptr<const FilterHandle> loaded = openFilter(path);
+    if (!loaded) return false;
+    {
+        lock_guard<mutex> swapGuard(currentLock);
+        current = move(loaded);
+    }
+    options.filterFile = path;
+    generation.fetch_add(1, memory_order_relaxed);
+    return true;
+}
+
+void FilterServer::runReloader() {
+    unique_lock<mutex> lock(reloadQueueLock);
+    while (true) {
+        reloadQueued.wait(lock, [this]() { return stopping || !reloadQueue.empty(); });
+        if (stopping) return;
+        vector<ReloadRequest> batch;
+        batch.swap(reloadQueue);
+        lock.unlock();
+
+        // Frames queued together for the same file share one load
+        vector<bool> answered(batch.size(), false);
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (answered[i]) continue;
+            bool ok = reload(batch[i].path);
+            FinishedReload finished = {0, ok, filterGeneration()};
+            for (size_t j = i; j < batch.size(); j++) {
+                if (answered[j] || batch[j].path != batch[i].path) continue;
+                answered[j] = true;
+                Worker& worker = *batch[j].worker;
+                finished.connectionId = batch[j].connectionId;
+                {
+                    lock_guard<mutex> guard(worker.wakeLock);
+                    worker.finishedReloads.push_back(finished);
+                }
+                uint64_t one = 1;
+                if (write(worker.wakeFd, &one, sizeof(one)) < 0) {
+                    // The counter is saturated, so the worker is already due to wake
+                }
+            }
+        }
+        lock.lock();
+    }
+}
+
+int FilterServer::listenOn(uint16_t port) {
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+    addrinfo* addresses = nullptr;
+    string service = to_string(port);
+    if (getaddrinfo(options.host.empty() ? nullptr : options.host.c_str(), service.c_str(), &hints, &addresses) != 0) {
+        problem = "cannot resolve " + options.host;
+        return -1;
+    }
+
+    int fd = -1;
+    for (addrinfo* address = addresses; address; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, address->ai_protocol);
+        if (fd < 0) continue;
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+        if (bind(fd, address->ai_addr, address->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0) problem = "cannot listen on " + options.host + ":" + service + ": " + strerror(errno);
+    return fd;
+}
+
+bool FilterServer::start() {
+    if (!threads.empty()) return true;
+    stopping = false;
+    if (!reload(options.filterFile)) {
+        problem = "cannot load filter from " + options.filterFile;
+        return false;
+    }
+
+    unsigned int count = options.threads ? options.threads : max(1u, thread::hardware_concurrency());
+    uint16_t port = options.port;
+    for (unsigned int i = 0; i < count; i++) {
+        unique_ptr<Worker> worker(new Worker());
+        worker->listenFd = listenOn(port);
+        if (worker->listenFd < 0) {
+            workers.clear();
+            return false;
+        }
+        if (i == 0) {
+            // Later workers join the port the first one was given
+            sockaddr_storage bound;
+            socklen_t length = sizeof(bound);
+            getsockname(worker->listenFd, reinterpret_cast<sockaddr*>(&bound), &length);
+            port = ntohs(bound.ss_family == AF_INET6 ? reinterpret_cast<sockaddr_in6*>(&bound)->sin6_port
+                                                     : reinterpret_cast<sockaddr_in*>(&bound)->sin_port);
+        }
+        worker->epollFd = epoll_create1(EPOLL_CLOEXEC);
+        worker->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        epoll_event listenEvent = {};
+        listenEvent.events = EPOLLIN;
+        listenEvent.data.ptr = nullptr;
+        epoll_event wakeEvent = {};
+        wakeEvent.events = EPOLLIN;
+        wakeEvent.data.ptr = &worker->wakeFd;
+        if (worker->epollFd < 0 || worker->wakeFd < 0 ||
+            epoll_ctl(worker->epollFd, EPOLL_CTL_ADD, worker->listenFd, &listenEvent) != 0 ||
+            epoll_ctl(worker->epollFd, EPOLL_CTL_ADD, worker->wakeFd, &wakeEvent) != 0) {
+            problem = string("cannot set up the event loop: ") + strerror(errno);
+            workers.clear();
+            return false;
+        }
+        workers.push_back(move(worker));
+    }
+    boundPort = port;
+
+    reloader = thread([this]() { runReloader(); });
+    for (auto& worker : workers) {
+        threads.emplace_back([this, &worker]() { runWorker(*worker); });
+    }
+    return true;
+}
+
+void FilterServer::stop() {
+    // The reloader posts to the workers, so it goes first
+    {
+        lock_guard<mutex> guard(reloadQueueLock);
+        stopping = true;
+        reloadQueue.clear();
+    }
+    reloadQueued.notify_one();
+    if (reloader.joinable()) reloader.join();
+
+    for (auto& worker : workers) {
+        {
+            lock_guard<mutex> guard(worker->wakeLock);
+            worker->stopRequested = true;
+        }
+        uint64_t one = 1;
+        if (write(worker->wakeFd, &one, sizeof(one)) < 0) {
+            // The loop also exits on its next event; nothing else to do
+        }
+    }
+    for (auto& th : threads) th.join();
+    threads.clear();
+    workers.clear();
+}
+
+namespace {
+
+// Register the events a connection currently needs: input unless its output is
+// backed up (or it is closing, or waiting on a reload), output while any is unsent
+bool updateEvents(int epollFd, Connection& connection) {
+    uint32_t wanted = 0;
+    if (!connection.closing && !connection.awaitingReload && connection.pendingOutput() < kMaxPendingOutput) {
+        wanted |= EPOLLIN;
+    }
+    if (connection.pendingOutput() > 0) wanted |= EPOLLOUT;
+    if (wanted == connection.events) return true;
+    epoll_event event = {};
+    event.events = wanted;
+    event.data.ptr = &connection;
+    connection.events = wanted;
+    return epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.fd, &event) == 0;
+}
+
+// Send as much pending output as the socket takes; false if the peer is gone
+bool flushOutput(Connection& connection) {
+    while (connection.pendingOutput() > 0) {
+        ssize_t sent = send(connection.fd, connection.output.data() + connection.outputStart,
+                            connection.pendingOutput(), MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        connection.outputStart += static_cast<size_t>(sent);
+    }
+    connection.output.clear();
+    connection.outputStart = 0;
+    return true;
+}
+
+} // namespace
+
+void FilterServer::runWorker(Worker& worker) {
+    epoll_event events[kMaxEvents];
+
+    // Later events of the same epoll_wait batch may still name the connection, so it is
+    // only marked here and freed by freeClosed() after the batch
+    auto closeConnection = [&worker](Connection* connection) {
+        if (connection->closed) return;
+        epoll_ctl(worker.epollFd, EPOLL_CTL_DEL, connection->fd, nullptr);
+        connection->closed = true;
+    };
+
+    auto freeClosed = [&worker]() {
+        worker.connections.erase(remove_if(worker.connections.begin(), worker.connections.end(),
+                                           [](const unique_ptr<Connection>& c) { return c->closed; }),
+                                 worker.connections.end());
+    };
+
+    // Answer one complete frame; false if the connection must close after its output drains
+    auto answer = [&](Connection& connection, const FrameHeader& header, const char* payload) {
+        vector<char>& out = connection.output;
+        switch (static_cast<FrameOp>(header.op)) {
+            case FrameOp::Query: {
+                worker.keys.clear();
+                size_t offset = 0;
+                for (uint32_t i = 0; i < header.count; i++) {
+                    uint16_t length;
+                    if (header.payloadBytes - offset < sizeof(length)) break;
+                    memcpy(&length, payload + offset, sizeof(length));
+                    offset += sizeof(length);
+                    if (header.payloadBytes - offset < length) break;
+                    worker.keys.emplace_back(payload + offset, length);
+                    offset += length;
+                }
+                if (worker.keys.size() != header.count || offset != header.payloadBytes) {
+                    appendHeader(out, FrameOp::Query, FrameStatus::BadRequest, 0, 0);
+                    return false;
+                }
+                if (worker.resultCapacity < header.count) {
+                    worker.resultCapacity = max<size_t>(header.count, 1024);
+                    worker.results.reset(new bool[worker.resultCapacity]);
+                }
+                shared_ptr<const FilterHandle> snapshot = filter();
+                snapshot->mightContainBatch(worker.keys.data(), header.count, worker.results.get());
+
+                uint32_t bitmapBytes = (header.count + 7) / 8;
+                appendHeader(out, FrameOp::Query, FrameStatus::Ok, header.count, bitmapBytes);
+                size_t base = out.size();
+                out.resize(base + bitmapBytes, 0);
+                for (uint32_t i = 0; i < header.count; i++) {
+                    out[base + i / 8] |= static_cast<char>(worker.results[i] << (i % 8));
+                }
+                return true;
+            }
+            case FrameOp::Info: {
+                shared_ptr<const FilterHandle> snapshot = filter();
+                uint64_t words[2] = {filterGeneration(), snapshot->getSize()};
+                uint32_t hashes[2] = {snapshot->getNumHashes(), 0};
+                const string& name = snapshot->name();
+                appendHeader(out, FrameOp::Info, FrameStatus::Ok, 0,
+                             static_cast<uint32_t>(sizeof(words) + sizeof(hashes) + name.size()));
+                appendBytes(out, words, sizeof(words));
+                appendBytes(out, hashes, sizeof(hashes));
+                appendBytes(out, name.data(), name.size());
+                return true;
+            }
+            case FrameOp::Metrics: {
+                string text = metricsText();
+                appendHeader(out, FrameOp::Metrics, FrameStatus::Ok, 0, static_cast<uint32_t>(text.size()));
+                appendBytes(out, text.data(), text.size());
+                return true;
+            }
+            case FrameOp::Reload: {
+                if (header.payloadBytes && !options.allowPathReload) {
+                    appendHeader(out, FrameOp::Reload, FrameStatus::BadRequest, 0, 0);
+                    return false;
+                }
+                // Answered from the worker's wake event once the reloader is done
+                connection.awaitingReload = true;
+                {
+                    lock_guard<mutex> guard(reloadQueueLock);
+                    reloadQueue.push_back({&worker, connection.id, string(payload, header.payloadBytes)});
+                }
+                reloadQueued.notify_one();
+                return true;
+            }
+        }
+        appendHeader(out, static_cast<FrameOp>(header.op), FrameStatus::UnknownOp, 0, 0);
+        return false;
+    };
+
+    // Answer an HTTP request head (a Prometheus scrape); the connection closes after it
+    auto answerHttp = [&](Connection& connection, string_view request) {
+        string_view target = request.substr(4, request.find(' ', 4) - 4);
+        bool found = target == "/metrics" || target.substr(0, 9) == "/metrics?";
+        string body = found ? metricsText() : string("not found\n");
+        string head = string(found ? "HTTP/1.0 200 OK\r\n" : "HTTP/1.0 404 Not Found\r\n") +
+                      "Content-Type: " + (found ? "text/plain; version=0.0.4" : "text/plain") + "\r\n" +
+                      "Content-Length: " + to_string(body.size()) + "\r\n" +
+                      "Connection: close\r\n\r\n";
+        appendBytes(connection.output, head.data(), head.size());
+        appendBytes(connection.output, body.data(), body.size());
+        connection.closing = true;
+    };
+
+    // Answer every complete frame in the input buffer, stopping early under backpressure
+    // or behind a pending reload
+    auto processInput = [&](Connection& connection) {
+        while (!connection.closing && !connection.awaitingReload && connection.pendingOutput() < kMaxPendingOutput) {
+            size_t available = connection.inputEnd - connection.inputStart;
+            const char* start = connection.input.get() + connection.inputStart;
+            if (available >= 4 && memcmp(start, "GET ", 4) == 0) {
+                // No frame starts with 'G', so this is HTTP; wait for the whole head
+                string_view request(start, available);
+                size_t headEnd = request.find("\r\n\r\n");
+                if (headEnd != string_view::npos) {
+                    answerHttp(connection, request.substr(0, headEnd));
+                } else if (available > kMaxHttpRequestBytes) {
+                    connection.closing = true;
+                }
+                if (connection.closing) connection.inputStart = connection.inputEnd;
+                break;
+            }
+            if (available < sizeof(FrameHeader)) break;
+            FrameHeader header;
+            memcpy(&header, connection.input.get() + connection.inputStart, sizeof(header));
+            if (header.payloadBytes > kMaxFramePayload) {
+                appendHeader(connection.output, static_cast<FrameOp>(header.op), FrameStatus::BadRequest, 0, 0);
+                connection.closing = true;
+                break;
+            }
+            if (available < sizeof(header) + header.payloadBytes) break;
+            const char* payload = connection.input.get() + connection.inputStart + sizeof(header);
+            if (!answer(connection, header, payload)) connection.closing = true;
+            connection.inputStart += sizeof(header) + header.payloadBytes;
+        }
+        if (connection.inputStart == connection.inputEnd) {
+            connection.inputStart = 0;
+            connection.inputEnd = 0;
+        }
+    };
+
+    // Read what the socket has and answer it; false if the peer closed or failed
+    auto readInput = [&](Connection& connection) {
+        while (!connection.closing && !connection.awaitingReload && connection.pendingOutput() < kMaxPendingOutput) {
+            connection.reserveInput(kReadChunkBytes);
+            size_t room = connection.inputCapacity - connection.inputEnd;
+            ssize_t got = recv(connection.fd, connection.input.get() + connection.inputEnd, room, 0);
+            if (got == 0) return false;
+            if (got < 0) {
+                if (errno == EINTR) continue;
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            connection.inputEnd += static_cast<size_t>(got);
+            processInput(connection);
+            if (static_cast<size_t>(got) < room) break;
+        }
+        return true;
+    };
+
+    // Flush what a connection has ready and answer frames unblocked by the flush; false
+    // if the peer is gone
+    auto flushAndContinue = [&](Connection& connection) {
+        if (!flushOutput(connection)) return false;
+        processInput(connection);
+        return flushOutput(connection);
+    };
+
+    // Close the connection if it is dead or done, otherwise re-arm its events
+    auto settle = [&](Connection* connection, bool alive) {
+        if (connection->closing && connection->pendingOutput() == 0) alive = false;
+        if (!alive || !updateEvents(worker.epollFd, *connection)) {
+            closeConnection(connection);
+        }
+    };
+
+    // Send the replies to reloads the reloader finished; true once stop() was called
+    auto handleWake = [&]() {
+        uint64_t count;
+        if (read(worker.wakeFd, &count, sizeof(count)) < 0) {
+            // Already drained; the lists below are what matter
+        }
+        vector<FinishedReload> finished;
+        {
+            lock_guard<mutex> guard(worker.wakeLock);
+            if (worker.stopRequested) return true;
+            finished.swap(worker.finishedReloads);
+        }
+        for (const FinishedReload& reloaded : finished) {
+            auto it = find_if(worker.connections.begin(), worker.connections.end(),
+                              [&reloaded](const unique_ptr<Connection>& c) { return c->id == reloaded.connectionId; });
+            // The client may have hung up while the file loaded
+            if (it == worker.connections.end() || (*it)->closed) continue;
+            Connection* connection = it->get();
+            appendReloadReply(connection->output, reloaded.ok, reloaded.generation);
+            connection->awaitingReload = false;
+            settle(connection, flushAndContinue(*connection));
+        }
+        return false;
+    };
+
+    while (true) {
+        int ready = epoll_wait(worker.epollFd, events, kMaxEvents, -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 0; i < ready; i++) {
+            void* tag = events[i].data.ptr;
+            if (tag == &worker.wakeFd) {
+                if (handleWake()) return;
+                continue;
+            }
+
+            if (!tag) {
+                // Accept every pending connection
+                while (true) {
+                    int fd = accept4(worker.listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if (fd < 0) break;
+                    int on = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                    unique_ptr<Connection> connection(new Connection(fd, worker.nextConnectionId++));
+                    epoll_event event = {};
+                    event.events = EPOLLIN;
+                    event.data.ptr = connection.get();
+                    connection->events = EPOLLIN;
+                    if (epoll_ctl(worker.epollFd, EPOLL_CTL_ADD, fd, &event) == 0) {
+                        worker.connections.push_back(move(connection));
+                    }
+                }
+                continue;
+            }
+
+            Connection* connection = static_cast<Connection*>(tag);
+            // Closed earlier in this batch, e.g. after its reload reply
+            if (connection->closed) continue;
+            bool alive = !(events[i].events & EPOLLERR);
+            // A hung-up peer cannot take the reload reply, and would report EPOLLHUP until then
+            if (alive && connection->awaitingReload && (events[i].events & EPOLLHUP)) alive = false;
+            if (alive && (events[i].events & (EPOLLIN | EPOLLHUP))) alive = readInput(*connection);
+            if (alive) {
+                // Frames left unanswered under backpressure are picked up once output drains
+                alive = flushAndContinue(*connection);
+            } else {
+                // The peer is gone or half-closed: send what is ready, then close
+                flushOutput(*connection);
+            }
+            settle(connection, alive);
+        }
+        freeClosed();
+    }
+}
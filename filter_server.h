@@ -0,0 +1,159 @@
+#ifndef FILTER_SERVER_H
+#define FILTER_SERVER_H
+
+#include "filter_handle.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Read-only network front end for a saved filter.
+//
+// Each worker thread runs its own epoll loop over its own SO_REUSEPORT listening
+// socket, so the kernel spreads connections across cores and workers share nothing
+// but the filter. Sockets are non-blocking; every complete frame in a read is answered
+// before the replies are written back in one send, so clients can pipeline many frames
+// per round trip. A query frame carries many keys and is answered through
+// mightContainBatch with a bitmap.
+//
+// The filter is opened from its mapped format (falling back to a full load for
+// compressed snapshots). reload() swaps in a freshly opened copy of the file: frames
+// already being answered finish on the old copy, and no connection is dropped. A file
+// that fails to load (or throws while loading) leaves the current filter in place.
+// Reload frames are handed to a reloader thread, so a slow load never stalls an event
+// loop; the connection that sent one is not answered further until its reply is sent.
+//
+// Wire format, little-endian. Every frame, in both directions, starts with
+//   uint8 op, uint8 status, uint16 reserved, uint32 count, uint32 payloadBytes
+// followed by payloadBytes of payload. Requests send status 0; responses echo op.
+//   Query   request payload: count keys, each a uint16 length then its bytes.
+//           response payload: ceil(count / 8) bytes; bit i (LSB first) is set if
+//           key i might be present.
+//   Info    request payload empty. response payload: uint64 generation, uint64 size
+//           in bits, uint32 hash count (0 if not applicable), uint32 reserved, then the
+//           filter type name.
+//   Reload  request payload empty, or a new filter path if allowPathReload is set
+//           (otherwise a path is a BadRequest). response payload: uint64 generation
+//           after the attempt; status ReloadFailed if the file did not load.
+//   Metrics request payload empty. response payload: the served filter's metrics in
+//           the Prometheus text format (see writePrometheus).
+// A malformed frame is answered with status BadRequest and the connection is closed.
+//
+// A connection that starts with "GET " is taken as an HTTP/1.x request instead, so
+// Prometheus can scrape GET /metrics from the query port; the reply closes it. The
+// insert/query counters restart with each reload.
+
+enum class FrameOp : uint8_t {
+    Query = 1,
+    Info = 2,
+    Reload = 3,
+    Metrics = 4
+};
+
+enum class FrameStatus : uint8_t {
+    Ok = 0,
+    BadRequest = 1,
+    ReloadFailed = 2,
+    UnknownOp = 3
+};
+
+struct FrameHeader {
+    uint8_t op;
+    uint8_t status;
+    uint16_t reserved;
+    uint32_t count;
+    uint32_t payloadBytes;
+};
+
+static_assert(sizeof(FrameHeader) == 12, "frame header layout is part of the protocol");
+
+// Largest payload a request may carry
+constexpr uint32_t kMaxFramePayload = 64u << 20;
+
+struct FilterServerOptions {
+    std::string filterFile;
+    std::string host = "0.0.0.0";
+    // 0 picks a free port; see FilterServer::port()
+    uint16_t port = 7171;
+    // Worker threads, each with its own event loop; 0 uses every hardware thread
+    unsigned int threads = 1;
+    // Let Reload frames name a file to serve instead of the configured one. Any client
+    // can send them, so only set this where every client may read any file the server can
+    bool allowPathReload = false;
+};
+
+class FilterServer {
+private:
+    struct Worker;
+
+    FilterServerOptions options;
+    uint16_t boundPort;
+
+    // Current filter; workers take a reference for each frame they answer
+    std::shared_ptr<const FilterHandle> current;
+    mutable std::mutex currentLock;
+    std::mutex reloadLock;
+    std::atomic<uint64_t> generation;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::string problem;
+
+    // Reload frames waiting for the reloader thread
+    struct ReloadRequest;
+    std::vector<ReloadRequest> reloadQueue;
+    std::mutex reloadQueueLock;
+    std::condition_variable reloadQueued;
+    bool stopping;
+    std::thread reloader;
+
+    // Null if the file does not load
+    static std::shared_ptr<const FilterHandle> openFilter(const std::string& filename);
+
+    // Listening socket on host:port with SO_REUSEPORT; -1 on failure
+    int listenOn(uint16_t port);
+
+    void runWorker(Worker& worker);
+
+    // Answers queued Reload frames until stop()
+    void runReloader();
+
+    // Prometheus exposition of the served filter and the reload generation, plus the
+    // lookup latency percentiles in a profiling build
+    std::string metricsText() const;
+
+public:
+    explicit FilterServer(FilterServerOptions serverOptions);
+    ~FilterServer();
+
+    FilterServer(const FilterServer&) = delete;
+    FilterServer& operator=(const FilterServer&) = delete;
+
+    // Load the filter, bind and start the workers; false (see error()) on failure
+    bool start();
+
+    // Stop accepting, close every connection and join the workers
+    void stop();
+
+    // Swap in a fresh copy of filename (empty: the file being served); false, keeping
+    // the current filter, if it does not load
+    bool reload(const std::string& filename = "");
+
+    // The filter being served; never null once start() succeeded
+    std::shared_ptr<const FilterHandle> filter() const;
+
+    // Bumped by every successful reload
+    uint64_t filterGeneration() const { return generation.load(std::memory_order_relaxed); }
+
+    // Port actually bound, after start()
+    uint16_t port() const { return boundPort; }
+
+    const std::string& error() const { return problem; }
+};
+
+#endif // FILTER_SERVER_H
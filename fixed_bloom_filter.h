@@ -0,0 +1,179 @@
+#ifndef FIXED_BLOOM_FILTER_H
+#define FIXED_BLOOM_FILTER_H
+
+#include "bloom_filter.h"
+#include "hash_policy.h"
+#include "probe_engine.h"
+#include "word_ops.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+namespace fixed_bloom_detail {
+
+// libm's log and ceil are not constexpr. ln(x) = e ln 2 + 2 atanh((m - 1) / (m + 1))
+// for x = m 2^e with m in [1, 2); the series converges fast enough that the sizes
+// agree with BloomFilter::computeOptimalParameters.
+constexpr double kLn2 = 0.693147180559945309417232121458176568;
+
+constexpr double constexprLog(double x) {
+    int exponent = 0;
+    while (x >= 2.0) {
+        x /= 2.0;
+        exponent++;
+    }
+    while (x < 1.0) {
+        x *= 2.0;
+        exponent--;
+    }
+    double y = (x - 1.0) / (x + 1.0);
+    double y2 = y * y;
+    double term = y;
+    double sum = 0.0;
+    for (int i = 1; i < 80; i += 2) {
+        sum += term / i;
+        term *= y2;
+    }
+    return 2.0 * sum + exponent * kLn2;
+}
+
+// Positive values only
+constexpr double constexprCeil(double x) {
+    double truncated = static_cast<double>(static_cast<uint64_t>(x));
+    return truncated < x ? truncated + 1.0 : truncated;
+}
+
+// Same formulas as BloomFilter::computeOptimalParameters (without power-of-two
+// rounding); k comes from the size before it is raised to the 8-bit minimum
+constexpr size_t unclampedBits(size_t expectedItems, double falsePositiveRate) {
+    return static_cast<size_t>(constexprCeil(-1.0 * expectedItems * constexprLog(falsePositiveRate) / (kLn2 * kLn2)));
+}
+
+constexpr size_t optimalBits(size_t expectedItems, double falsePositiveRate) {
+    size_t bits = unclampedBits(expectedItems, falsePositiveRate);
+    return bits < 8 ? 8 : bits;
+}
+
+constexpr unsigned int optimalHashes(size_t expectedItems, double falsePositiveRate) {
+    size_t bits = unclampedBits(expectedItems, falsePositiveRate);
+    unsigned int hashes = static_cast<unsigned int>(constexprCeil((bits / static_cast<double>(expectedItems)) * kLn2));
+    return hashes < 1 ? 1 : hashes;
+}
+
+} // namespace fixed_bloom_detail
+
+// Bloom filter whose geometry is fixed at compile time, for the many small filters
+// built and dropped per request. Size and k are worked out in constexpr from
+// ExpectedItems and the false positive rate in parts per million, the bits live
+// inline in a std::array (no heap allocation, so the filter sits on the stack or in
+// its owner), and the k probes unroll with the size a constant.
+//
+// Bit positions are BloomFilter's (djb2 + sdbm): BloomFilter::createOptimal with the
+// same expected items and rate builds a filter of the same geometry, so the two can
+// be unioned, intersected and converted into one another. The whole array is copied
+// with the filter, so keep ExpectedItems to a few thousand.
+template <size_t ExpectedItems, uint32_t FprPpm>
+class StaticBloomFilter {
+    static_assert(ExpectedItems > 0, "StaticBloomFilter needs at least one expected item");
+    static_assert(FprPpm > 0 && FprPpm < 1000000, "false positive rate must be in (0, 1000000) ppm");
+
+public:
+    static constexpr size_t kBits = fixed_bloom_detail::optimalBits(ExpectedItems, FprPpm / 1e6);
+    static constexpr unsigned int kHashes = fixed_bloom_detail::optimalHashes(ExpectedItems, FprPpm / 1e6);
+    static constexpr size_t kWords = (kBits + 63) / 64;
+
+private:
+    // Power-of-two sizes index with a mask, as BloomFilter does; same bit positions
+    using Reduction = std::conditional_t<(kBits & (kBits - 1)) == 0, MaskReduction, ModuloReduction>;
+    using Engine = ProbeEngine<Djb2SdbmHash, Reduction, kHashes>;
+
+    std::array<uint64_t, kWords> words{};
+
+    static bool sameGeometry(const BloomFilter& other) {
+        return other.size == kBits && other.numHashes == kHashes;
+    }
+
+public:
+    constexpr StaticBloomFilter() = default;
+
+    // Insert an element; same bits as BloomFilter::insert
+    void insert(std::string_view element) {
+        Engine::insert(words.data(), kBits, kHashes, element.data(), element.size());
+    }
+    void insert(const void* data, size_t len) {
+        Engine::insert(words.data(), kBits, kHashes, static_cast<const char*>(data), len);
+    }
+    void insert(uint64_t key) {
+        Engine::insertHashed(words.data(), kBits, kHashes, Djb2SdbmHash::hashKey(key));
+    }
+
+    // Check if an element might be in the set
+    bool mightContain(std::string_view element) const {
+        return Engine::contains(words.data(), kBits, kHashes, element.data(), element.size());
+    }
+    bool mightContain(const void* data, size_t len) const {
+        return Engine::contains(words.data(), kBits, kHashes, static_cast<const char*>(data), len);
+    }
+    bool mightContain(uint64_t key) const {
+        return Engine::containsHashed(words.data(), kBits, kHashes, Djb2SdbmHash::hashKey(key));
+    }
+
+    static constexpr size_t getSize() { return kBits; }
+    static constexpr unsigned int getNumHashes() { return kHashes; }
+
+    void clear() { words.fill(0); }
+
+    // Number of bits set (counted on demand; there is no running count to maintain
+    // on insert) and the item count estimated from it
+    size_t countSetBits() const { return popcountWords(words.data(), kWords); }
+    double estimateCardinality() const { return estimateItemsFromBits(kBits, kHashes, countSetBits()); }
+
+    // OR / AND another filter of the same parameters into this one
+    void unionWith(const StaticBloomFilter& other) {
+        for (size_t i = 0; i < kWords; i++) words[i] |= other.words[i];
+    }
+    void intersectWith(const StaticBloomFilter& other) {
+        for (size_t i = 0; i < kWords; i++) words[i] &= other.words[i];
+    }
+
+    // OR / AND a dynamic filter into this one; false unless it has kBits bits and
+    // kHashes hashes
+    bool unionWith(const BloomFilter& other) {
+        if (!sameGeometry(other)) return false;
+        orWords(words.data(), other.bitArray.data(), kWords);
+        return true;
+    }
+    bool intersectWith(const BloomFilter& other) {
+        if (!sameGeometry(other)) return false;
+        andWords(words.data(), other.bitArray.data(), kWords);
+        return true;
+    }
+
+    // OR this filter into a dynamic one, e.g. to fold per-request filters into a
+    // long-lived one; false on a geometry mismatch
+    bool mergeInto(BloomFilter& target) const {
+        if (!sameGeometry(target)) return false;
+        // Count the bits turned on as they are ORed, so a large target is not recounted
+        uint64_t* targetWords = target.bitArray.data();
+        size_t added = 0;
+        for (size_t i = 0; i < kWords; i++) {
+            added += __builtin_popcountll(words[i] & ~targetWords[i]);
+            targetWords[i] |= words[i];
+        }
+        if (target.setBitsCounted) target.setBits += added;
+        return true;
+    }
+
+    // Dynamic copy, e.g. to save or serve the filter
+    BloomFilter toBloomFilter() const {
+        BloomFilter filter(kBits, kHashes);
+        memcpy(filter.bitArray.data(), words.data(), sizeof(words));
+        filter.recountSetBits();
+        return filter;
+    }
+};
+
+#endif // FIXED_BLOOM_FILTER_H
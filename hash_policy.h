@@ -0,0 +1,154 @@
+#ifndef HASH_POLICY_H
+#define HASH_POLICY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// A key hashed once into the two values that drive double hashing
+struct HashPair {
+    uint64_t h1;
+    uint64_t h2;
+};
+
+// Identifiers recorded alongside saved filters
+enum class HashPolicyId : uint32_t {
+    Djb2Sdbm = 0,
+    WyHash = 1
+};
+
+// Legacy policy: djb2 and sdbm computed together in a single pass.
+// Produces exactly the bit positions of the original per-probe lambdas, so filters
+// saved before the probe engine existed stay valid.
+struct Djb2SdbmHash {
+    static constexpr HashPolicyId id = HashPolicyId::Djb2Sdbm;
+
+    static HashPair hash(const char* data, size_t len) {
+        uint64_t hash1 = 5381;
+        uint64_t hash2 = 0;
+        for (size_t i = 0; i < len; i++) {
+            // Keys were hashed as (signed) char; keep the sign extension
+            uint64_t c = static_cast<uint64_t>(static_cast<int64_t>(static_cast<signed char>(data[i])));
+            hash1 = ((hash1 << 5) + hash1) + c;
+            hash2 = c + (hash2 << 6) + (hash2 << 16) - hash2;
+        }
+        return {hash1, hash2};
+    }
+
+    // hash() of the key's 8 little-endian bytes, unrolled and without touching memory
+    static HashPair hashKey(uint64_t key) {
+        uint64_t hash1 = 5381;
+        uint64_t hash2 = 0;
+        for (unsigned int i = 0; i < 8; i++) {
+            uint64_t c = static_cast<uint64_t>(static_cast<int64_t>(static_cast<signed char>(key >> (8 * i))));
+            hash1 = ((hash1 << 5) + hash1) + c;
+            hash2 = c + (hash2 << 6) + (hash2 << 16) - hash2;
+        }
+        return {hash1, hash2};
+    }
+};
+
+// wyhash (final4): a fast 64-bit hash with good avalanche on short, similar keys
+struct WyHash {
+    static constexpr HashPolicyId id = HashPolicyId::WyHash;
+
+    static constexpr uint64_t kSecret0 = 0x2d358dccaa6c78a5ULL;
+    static constexpr uint64_t kSecret1 = 0x8bb84b93962eacc9ULL;
+    static constexpr uint64_t kSecret2 = 0x4b33a62ed433d4a3ULL;
+    static constexpr uint64_t kSecret3 = 0x4d5a2da51de1aa47ULL;
+
+    static void mum(uint64_t& a, uint64_t& b) {
+        __uint128_t r = static_cast<__uint128_t>(a) * b;
+        a = static_cast<uint64_t>(r);
+        b = static_cast<uint64_t>(r >> 64);
+    }
+
+    static uint64_t mix(uint64_t a, uint64_t b) {
+        mum(a, b);
+        return a ^ b;
+    }
+
+    static uint64_t read8(const uint8_t* p) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        return v;
+    }
+
+    static uint64_t read4(const uint8_t* p) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        return v;
+    }
+
+    static uint64_t read3(const uint8_t* p, size_t k) {
+        return (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[k >> 1]) << 8) | p[k - 1];
+    }
+
+    static uint64_t hash64(const void* key, size_t len, uint64_t seed = 0) {
+        const uint8_t* p = static_cast<const uint8_t*>(key);
+        seed ^= mix(seed ^ kSecret0, kSecret1);
+        uint64_t a, b;
+        if (len <= 16) {
+            if (len >= 4) {
+                a = (read4(p) << 32) | read4(p + ((len >> 3) << 2));
+                b = (read4(p + len - 4) << 32) | read4(p + len - 4 - ((len >> 3) << 2));
+            } else if (len > 0) {
+                a = read3(p, len);
+                b = 0;
+            } else {
+                a = b = 0;
+            }
+        } else {
+            size_t i = len;
+            if (i > 48) {
+                uint64_t see1 = seed, see2 = seed;
+                do {
+                    seed = mix(read8(p) ^ kSecret1, read8(p + 8) ^ seed);
+                    see1 = mix(read8(p + 16) ^ kSecret2, read8(p + 24) ^ see1);
+                    see2 = mix(read8(p + 32) ^ kSecret3, read8(p + 40) ^ see2);
+                    p += 48;
+                    i -= 48;
+                } while (i > 48);
+                seed ^= see1 ^ see2;
+            }
+            while (i > 16) {
+                seed = mix(read8(p) ^ kSecret1, read8(p + 8) ^ seed);
+                i -= 16;
+                p += 16;
+            }
+            a = read8(p + i - 16);
+            b = read8(p + i - 8);
+        }
+        a ^= kSecret1;
+        b ^= seed;
+        mum(a, b);
+        return mix(a ^ kSecret0 ^ len, b ^ kSecret1);
+    }
+
+    // hash64() of the key's 8 little-endian bytes: the len == 8 branch with the
+    // 4-byte reads taken straight from the register
+    static uint64_t hash64Key(uint64_t key, uint64_t seed = 0) {
+        seed ^= mix(seed ^ kSecret0, kSecret1);
+        uint64_t lo = key & 0xffffffffULL;
+        uint64_t hi = key >> 32;
+        uint64_t a = ((lo << 32) | hi) ^ kSecret1;
+        uint64_t b = ((hi << 32) | lo) ^ seed;
+        mum(a, b);
+        return mix(a ^ kSecret0 ^ 8, b ^ kSecret1);
+    }
+
+    static HashPair hash(const char* data, size_t len) {
+        return fromHash64(hash64(data, len));
+    }
+
+    static HashPair hashKey(uint64_t key) {
+        return fromHash64(hash64Key(key));
+    }
+
+    // Second value costs one extra multiply instead of another pass over the key
+    static HashPair fromHash64(uint64_t h) {
+        return {h, mix(h ^ kSecret2, kSecret3)};
+    }
+};
+
+#endif // HASH_POLICY_H
@@ -0,0 +1,226 @@
+#include "key_set.h"
+#include "atomic_file.h"
+#include "checksum.h"
+#include "hash_policy.h"
+#include "line_reader.h"
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+constexpr char kKeySetMagic[8] = {'B', 'L', 'O', 'O', 'M', 'K', 'E', 'Y'};
+constexpr uint32_t kKeySetVersion = 1;
+
+constexpr size_t kInitialSlots = 1024;
+
+// Payload bytes parsed per read when loading
+constexpr size_t kReadChunkBytes = 1 << 16;
+
+struct KeySetFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved0;
+    uint64_t keyCount;
+    uint64_t payloadBytes;
+    uint32_t checksum;
+    uint32_t reserved1;
+};
+
+static_assert(sizeof(KeySetFileHeader) == 40, "key set header layout is part of the file format");
+
+inline size_t encodeLength(uint64_t value, uint8_t* out) {
+    size_t n = 0;
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        out[n++] = value ? byte | 0x80 : byte;
+    } while (value);
+    return n;
+}
+
+} // namespace
+
+KeySet::KeySet() : slots(kInitialSlots, Slot{0, nullptr}), count(0) {
+}
+
+size_t KeySet::findSlot(uint64_t hash, string_view key) const {
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        const Slot& slot = slots[i];
+        if (!slot.entry) return i;
+        if (slot.hash != hash) continue;
+        uint32_t length;
+        memcpy(&length, slot.entry, sizeof(length));
+        if (length == key.size() && memcmp(slot.entry + sizeof(length), key.data(), length) == 0) return i;
+    }
+}
+
+const char* KeySet::store(string_view key) {
+    if (key.size() > UINT32_MAX) {
+        throw length_error("KeySet keys are limited to 4 GiB");
+    }
+    char* entry = arena.allocate(sizeof(uint32_t) + key.size());
+    uint32_t length = static_cast<uint32_t>(key.size());
+    memcpy(entry, &length, sizeof(length));
+    if (!key.empty()) memcpy(entry + sizeof(length), key.data(), key.size());
+    return entry;
+}
+
+void KeySet::grow() {
+    vector<Slot> old(slots.size() * 2, Slot{0, nullptr});
+    old.swap(slots);
+    size_t mask = slots.size() - 1;
+    for (const Slot& slot : old) {
+        if (!slot.entry) continue;
+        size_t i = slot.hash & mask;
+        while (slots[i].entry) i = (i + 1) & mask;
+        slots[i] = slot;
+    }
+}
+
+bool KeySet::insert(string_view key) {
+    // Keep the load factor at or below 3/4 so probe runs stay short
+    if ((count + 1) * 4 > slots.size() * 3) grow();
+
+    uint64_t hash = WyHash::hash64(key.data(), key.size());
+    size_t i = findSlot(hash, key);
+    if (slots[i].entry) return false;
+
+    slots[i] = Slot{hash, store(key)};
+    count++;
+    return true;
+}
+
+bool KeySet::contains(string_view key) const {
+    return slots[findSlot(WyHash::hash64(key.data(), key.size()), key)].entry != nullptr;
+}
+
+size_t KeySet::memoryBytes() const {
+    return slots.size() * sizeof(Slot) + arena.capacityBytes();
+}
+
+void KeySet::clear() {
+    slots.assign(kInitialSlots, Slot{0, nullptr});
+    arena.clear();
+    count = 0;
+}
+
+bool KeySet::writeTo(ostream& out) const {
+    // Payload size and checksum go in the header, so encode once to size it first
+    uint64_t payloadBytes = 0;
+    uint32_t crc = 0;
+    uint8_t prefix[10];
+    forEach([&](string_view key) {
+        size_t n = encodeLength(key.size(), prefix);
+        crc = crc32c(crc, prefix, n);
+        crc = crc32c(crc, key.data(), key.size());
+        payloadBytes += n + key.size();
+    });
+
+    KeySetFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kKeySetMagic, sizeof(kKeySetMagic));
+    header.version = kKeySetVersion;
+    header.keyCount = count;
+    header.payloadBytes = payloadBytes;
+    header.checksum = crc;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    forEach([&](string_view key) {
+        size_t n = encodeLength(key.size(), prefix);
+        out.write(reinterpret_cast<const char*>(prefix), n);
+        out.write(key.data(), key.size());
+    });
+    return !out.fail();
+}
+
+bool KeySet::readFrom(istream& in, KeySet& keys) {
+    KeySetFileHeader header;
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (in.fail() || memcmp(header.magic, kKeySetMagic, sizeof(kKeySetMagic)) != 0 ||
+        header.version != kKeySetVersion || header.payloadBytes < header.keyCount) {
+        return false;
+    }
+
+    // Parse in chunks; a key split across a chunk boundary is carried over in pending
+    KeySet loaded;
+    vector<char> buffer(kReadChunkBytes);
+    string pending;
+    uint64_t remaining = header.payloadBytes;
+    uint64_t keyLength = 0;
+    unsigned int shift = 0;
+    bool inKey = false;
+    uint32_t crc = 0;
+
+    while (remaining > 0) {
+        size_t n = static_cast<size_t>(min<uint64_t>(remaining, buffer.size()));
+        in.read(buffer.data(), n);
+        if (in.fail()) return false;
+        crc = crc32c(crc, buffer.data(), n);
+        remaining -= n;
+
+        for (size_t i = 0; i < n;) {
+            if (!inKey) {
+                uint8_t byte = static_cast<uint8_t>(buffer[i++]);
+                if (shift > 63) return false;
+                keyLength |= uint64_t(byte & 0x7f) << shift;
+                shift += 7;
+                if (byte & 0x80) continue;
+                if (keyLength > UINT32_MAX || keyLength > header.payloadBytes) return false;
+                inKey = true;
+                pending.clear();
+            }
+            size_t take = static_cast<size_t>(min<uint64_t>(keyLength - pending.size(), n - i));
+            pending.append(buffer.data() + i, take);
+            i += take;
+            if (pending.size() == keyLength) {
+                if (!loaded.insert(pending)) return false;
+                inKey = false;
+                keyLength = 0;
+                shift = 0;
+            }
+        }
+    }
+
+    if (inKey || shift != 0 || crc != header.checksum || loaded.size() != header.keyCount) {
+        return false;
+    }
+    keys = move(loaded);
+    return true;
+}
+
+bool KeySet::saveToFile(const string& filename) const {
+    return writeFileAtomically(filename, [this](ostream& out) {
+        return writeTo(out);
+    });
+}
+
+KeySet* KeySet::loadFromFile(const string& filename) {
+    ifstream inFile(filename, ios::binary);
+
+    if (!inFile.is_open()) {
+        return nullptr;
+    }
+
+    KeySet* keys = new KeySet();
+    if (!readFrom(inFile, *keys)) {
+        delete keys;
+        return nullptr;
+    }
+    return keys;
+}
+
+KeySet* KeySet::loadFromListFile(const string& filename) {
+    KeySet* keys = new KeySet();
+    bool ok = forEachLineBatch(filename, [keys](const string_view* lines, size_t count) {
+        for (size_t i = 0; i < count; i++) keys->insert(lines[i]);
+    });
+    if (!ok) {
+        delete keys;
+        return nullptr;
+    }
+    return keys;
+}
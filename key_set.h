@@ -0,0 +1,87 @@
+#ifndef KEY_SET_H
+#define KEY_SET_H
+
+#include "string_arena.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Exact set of strings, kept next to a filter as optional ground truth.
+// Key bytes are appended to a StringArena and never move; the index is a
+// flat power-of-two table of {hash, arena pointer} slots probed linearly, so a
+// lookup is one hash and usually one cache line, and growing only rehashes slots.
+// Keys are visited and saved in insertion order. Keys are limited to 4 GiB each.
+//
+// File layout: "BLOOMKEY", uint32 version, uint32 reserved, uint64 key count,
+// uint64 payload bytes, uint32 CRC32C of the payload, uint32 reserved, then each
+// key as a LEB128 length followed by its bytes.
+class KeySet {
+private:
+    // 16 bytes; entry points at the key's length prefix in the arena, nullptr if empty
+    struct Slot {
+        uint64_t hash;
+        const char* entry;
+    };
+
+    std::vector<Slot> slots;
+    StringArena arena;
+    size_t count;
+
+    // Slot holding key, or the empty slot where it would go
+    size_t findSlot(uint64_t hash, std::string_view key) const;
+
+    // Copy key into the arena, prefixed by its length so the arena can be walked
+    const char* store(std::string_view key);
+
+    void grow();
+
+public:
+    KeySet();
+
+    // Add a key; false if it was already present
+    bool insert(std::string_view key);
+
+    bool contains(std::string_view key) const;
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    // Bytes held by the table and the arena
+    size_t memoryBytes() const;
+
+    void clear();
+
+    // Visit every key in insertion order as visit(std::string_view)
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        // Entries never straddle blocks, and only store() allocates from the arena
+        arena.forEachBlock([&visit](const char* data, size_t used) {
+            for (size_t offset = 0; offset < used;) {
+                uint32_t length;
+                std::memcpy(&length, data + offset, sizeof(length));
+                offset += sizeof(length);
+                visit(std::string_view(data + offset, length));
+                offset += length;
+            }
+        });
+    }
+
+    // Serialize to / parse from a stream; readFrom verifies the checksum and encoding
+    bool writeTo(std::ostream& out) const;
+    static bool readFrom(std::istream& in, KeySet& keys);
+
+    // Save to a file (atomically replaced) / load from one; nullptr on failure
+    bool saveToFile(const std::string& filename) const;
+    static KeySet* loadFromFile(const std::string& filename);
+
+    // Load a newline-separated list (empty lines skipped), e.g. an element list
+    // written before the binary format existed; nullptr if it cannot be read
+    static KeySet* loadFromListFile(const std::string& filename);
+};
+
+#endif // KEY_SET_H
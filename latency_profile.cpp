@@ -0,0 +1,197 @@
+#include "latency_profile.h"
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+const char* profiledOpName(ProfiledOp op) {
+    switch (op) {
+        case ProfiledOp::Insert: return "insert";
+        case ProfiledOp::Contains: return "contains";
+        case ProfiledOp::InsertBatch: return "insert_batch";
+        case ProfiledOp::ContainsBatch: return "contains_batch";
+    }
+    return "unknown";
+}
+
+#ifndef BLOOM_ENABLE_PROFILING
+
+void setProfilingSampleInterval(uint32_t) {
+}
+
+vector<LatencySummary> latencySummaries() {
+    return {};
+}
+
+void resetLatencyProfile() {
+}
+
+#else
+
+namespace {
+
+// Log-linear buckets: values below 2^kSubBucketBits get a bucket each; above, every
+// power of two is split into 2^kSubBucketBits equal sub-buckets
+constexpr unsigned int kSubBucketBits = 6;
+constexpr uint64_t kSubBuckets = uint64_t(1) << kSubBucketBits;
+// Largest recorded value is 2^kMaxValueBits - 1 ticks (minutes at GHz rates)
+constexpr unsigned int kMaxValueBits = 44;
+constexpr size_t kBuckets = (kMaxValueBits - kSubBucketBits + 1) * kSubBuckets;
+
+size_t bucketFor(uint64_t ticks) {
+    if (ticks >= (uint64_t(1) << kMaxValueBits)) ticks = (uint64_t(1) << kMaxValueBits) - 1;
+    if (ticks < kSubBuckets) return static_cast<size_t>(ticks);
+    unsigned int shift = 63 - __builtin_clzll(ticks) - kSubBucketBits;
+    return static_cast<size_t>((shift + 1) * kSubBuckets + ((ticks >> shift) & (kSubBuckets - 1)));
+}
+
+// Midpoint of a bucket's value range
+double bucketValue(size_t bucket) {
+    if (bucket < kSubBuckets) return static_cast<double>(bucket);
+    unsigned int shift = static_cast<unsigned int>(bucket / kSubBuckets - 1);
+    uint64_t low = (kSubBuckets + bucket % kSubBuckets) << shift;
+    return low + ((uint64_t(1) << shift) - 1) / 2.0;
+}
+
+// One thread's histograms; only the owning thread writes, so a relaxed load and store
+// replace the read-modify-write
+struct ThreadHistograms {
+    atomic<uint64_t> counts[kProfiledOps][kBuckets] = {};
+    atomic<uint64_t> maxTicks[kProfiledOps] = {};
+    atomic<bool> inUse{true};
+
+    static void bump(atomic<uint64_t>& counter) {
+        counter.store(counter.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+};
+
+// Every set of histograms ever handed out; a thread that exits leaves its counts and
+// hands the set to the next new thread
+struct Registry {
+    mutex lock;
+    vector<unique_ptr<ThreadHistograms>> threads;
+
+    ThreadHistograms* acquire() {
+        lock_guard<mutex> guard(lock);
+        for (auto& histograms : threads) {
+            if (!histograms->inUse.load(memory_order_relaxed)) {
+                histograms->inUse.store(true, memory_order_relaxed);
+                return histograms.get();
+            }
+        }
+        threads.emplace_back(new ThreadHistograms());
+        return threads.back().get();
+    }
+};
+
+Registry& registry() {
+    static Registry* instance = new Registry();
+    return *instance;
+}
+
+struct ThreadSlot {
+    ThreadHistograms* histograms = registry().acquire();
+    ~ThreadSlot() { histograms->inUse.store(false, memory_order_relaxed); }
+};
+
+ThreadHistograms& threadHistograms() {
+    thread_local ThreadSlot slot;
+    return *slot.histograms;
+}
+
+// Nanoseconds per tick, measured once against steady_clock
+double nanosecondsPerTick() {
+    static const double ratio = []() {
+#if defined(__x86_64__) || defined(__i386__)
+        auto wallStart = chrono::steady_clock::now();
+        uint64_t tickStart = latency_detail::readTicks();
+        this_thread::sleep_for(chrono::milliseconds(20));
+        uint64_t ticks = latency_detail::readTicks() - tickStart;
+        double nanoseconds = chrono::duration<double, nano>(chrono::steady_clock::now() - wallStart).count();
+        return ticks ? nanoseconds / ticks : 1.0;
+#else
+        return 1.0;
+#endif
+    }();
+    return ratio;
+}
+
+} // namespace
+
+namespace latency_detail {
+
+atomic<uint32_t> sampleInterval{64};
+
+void record(ProfiledOp op, uint64_t ticks) {
+    ThreadHistograms& histograms = threadHistograms();
+    size_t index = static_cast<size_t>(op);
+    ThreadHistograms::bump(histograms.counts[index][bucketFor(ticks)]);
+    if (ticks > histograms.maxTicks[index].load(memory_order_relaxed)) {
+        histograms.maxTicks[index].store(ticks, memory_order_relaxed);
+    }
+}
+
+} // namespace latency_detail
+
+void setProfilingSampleInterval(uint32_t interval) {
+    latency_detail::sampleInterval.store(max<uint32_t>(interval, 1), memory_order_relaxed);
+}
+
+vector<LatencySummary> latencySummaries() {
+    Registry& reg = registry();
+    lock_guard<mutex> guard(reg.lock);
+    double scale = nanosecondsPerTick();
+
+    vector<LatencySummary> summaries;
+    vector<uint64_t> merged(kBuckets);
+    for (size_t op = 0; op < kProfiledOps; op++) {
+        fill(merged.begin(), merged.end(), 0);
+        uint64_t total = 0;
+        uint64_t maxTicks = 0;
+        for (auto& histograms : reg.threads) {
+            for (size_t b = 0; b < kBuckets; b++) {
+                uint64_t count = histograms->counts[op][b].load(memory_order_relaxed);
+                merged[b] += count;
+                total += count;
+            }
+            maxTicks = max(maxTicks, histograms->maxTicks[op].load(memory_order_relaxed));
+        }
+        if (total == 0) continue;
+
+        // Value at the bucket holding the rank-th smallest sample
+        auto percentile = [&](double fraction) {
+            uint64_t rank = max<uint64_t>(1, static_cast<uint64_t>(fraction * total + 0.5));
+            uint64_t seen = 0;
+            for (size_t b = 0; b < kBuckets; b++) {
+                seen += merged[b];
+                if (seen >= rank) return min(bucketValue(b), static_cast<double>(maxTicks)) * scale;
+            }
+            return maxTicks * scale;
+        };
+
+        LatencySummary summary;
+        summary.op = static_cast<ProfiledOp>(op);
+        summary.samples = total;
+        summary.p50Ns = percentile(0.50);
+        summary.p99Ns = percentile(0.99);
+        summary.p999Ns = percentile(0.999);
+        summary.maxNs = maxTicks * scale;
+        summaries.push_back(summary);
+    }
+    return summaries;
+}
+
+void resetLatencyProfile() {
+    Registry& reg = registry();
+    lock_guard<mutex> guard(reg.lock);
+    for (auto& histograms : reg.threads) {
+        for (size_t op = 0; op < kProfiledOps; op++) {
+            for (size_t b = 0; b < kBuckets; b++) histograms->counts[op][b].store(0, memory_order_relaxed);
+            histograms->maxTicks[op].store(0, memory_order_relaxed);
+        }
+    }
+}
+
+#endif
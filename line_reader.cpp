@@ -0,0 +1,162 @@
+#include "line_reader.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+// Block size when the file cannot be mapped; grows if a single line is longer
+constexpr size_t kReadBlockBytes = 4 << 20;
+
+// Collects non-empty lines and hands them to the sink kLineBatch at a time
+class LineBatcher {
+private:
+    string_view lines[kLineBatch];
+    size_t pending;
+    const LineBatchSink& sink;
+    size_t& count;
+
+public:
+    LineBatcher(const LineBatchSink& batchSink, size_t& lineCount) : pending(0), sink(batchSink), count(lineCount) {
+        count = 0;
+    }
+
+    void add(const char* data, size_t length) {
+        if (length == 0) return;
+        lines[pending++] = string_view(data, length);
+        if (pending == kLineBatch) flush();
+    }
+
+    // Must run before the bytes behind the pending views are overwritten
+    void flush() {
+        if (pending == 0) return;
+        sink(lines, pending);
+        count += pending;
+        pending = 0;
+    }
+};
+
+bool scanMapped(const MappedFile& file, uint64_t begin, uint64_t end, LineBatcher& batcher) {
+    const char* data = reinterpret_cast<const char*>(file.data());
+    const size_t size = file.size();
+    end = min<uint64_t>(end, size);
+    if (begin >= end) return true;
+
+    size_t pos = static_cast<size_t>(begin);
+    if (begin > 0) {
+        // The line holding byte begin - 1 started in the previous range: skip past its newline
+        const void* newline = memchr(data + begin - 1, '\n', size - (begin - 1));
+        pos = newline ? static_cast<const char*>(newline) - data + 1 : size;
+    }
+
+    while (pos < end) {
+        const void* newline = memchr(data + pos, '\n', size - pos);
+        size_t lineEnd = newline ? static_cast<const char*>(newline) - data : size;
+        batcher.add(data + pos, lineEnd - pos);
+        pos = lineEnd + 1;
+    }
+    batcher.flush();
+    return true;
+}
+
+// Block-read lines from in, whose next byte is at file offset bufferOffset. A range
+// other than the first starts one byte early (skipping) and, as in scanMapped, drops
+// everything up to the first newline.
+bool scanStream(istream& in, uint64_t bufferOffset, bool skipping, uint64_t end, LineBatcher& batcher) {
+    vector<char> buffer(kReadBlockBytes);
+    size_t carried = 0;
+    bool eof = false;
+
+    while (!eof) {
+        if (carried == buffer.size()) buffer.resize(buffer.size() * 2);
+        in.read(buffer.data() + carried, buffer.size() - carried);
+        size_t valid = carried + static_cast<size_t>(in.gcount());
+        if (in.bad()) return false;
+        eof = in.eof();
+
+        size_t pos = 0;
+        if (skipping) {
+            const void* newline = memchr(buffer.data(), '\n', valid);
+            if (!newline) {
+                if (eof) return true;
+                // Still inside the skipped line; drop what was read so far
+                bufferOffset += valid;
+                carried = 0;
+                continue;
+            }
+            pos = static_cast<const char*>(newline) - buffer.data() + 1;
+            skipping = false;
+        }
+
+        while (pos < valid) {
+            if (bufferOffset + pos >= end) {
+                batcher.flush();
+                return true;
+            }
+            const void* newline = memchr(buffer.data() + pos, '\n', valid - pos);
+            if (!newline) break;
+            size_t lineEnd = static_cast<const char*>(newline) - buffer.data();
+            batcher.add(buffer.data() + pos, lineEnd - pos);
+            pos = lineEnd + 1;
+        }
+
+        if (eof) {
+            // Last line without a trailing newline
+            if (pos < valid && bufferOffset + pos < end) batcher.add(buffer.data() + pos, valid - pos);
+            break;
+        }
+
+        // Views into the buffer must be consumed before the partial line is moved down
+        batcher.flush();
+        carried = valid - pos;
+        memmove(buffer.data(), buffer.data() + pos, carried);
+        bufferOffset += pos;
+    }
+    batcher.flush();
+    return true;
+}
+
+bool scanBlocks(const string& filename, uint64_t begin, uint64_t end, LineBatcher& batcher) {
+    ifstream inFile(filename, ios::binary);
+    if (!inFile.is_open()) return false;
+
+    uint64_t start = begin > 0 ? begin - 1 : 0;
+    inFile.seekg(static_cast<streamoff>(start));
+    if (inFile.fail()) return false;
+    return scanStream(inFile, start, begin > 0, end, batcher);
+}
+
+} // namespace
+
+bool forEachLineBatch(const string& filename, const LineBatchSink& sink) {
+    size_t count;
+    return forEachLineBatch(filename, 0, UINT64_MAX, sink, count);
+}
+
+bool forEachLineBatch(const string& filename, uint64_t begin, uint64_t end,
+                      const LineBatchSink& sink, size_t& count) {
+    LineBatcher batcher(sink, count);
+    shared_ptr<MappedFile> file = MappedFile::open(filename);
+    if (file) {
+        file->adviseSequential();
+        return scanMapped(*file, begin, end, batcher);
+    }
+    // Empty files, pipes and anything else that cannot be mapped
+    return scanBlocks(filename, begin, end, batcher);
+}
+
+bool forEachLineBatch(istream& in, const LineBatchSink& sink) {
+    size_t count;
+    LineBatcher batcher(sink, count);
+    return scanStream(in, 0, false, UINT64_MAX, batcher);
+}
+
+int64_t lineFileSize(const string& filename) {
+    ifstream inFile(filename, ios::binary | ios::ate);
+    if (!inFile.is_open()) return -1;
+    return static_cast<int64_t>(inFile.tellg());
+}
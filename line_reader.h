@@ -0,0 +1,43 @@
+#ifndef LINE_READER_H
+#define LINE_READER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <string>
+#include <string_view>
+
+// Zero-copy ingestion of newline-separated list files.
+// The file is memory-mapped for a sequential scan (or, if it cannot be mapped, read
+// in large blocks) and split in place with memchr, which glibc vectorizes with
+// SSE2/AVX2. Lines reach the sink as string_views into the mapping or block buffer,
+// kLineBatch at a time, ready for insertBatch; nothing is allocated per line.
+// The views are only valid during the sink call: copy what must be kept, e.g. into
+// a StringArena or KeySet.
+//
+// Lines are split on '\n' only and empty lines are skipped, as getline-based
+// reading did.
+
+// Lines handed to the sink per call
+constexpr size_t kLineBatch = 1024;
+
+using LineBatchSink = std::function<void(const std::string_view* lines, size_t count)>;
+
+// Every line of the file; false if it cannot be opened or read
+bool forEachLineBatch(const std::string& filename, const LineBatchSink& sink);
+
+// The lines whose first byte lies in [begin, end), so adjacent ranges split a file
+// without losing or repeating a line; count receives the number of lines visited
+bool forEachLineBatch(const std::string& filename, uint64_t begin, uint64_t end,
+                      const LineBatchSink& sink, size_t& count);
+
+// Every line of a stream such as std::cin, read in large blocks; false on a read error.
+// A batch reaches the sink once a block is read (or a pipe reaches end of input), so
+// results for interactive input lag by up to one block.
+bool forEachLineBatch(std::istream& in, const LineBatchSink& sink);
+
+// Size of the file in bytes, or -1 if it cannot be opened
+int64_t lineFileSize(const std::string& filename);
+
+#endif // LINE_READER_H
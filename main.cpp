@@ -1,4 +1,16 @@
+#include "basic_bloom_filter.h"
+#include "blocked_bloom_filter.h"
 #include "bloom_filter.h"
+#include "cli_commands.h"
+#include "concurrent_bloom_filter.h"
+#include "counting_bloom_filter.h"
+#include "cuckoo_filter.h"
+#include "filter_handle.h"
+#include "key_set.h"
+#include "line_reader.h"
+#include "parallel_build.h"
+#include "scalable_bloom_filter.h"
+#include "sharded_bloom_filter.h"
 #include <iostream>
 #include <vector>
 #include <string>
@@ -6,9 +18,11 @@
 #include <limits>
 #include <random>
 #include <chrono>
+#include <cmath>
 #include <iomanip>
 #include <algorithm>
-#include <set>
+#include <memory>
+#include <string_view>
 
 using namespace std;
 
@@ -41,31 +55,110 @@ string getStringInput(const string& prompt) {
 
 
 
-void addFilesFromList(BloomFilter& filter, vector<string>& insertedElements) {
+FilterVariant getVariantInput() {
+    cout << "Filter type:\n"
+         << "  1. Standard\n"
+         << "  2. Blocked (cache-line blocks)\n"
+         << "  3. Concurrent (lock-free shared inserts)\n"
+         << "  4. Counting (supports removal)\n"
+         << "  5. Scalable (grows past its capacity)\n"
+         << "  6. Cuckoo (compact at low false positive rates)\n"
+         << "  7. Fast (WyHash, fixed policies, in memory only)\n"
+         << "  8. Sharded (one shard per NUMA node)\n"
+         << "  9. Rotating (forgets the oldest keys, in memory only)" << endl;
+    int variant = getNumericInput<int>("Enter filter type (1-9): ");
+    if (variant < 1 || variant > 9) {
+        cout << "Unknown filter type, using standard." << endl;
+        return FilterVariant::Standard;
+    }
+    return static_cast<FilterVariant>(variant);
+}
+
+// What is known about the current filter's contents. The exact key set is optional:
+// it costs far more memory than the filter, so it is only kept when asked for.
+struct InsertedElements {
+    unique_ptr<KeySet> keys;
+    // Keys inserted so far (distinct ones when keys is kept); drives the theoretical FPR
+    size_t count = 0;
+    
+    void reset(bool track) {
+        keys.reset(track ? new KeySet() : nullptr);
+        count = 0;
+    }
+};
+
+bool getYesNoInput(const string& prompt) {
+    string answer = getStringInput(prompt);
+    return !answer.empty() && (answer[0] == 'y' || answer[0] == 'Y');
+}
+
+// Record lines just added to the filter
+void trackInserted(InsertedElements& inserted, const string_view* lines, size_t count) {
+    if (!inserted.keys) {
+        inserted.count += count;
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (inserted.keys->insert(lines[i])) inserted.count++;
+    }
+}
+
+// Runs the parallel builder if the filter is one it supports
+template <typename F>
+bool tryParallelInsert(FilterHandle& filter, const string& filename, unsigned int numThreads,
+                       InsertedElements& inserted, bool& ok) {
+    F* concrete = filter.get<F>();
+    if (!concrete) return false;
+    size_t added = 0;
+    size_t tracked = inserted.keys ? inserted.keys->size() : 0;
+    ok = parallelInsertFromFile(filename, *concrete, numThreads, added, inserted.keys.get());
+    if (!ok) return true;
+    inserted.count += inserted.keys ? inserted.keys->size() - tracked : added;
+    cout << "Added " << added << " filenames to the filter." << endl;
+    return true;
+}
+
+void addFilesFromList(FilterHandle& filter, InsertedElements& inserted) {
+    if (!filter.supportsInsert()) {
+        cout << "This " << filter.name() << " filter is read-only." << endl;
+        return;
+    }
+    
     string filename = getStringInput("Enter file containing list of filenames: ");
+    unsigned int numThreads = getNumericInput<unsigned int>("Enter number of build threads (0 = all cores, 1 = sequential): ");
     
-    ifstream inFile(filename);
-    if (!inFile.is_open()) {
-        cout << "Error opening file: " << filename << endl;
+    bool ok = true;
+    if (numThreads != 1 && (tryParallelInsert<BloomFilter>(filter, filename, numThreads, inserted, ok) ||
+                            tryParallelInsert<ConcurrentBloomFilter>(filter, filename, numThreads, inserted, ok) ||
+                            tryParallelInsert<ShardedBloomFilter>(filter, filename, numThreads, inserted, ok))) {
+        if (!ok) cout << "Error reading file: " << filename << endl;
         return;
     }
+    if (numThreads != 1) {
+        cout << "Parallel build is not available for " << filter.name() << " filters; inserting sequentially." << endl;
+    }
     
-    string line;
-    int count = 0;
-    
-    while (getline(inFile, line)) {
-        if (!line.empty()) {
-            filter.insert(line);
-            insertedElements.push_back(line);
-            count++;
-        }
+    // Lines arrive as views into the mapped file, so nothing is copied unless tracked
+    size_t added = 0;
+    bool full = false;
+    bool read = forEachLineBatch(filename, [&](const string_view* lines, size_t count) {
+        if (!filter.insertBatch(lines, count)) full = true;
+        trackInserted(inserted, lines, count);
+        added += count;
+    });
+    if (!read) {
+        cout << "Error opening file: " << filename << endl;
+        return;
+    }
+    if (full) {
+        cout << "Warning: the filter is full; not every filename could be stored." << endl;
     }
     
-    cout << "Added " << count << " filenames to the filter." << endl;
+    cout << "Added " << added << " filenames to the filter." << endl;
 }
 
-void testFalsePositiveRate(BloomFilter& filter, const vector<string>& insertedElements) {
-    if (insertedElements.empty()) {
+void testFalsePositiveRate(const FilterHandle& filter, const InsertedElements& inserted) {
+    if (inserted.count == 0) {
         cout << "No elements in the filter to test. Please add elements first." << endl;
         return;
     }
@@ -78,9 +171,12 @@ void testFalsePositiveRate(BloomFilter& filter, const vector<string>& insertedEl
     uniform_int_distribution<> lenDist(5, 20);
     uniform_int_distribution<> charDist(97, 122);
     
-    set<string> generatedStrings(insertedElements.begin(), insertedElements.end());
+    KeySet generatedStrings;
     
     cout << "Generating " << numTests << " random test strings..." << endl;
+    if (!inserted.keys) {
+        cout << "Note: no element list is kept, so a test string that was inserted would count as a false positive." << endl;
+    }
     
     while (testStrings.size() < numTests) {
         int len = lenDist(gen);
@@ -90,24 +186,27 @@ void testFalsePositiveRate(BloomFilter& filter, const vector<string>& insertedEl
         }
         randomStr += ".txt";
         
-        if (generatedStrings.find(randomStr) == generatedStrings.end()) {
+        if ((!inserted.keys || !inserted.keys->contains(randomStr)) && generatedStrings.insert(randomStr)) {
             testStrings.push_back(randomStr);
-            generatedStrings.insert(randomStr);
         }
     }
     
+    vector<string_view> batch(testStrings.begin(), testStrings.end());
+    unique_ptr<bool[]> results(new bool[batch.size()]);
+    filter.mightContainBatch(batch.data(), batch.size(), results.get());
+    
     size_t falsePositives = 0;
-    for (const auto& testStr : testStrings) {
-        if (filter.mightContain(testStr)) {
+    for (size_t i = 0; i < batch.size(); i++) {
+        if (results[i]) {
             falsePositives++;
         }
     }
     
     double empiricalFPR = static_cast<double>(falsePositives) / numTests;
-    double theoreticalFPR = filter.getCurrentFalsePositiveRate(insertedElements.size());
+    double theoreticalFPR = filter.getFalsePositiveRate(inserted.count);
     
     cout << "\n===== False Positive Rate Test Results =====" << endl;
-    cout << "Elements in filter: " << insertedElements.size() << endl;
+    cout << "Elements in filter: " << inserted.count << endl;
     cout << "Test cases run: " << numTests << endl;
     cout << "False positives: " << falsePositives << endl;
     cout << "Empirical false positive rate: " << fixed << setprecision(6) 
@@ -118,111 +217,84 @@ void testFalsePositiveRate(BloomFilter& filter, const vector<string>& insertedEl
               << abs(empiricalFPR - theoreticalFPR) * 100 << "%" << endl;
 }
 
-void saveFilterToFile(const BloomFilter& filter, const vector<string>& insertedElements) {
+void saveFilterToFile(const FilterHandle& filter, const InsertedElements& inserted) {
     string filename = getStringInput("Enter filename to save filter state: ");
+    bool compress = getYesNoInput("Write a compressed snapshot (smaller, but cannot be memory-mapped)? (y/n): ");
     
-    if (!filter.saveToFile(filename)) {
+    if (!filter.saveToFile(filename, compress)) {
         cout << "Error saving filter to file: " << filename << endl;
         return;
     }
+    cout << "Filter saved to " << filename << endl;
     
-    string elementListFile = filename + ".elements";
-    ofstream outFile(elementListFile);
+    if (!inserted.keys) {
+        return;
+    }
     
-    if (!outFile.is_open()) {
+    string elementListFile = filename + ".elements";
+    if (!inserted.keys->saveToFile(elementListFile)) {
         cout << "Warning: Could not save element list to " << elementListFile << endl;
         cout << "Filter was saved, but element list was not." << endl;
         return;
     }
     
-    for (const auto& element : insertedElements) {
-        outFile << element << endl;
-    }
-    
-    cout << "Filter saved to " << filename << endl;
     cout << "Element list saved to " << elementListFile << endl;
 }
 
-bool loadFilterFromFile(BloomFilter*& filter, vector<string>& insertedElements) {
+bool loadFilterFromFile(FilterHandle& filter, InsertedElements& inserted) {
     string filename = getStringInput("Enter filename to load filter state: ");
+    bool mapped = getYesNoInput("Memory-map the file instead of reading it? (y/n): ");
     
-    BloomFilter* loadedFilter = BloomFilter::loadFromFile(filename);
+    FilterHandle loadedFilter = FilterHandle::loadFromFile(filename, mapped);
     if (!loadedFilter) {
         cout << "Error loading filter from file: " << filename << endl;
         return false;
     }
     
+    // Element lists written before the binary format are one element per line
     string elementListFile = filename + ".elements";
-    ifstream inFile(elementListFile);
+    unique_ptr<KeySet> keys(KeySet::loadFromFile(elementListFile));
+    if (!keys) keys.reset(KeySet::loadFromListFile(elementListFile));
     
-    insertedElements.clear();
-    
-    if (inFile.is_open()) {
-        string line;
-        while (getline(inFile, line)) {
-            if (!line.empty()) {
-                insertedElements.push_back(line);
-            }
-        }
-        cout << "Loaded " << insertedElements.size() << " elements from " << elementListFile << endl;
+    if (keys) {
+        cout << "Loaded " << keys->size() << " elements from " << elementListFile << endl;
+        inserted.count = keys->size();
     } else {
-        cout << "Warning: Could not load element list from " << elementListFile << endl;
-        cout << "Filter was loaded, but you won't be able to view the list of elements." << endl;
+        cout << "No element list found at " << elementListFile << endl;
+        cout << "Filter was loaded, but checks cannot be confirmed against the inserted elements." << endl;
+        // Without the list the element count can still be estimated from the bit array
+        double estimate = loadedFilter.estimateCardinality();
+        inserted.count = estimate > 0 ? static_cast<size_t>(llround(estimate)) : 0;
+        if (estimate >= 0) {
+            cout << "Estimated " << inserted.count << " elements from the filter's fill." << endl;
+        }
     }
+    inserted.keys = move(keys);
     
-    delete filter;
-    filter = loadedFilter;
+    filter = move(loadedFilter);
     
     cout << "Filter loaded from " << filename << endl;
-    cout << "Filter size: " << filter->getSize() << " bits" << endl;
-    cout << "Hash functions: " << filter->getNumHashes() << endl;
+    cout << "Filter type: " << filter.name() << endl;
+    cout << "Filter size: " << filter.getSize() << " bits" << endl;
+    if (filter.getNumHashes()) {
+        cout << "Hash functions: " << filter.getNumHashes() << endl;
+    }
     
     return true;
 }
 
-void benchmarkPerformance(const BloomFilter& filter) {
-    size_t numOperations = getNumericInput<size_t>("Enter number of operations to benchmark (recommended: 100000): ");
-    
-    cout << "\nGenerating random test data..." << endl;
-    vector<string> testData;
-    
-    random_device rd;
-    mt19937 gen(rd());
-    uniform_int_distribution<> lenDist(5, 20);
-    uniform_int_distribution<> charDist(97, 122);
-    
-    for (size_t i = 0; i < numOperations; i++) {
-        int len = lenDist(gen);
-        string randomStr = "bench_";
-        for (int j = 0; j < len; j++) {
-            randomStr.push_back(static_cast<char>(charDist(gen)));
-        }
-        randomStr += ".txt";
-        testData.push_back(randomStr);
-    }
-    
-    cout << "Starting benchmark..." << endl;
-    
-    auto startInsert = chrono::high_resolution_clock::now();
-    
-    BloomFilter testFilter(filter.getSize(), filter.getNumHashes());
-    for (const auto& item : testData) {
-        testFilter.insert(item);
+// Quick single-run timing. bloom_bench sweeps size, k, key length, hit ratio and
+// threads for real measurements.
+void benchmarkPerformance(const FilterHandle& filter) {
+    if (!filter.supportsInsert()) {
+        cout << "Benchmarking needs an insertable filter; " << filter.name() << " filters are build-once." << endl;
+        return;
     }
     
-    auto endInsert = chrono::high_resolution_clock::now();
-    chrono::duration<double> insertDuration = endInsert - startInsert;
-    cout << "Insertion time: " << insertDuration.count() << " seconds" << endl;
-    
-    auto startLookup = chrono::high_resolution_clock::now();
-    
-    for (const auto& item : testData) {
-        testFilter.mightContain(item);
+    size_t numOperations = getNumericInput<size_t>("Enter number of operations to benchmark (recommended: 100000): ");
+    if (!runQuickBenchmark(filter, numOperations, cout)) {
+        cout << "Benchmarking is not available for " << filter.name() << " filters." << endl;
     }
-    
-    auto endLookup = chrono::high_resolution_clock::now();
-    chrono::duration<double> lookupDuration = endLookup - startLookup;
-    cout << "Lookup time: " << lookupDuration.count() << " seconds" << endl;
 }
 int displayMenu() {
     cout << "\n===== Bloom Filter File Checker =====" << endl;
@@ -244,33 +316,50 @@ int displayMenu() {
     clearInputBuffer();
     return choice;
 }
-int main() {
-    vector<string> insertedElements;
-    BloomFilter* filter = nullptr;
+int main(int argc, char** argv) {
+    // Subcommands run without prompts; no arguments starts the menu
+    if (argc > 1) {
+        return runCommand(argc, argv);
+    }
+    
+    InsertedElements inserted;
+    FilterHandle filter;
     
     while (true) {
         int choice = displayMenu();
         
         switch (choice) {
             case 1: { // Create optimal filter
-                if (filter) {
-                    delete filter;
-                    filter = nullptr;
-                }
+                filter = FilterHandle();
                 
+                FilterVariant variant = getVariantInput();
                 size_t expectedElements = getNumericInput<size_t>("Enter expected number of elements: ");
                 double falsePositiveRate = getNumericInput<double>("Enter desired false positive rate (e.g., 0.01 for 1%): ");
+                bool roundToPowerOfTwo = getYesNoInput("Round size up to a power of two for faster indexing? (y/n): ");
+                bool track = getYesNoInput("Keep an exact list of inserted elements (uses extra memory)? (y/n): ");
                 
                 try {
-                    filter = new BloomFilter(BloomFilter::createOptimal(expectedElements, falsePositiveRate));
-                    insertedElements.clear();
+                    filter = FilterHandle::createOptimal(variant, expectedElements, falsePositiveRate, roundToPowerOfTwo);
+                    inserted.reset(track);
                     
-                    cout << "Created optimal filter with:\n"
-                         << "Size: " << filter->getSize() << " bits (" 
-                         << (filter->getSize() / 8 / 1024) << " KB)\n"
-                         << "Hash functions: " << filter->getNumHashes() << "\n"
-                         << "Theoretical FPR: " << fixed << setprecision(4) 
+                    cout << "Created optimal " << filter.name() << " filter with:\n"
+                         << "Size: " << filter.getSize() << " bits (" 
+                         << (filter.getSize() / 8 / 1024) << " KB)\n";
+                    if (filter.getNumHashes()) {
+                        cout << "Hash functions: " << filter.getNumHashes() << "\n";
+                    }
+                    if (ShardedBloomFilter* sharded = filter.get<ShardedBloomFilter>()) {
+                        cout << "Shards: " << sharded->getShardCount() << " x " << sharded->getShardSize()
+                             << " bits, on nodes";
+                        for (size_t i = 0; i < sharded->getShardCount(); i++) cout << " " << sharded->shardNode(i);
+                        cout << "\n";
+                    }
+                    cout << "Theoretical FPR: " << fixed << setprecision(4) 
                          << (falsePositiveRate * 100) << "%" << endl;
+                    if (roundToPowerOfTwo) {
+                        cout << "FPR at " << expectedElements << " elements after rounding: " << fixed << setprecision(4)
+                             << (filter.getFalsePositiveRate(expectedElements) * 100) << "%" << endl;
+                    }
                 } catch (const exception& e) {
                     cerr << "Error creating filter: " << e.what() << endl;
                 }
@@ -278,22 +367,18 @@ int main() {
             }
             
             case 2: { // Create manual filter
-                if (filter) {
-                    delete filter;
-                    filter = nullptr;
-                }
-                
                 size_t filterSize = getNumericInput<size_t>("Enter filter size (in bits): ");
                 size_t numHashes = getNumericInput<size_t>("Enter number of hash functions: ");
+                bool track = getYesNoInput("Keep an exact list of inserted elements (uses extra memory)? (y/n): ");
                 
-                filter = new BloomFilter(filterSize, numHashes);
-                insertedElements.clear();
+                filter = FilterHandle(make_unique<BloomFilter>(filterSize, numHashes), "standard");
+                inserted.reset(track);
                 
                 cout << "Created manual filter with:\n"
-                     << "Size: " << filter->getSize() << " bits\n"
-                     << "Hash functions: " << filter->getNumHashes() << "\n"
+                     << "Size: " << filter.getSize() << " bits\n"
+                     << "Hash functions: " << filter.getNumHashes() << "\n"
                      << "Current FPR: " << fixed << setprecision(4)
-                     << (filter->getCurrentFalsePositiveRate(0) * 100) << "%" << endl;
+                     << (filter.getFalsePositiveRate(0) * 100) << "%" << endl;
                 break;
             }
             
@@ -302,7 +387,7 @@ int main() {
                     cout << "No filter created yet. Please create a filter first." << endl;
                     break;
                 }
-                addFilesFromList(*filter, insertedElements);
+                addFilesFromList(filter, inserted);
                 break;
             }
             
@@ -312,17 +397,18 @@ int main() {
                     break;
                 }
                 string filename = getStringInput("Enter filename to check: ");
-                bool mightExist = filter->mightContain(filename);
-                bool actuallyExists = find(insertedElements.begin(), insertedElements.end(), filename) != insertedElements.end();
+                bool mightExist = filter.mightContain(filename);
                 
                 cout << "Bloom filter result: ";
                 if (mightExist) {
-                    if (actuallyExists) {
+                    if (!inserted.keys) {
+                        cout << "File might exist (no element list kept to confirm)";
+                    } else if (inserted.keys->contains(filename)) {
                         cout << "File exists in filter (true positive)";
                     } else {
                         cout << "File might exist (false positive)";
                         cout << "\nCurrent false positive probability: " << fixed << setprecision(4)
-                             << (filter->getCurrentFalsePositiveRate(insertedElements.size()) * 100) << "%";
+                             << (filter.getFalsePositiveRate(inserted.count) * 100) << "%";
                     }
                 } else {
                     cout << "File definitely does not exist";
@@ -337,14 +423,36 @@ int main() {
                     break;
                 }
                 cout << "\n===== Filter Statistics =====" << endl;
-                cout << "Size: " << filter->getSize() << " bits (" 
-                     << (filter->getSize() / 8) << " bytes)" << endl;
-                cout << "Hash functions: " << filter->getNumHashes() << endl;
-                cout << "Elements inserted: " << insertedElements.size() << endl;
+                cout << "Type: " << filter.name() << endl;
+                cout << "Size: " << filter.getSize() << " bits (" 
+                     << (filter.getSize() / 8) << " bytes)" << endl;
+                if (filter.getNumHashes()) {
+                    cout << "Hash functions: " << filter.getNumHashes() << endl;
+                }
+                cout << "Elements inserted: " << inserted.count << endl;
+                {
+                    double estimate = filter.estimateCardinality();
+                    if (estimate >= 0) {
+                        cout << "Estimated elements (from fill): " << static_cast<size_t>(llround(estimate)) << endl;
+                    }
+                }
+                if (inserted.keys) {
+                    cout << "Element list: " << inserted.keys->size() << " keys in "
+                         << (inserted.keys->memoryBytes() / 1024) << " KB" << endl;
+                }
                 cout << "Current false positive rate: " << fixed << setprecision(4)
-                     << (filter->getCurrentFalsePositiveRate(insertedElements.size()) * 100) << "%" << endl;
-                cout << "Filter utilization: " << fixed << setprecision(2)
-                     << ((double)insertedElements.size() / (filter->getSize() / filter->getNumHashes()) * 100) << "%" << endl;
+                     << (filter.getFalsePositiveRate(inserted.count) * 100) << "%" << endl;
+                {
+                    FilterMetrics metrics = filter.metrics();
+                    if (metrics.hasFill) {
+                        cout << "Bits set: " << metrics.setBits << " (" << fixed << setprecision(2)
+                             << (metrics.fillRatio * 100) << "% fill)" << endl;
+                        cout << "False positive rate from fill: " << fixed << setprecision(4)
+                             << (metrics.estimatedFpr * 100) << "%" << endl;
+                    }
+                    cout << "Queries: " << metrics.queries << " (" << fixed << setprecision(2)
+                         << (metrics.positiveRate() * 100) << "% positive)" << endl;
+                }
                 break;
             }
             
@@ -353,7 +461,7 @@ int main() {
                     cout << "No filter created yet. Please create a filter first." << endl;
                     break;
                 }
-                testFalsePositiveRate(*filter, insertedElements);
+                testFalsePositiveRate(filter, inserted);
                 break;
             }
             
@@ -362,16 +470,12 @@ int main() {
                     cout << "No filter created yet. Please create a filter first." << endl;
                     break;
                 }
-                saveFilterToFile(*filter, insertedElements);
+                saveFilterToFile(filter, inserted);
                 break;
             }
             
             case 8: { // Load filter
-                if (filter) {
-                    delete filter;
-                    filter = nullptr;
-                }
-                if (!loadFilterFromFile(filter, insertedElements)) {
+                if (!loadFilterFromFile(filter, inserted)) {
                     cout << "Failed to load filter." << endl;
                 }
                 break;
@@ -382,7 +486,7 @@ int main() {
                     cout << "No filter created yet. Please create a filter first." << endl;
                     break;
                 }
-                benchmarkPerformance(*filter);
+                benchmarkPerformance(filter);
                 break;
             }
             
@@ -391,16 +495,16 @@ int main() {
                     cout << "No filter created yet. Please create a filter first." << endl;
                     break;
                 }
-                filter->clear();
-                insertedElements.clear();
+                if (!filter.clear()) {
+                    cout << "This " << filter.name() << " filter cannot be cleared." << endl;
+                    break;
+                }
+                inserted.reset(inserted.keys != nullptr);
                 cout << "Filter cleared." << endl;
                 break;
             }
             
             case 11: { // Exit
-                if (filter) {
-                    delete filter;
-                }
                 cout << "Exiting program..." << endl;
                 return 0;
             }
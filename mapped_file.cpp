@@ -0,0 +1,41 @@
+#include "mapped_file.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+MappedFile::MappedFile(void* mappedAddress, size_t mappedLength)
+    : address(mappedAddress), length(mappedLength) {
+}
+
+MappedFile::~MappedFile() {
+    if (address) munmap(address, length);
+}
+
+void MappedFile::adviseSequential() {
+    madvise(address, length, MADV_SEQUENTIAL);
+}
+
+shared_ptr<MappedFile> MappedFile::open(const string& filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return nullptr;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    size_t length = static_cast<size_t>(info.st_size);
+    void* address = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file referenced; the descriptor is no longer needed
+    close(fd);
+    if (address == MAP_FAILED) return nullptr;
+
+    // Bloom probes are random; readahead would only pull in pages nobody asked for
+    madvise(address, length, MADV_RANDOM);
+
+    return shared_ptr<MappedFile>(new MappedFile(address, length));
+}
@@ -0,0 +1,35 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// Read-mostly memory mapping of a whole file.
+// Pages are mapped MAP_PRIVATE: every process mapping the same file shares the
+// page-cache copy, and a process that writes gets private copy-on-write pages
+// instead of modifying the file.
+class MappedFile {
+private:
+    void* address;
+    size_t length;
+
+    MappedFile(void* mappedAddress, size_t mappedLength);
+
+public:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    // Map a file; returns nullptr if it cannot be opened or mapped
+    static std::shared_ptr<MappedFile> open(const std::string& filename);
+
+    const unsigned char* data() const { return static_cast<const unsigned char*>(address); }
+    unsigned char* mutableData() { return static_cast<unsigned char*>(address); }
+    size_t size() const { return length; }
+
+    // Switch the readahead hint from random (filter probes) to a front-to-back scan
+    void adviseSequential();
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,166 @@
+#include "numa_memory.h"
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <string>
+
+using namespace std;
+
+namespace {
+
+// x86-64 and arm64 default huge page size
+constexpr size_t kHugePageBytes = size_t(2) << 20;
+
+// mbind policy from <linux/mempolicy.h>; libnuma's numaif.h is not assumed
+constexpr int kMpolPreferred = 1;
+
+// Parse a sysfs list such as "0-3,8,10-11"; false if it is malformed
+bool parseIdList(const string& text, vector<int>& ids) {
+    ids.clear();
+    size_t pos = 0;
+    while (pos < text.size() && text[pos] != '\n') {
+        char* end = nullptr;
+        long first = strtol(text.c_str() + pos, &end, 10);
+        if (end == text.c_str() + pos || first < 0) return false;
+        long last = first;
+        pos = end - text.c_str();
+        if (pos < text.size() && text[pos] == '-') {
+            last = strtol(text.c_str() + pos + 1, &end, 10);
+            if (end == text.c_str() + pos + 1 || last < first) return false;
+            pos = end - text.c_str();
+        }
+        for (long id = first; id <= last; id++) ids.push_back(static_cast<int>(id));
+        if (pos < text.size() && text[pos] == ',') pos++;
+    }
+    return !ids.empty();
+}
+
+bool readIdList(const string& path, vector<int>& ids) {
+    ifstream in(path);
+    string text;
+    return getline(in, text) && parseIdList(text, ids);
+}
+
+size_t roundUp(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+bool bindToNode(void* address, size_t length, int node) {
+#ifdef __linux__
+    if (node < 0 || node >= 64 * 16) return false;
+    unsigned long mask[16] = {};
+    mask[node / 64] |= 1UL << (node % 64);
+    return syscall(SYS_mbind, address, length, kMpolPreferred, mask, sizeof(mask) * 8, 0) == 0;
+#else
+    (void)address;
+    (void)length;
+    (void)node;
+    return false;
+#endif
+}
+
+} // namespace
+
+vector<int> numaNodes() {
+    vector<int> nodes;
+    if (readIdList("/sys/devices/system/node/has_memory", nodes) ||
+        readIdList("/sys/devices/system/node/online", nodes)) {
+        return nodes;
+    }
+    return {0};
+}
+
+unsigned int numaNodeCount() {
+    return static_cast<unsigned int>(numaNodes().size());
+}
+
+int currentNumaNode() {
+#ifdef __linux__
+    unsigned int cpu = 0;
+    unsigned int node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) return static_cast<int>(node);
+#endif
+    return -1;
+}
+
+vector<int> numaNodeCpus(int node) {
+    vector<int> cpus;
+    if (node < 0 || !readIdList("/sys/devices/system/node/node" + to_string(node) + "/cpulist", cpus)) {
+        // Without sysfs node information, node 0 is the whole machine
+        cpus.clear();
+        if (node == 0 && numaNodes() == vector<int>{0}) {
+            long online = sysconf(_SC_NPROCESSORS_ONLN);
+            for (long cpu = 0; cpu < online; cpu++) cpus.push_back(static_cast<int>(cpu));
+        }
+    }
+    return cpus;
+}
+
+bool pinThreadToNumaNode(int node) {
+#ifdef __linux__
+    vector<int> cpus = numaNodeCpus(node);
+    if (cpus.empty()) return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void)node;
+    return false;
+#endif
+}
+
+NumaMemory::NumaMemory(void* mappedAddress, size_t mappedLength, int node, PageBacking pageBacking)
+    : address(mappedAddress), length(mappedLength), boundNode(node), backing(pageBacking) {
+}
+
+NumaMemory::~NumaMemory() {
+    if (address) munmap(address, length);
+}
+
+shared_ptr<NumaMemory> NumaMemory::allocate(size_t bytes, int node, bool hugePages) {
+    bytes = max<size_t>(bytes, 1);
+    void* address = MAP_FAILED;
+    size_t length = 0;
+    PageBacking backing = PageBacking::Normal;
+
+#ifdef MAP_HUGETLB
+    if (hugePages && bytes >= kHugePageBytes) {
+        length = roundUp(bytes, kHugePageBytes);
+        address = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (address != MAP_FAILED) backing = PageBacking::HugeTlb;
+    }
+#endif
+    if (address == MAP_FAILED) {
+        length = roundUp(bytes, static_cast<size_t>(sysconf(_SC_PAGESIZE)));
+        bool transparent = hugePages && length >= kHugePageBytes;
+        // Over-map by one huge page and trim, so the region starts on a huge page
+        // boundary and every 2 MiB of it can be backed by one
+        size_t mapped = transparent ? length + kHugePageBytes : length;
+        void* raw = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) throw bad_alloc();
+        address = raw;
+        if (transparent) {
+            uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+            uintptr_t aligned = roundUp(start, kHugePageBytes);
+            if (aligned > start) munmap(raw, aligned - start);
+            size_t tail = (start + mapped) - (aligned + length);
+            if (tail) munmap(reinterpret_cast<void*>(aligned + length), tail);
+            address = reinterpret_cast<void*>(aligned);
+#ifdef MADV_HUGEPAGE
+            if (madvise(address, length, MADV_HUGEPAGE) == 0) backing = PageBacking::TransparentHuge;
+#endif
+        }
+    }
+
+    int boundNode = node >= 0 && bindToNode(address, length, node) ? node : -1;
+    return shared_ptr<NumaMemory>(new NumaMemory(address, length, boundNode, backing));
+}
@@ -0,0 +1,69 @@
+#ifndef NUMA_MEMORY_H
+#define NUMA_MEMORY_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// NUMA topology, placement and thread affinity, through the kernel interfaces
+// directly (sysfs, mbind, sched_setaffinity) so nothing beyond libc is linked.
+// On a machine or kernel without NUMA everything degrades to a single node 0.
+
+// Ids of the NUMA nodes with memory online, ascending ({0} without NUMA). Ids can
+// have gaps, so iterate this rather than counting up to numaNodeCount().
+std::vector<int> numaNodes();
+unsigned int numaNodeCount();
+
+// Node the calling thread is running on right now; -1 if unknown
+int currentNumaNode();
+
+// CPUs belonging to node; empty if the node does not exist
+std::vector<int> numaNodeCpus(int node);
+
+// Restrict the calling thread to the CPUs of node, so its allocations and its probes
+// stay local; false if the node has no CPUs or the affinity call fails
+bool pinThreadToNumaNode(int node);
+
+// How a NumaMemory region is backed
+enum class PageBacking {
+    Normal,
+    // Transparent huge pages were requested with madvise(MADV_HUGEPAGE)
+    TransparentHuge,
+    // Reserved huge pages from the hugetlbfs pool (MAP_HUGETLB)
+    HugeTlb
+};
+
+// Zeroed anonymous memory placed on one NUMA node.
+// The region is bound with mbind(MPOL_PREFERRED) before any page is touched, so pages
+// come from that node while it has free memory and from the nearest other node after
+// that, rather than failing. With huge pages requested, a region of at least one huge
+// page tries the reserved pool first and falls back to transparent huge pages.
+class NumaMemory {
+private:
+    void* address;
+    size_t length;
+    int boundNode;
+    PageBacking backing;
+
+    NumaMemory(void* mappedAddress, size_t mappedLength, int node, PageBacking pageBacking);
+
+public:
+    NumaMemory(const NumaMemory&) = delete;
+    NumaMemory& operator=(const NumaMemory&) = delete;
+    ~NumaMemory();
+
+    // Map at least bytes on node (node < 0: wherever the kernel likes). Throws
+    // std::bad_alloc if no memory can be mapped at all; a failed binding is not an
+    // error and shows up as node() == -1.
+    static std::shared_ptr<NumaMemory> allocate(size_t bytes, int node, bool hugePages);
+
+    void* data() { return address; }
+    const void* data() const { return address; }
+    size_t size() const { return length; }
+
+    // Node the region is bound to, or -1 if unbound
+    int node() const { return boundNode; }
+    PageBacking pageBacking() const { return backing; }
+};
+
+#endif // NUMA_MEMORY_H
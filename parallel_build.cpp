@@ -0,0 +1,110 @@
+#include "parallel_build.h"
+#include "line_reader.h"
+#include <atomic>
+#include <memory>
+#include <string_view>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+unsigned int resolveThreadCount(unsigned int requested) {
+    if (requested > 0) return requested;
+    unsigned int hardware = thread::hardware_concurrency();
+    return hardware > 0 ? hardware : 1;
+}
+
+// Run one worker per byte range; worker(index, begin, end, countSlot) returns success
+template <typename Worker>
+bool runRanges(const string& filename, unsigned int numThreads, size_t& inserted, Worker&& worker) {
+    int64_t fileSize = lineFileSize(filename);
+    if (fileSize < 0) return false;
+
+    unsigned int threads = resolveThreadCount(numThreads);
+    // Tiny files are not worth splitting
+    if (fileSize < static_cast<int64_t>(threads) * 4096) threads = 1;
+
+    vector<size_t> counts(threads, 0);
+    atomic<bool> ok(true);
+    vector<thread> pool;
+
+    for (unsigned int t = 0; t < threads; t++) {
+        uint64_t begin = static_cast<uint64_t>(fileSize) * t / threads;
+        uint64_t end = static_cast<uint64_t>(fileSize) * (t + 1) / threads;
+        pool.emplace_back([&, t, begin, end]() {
+            try {
+                if (!worker(t, begin, end, counts[t])) ok = false;
+            } catch (...) {
+                ok = false;
+            }
+        });
+    }
+    for (auto& th : pool) th.join();
+    if (!ok) return false;
+
+    inserted = 0;
+    for (size_t count : counts) inserted += count;
+    return true;
+}
+
+// Intern every line into retained, in file order, once the filter is built
+bool retainLines(const string& filename, KeySet* retained) {
+    if (!retained) return true;
+    return forEachLineBatch(filename, [retained](const string_view* lines, size_t count) {
+        for (size_t i = 0; i < count; i++) retained->insert(lines[i]);
+    });
+}
+
+// Every thread inserts into the one thread-safe filter
+template <typename SharedFilter>
+bool insertShared(const string& filename, SharedFilter& filter, unsigned int numThreads,
+                  size_t& inserted, KeySet* retained) {
+    bool ok = runRanges(filename, numThreads, inserted,
+        [&](unsigned int, uint64_t begin, uint64_t end, size_t& count) {
+            return forEachLineBatch(filename, begin, end, [&filter](const string_view* lines, size_t n) {
+                for (size_t i = 0; i < n; i++) filter.insert(lines[i]);
+            }, count);
+        });
+    return ok && retainLines(filename, retained);
+}
+
+} // namespace
+
+bool parallelInsertFromFile(const string& filename, BloomFilter& filter, unsigned int numThreads,
+                            size_t& inserted, KeySet* retained) {
+    unsigned int threads = resolveThreadCount(numThreads);
+    // Thread 0 writes into the target itself; the others get private filters
+    vector<unique_ptr<BloomFilter>> locals(threads);
+    auto target = [&](unsigned int t) -> BloomFilter& {
+        if (t == 0) return filter;
+        if (!locals[t]) locals[t].reset(new BloomFilter(filter.getSize(), filter.getNumHashes()));
+        return *locals[t];
+    };
+
+    bool ok = runRanges(filename, threads, inserted,
+        [&](unsigned int t, uint64_t begin, uint64_t end, size_t& count) {
+            BloomFilter& local = target(t);
+            return forEachLineBatch(filename, begin, end, [&local](const string_view* lines, size_t n) {
+                local.insertBatch(lines, n);
+            }, count);
+        });
+    if (!ok) return false;
+
+    // Each union is itself split across threads once the array is large
+    for (size_t t = 1; t < threads; t++) {
+        if (locals[t]) filter.unionWith(*locals[t]);
+        locals[t].reset();
+    }
+    return retainLines(filename, retained);
+}
+
+bool parallelInsertFromFile(const string& filename, ConcurrentBloomFilter& filter, unsigned int numThreads,
+                            size_t& inserted, KeySet* retained) {
+    return insertShared(filename, filter, numThreads, inserted, retained);
+}
+
+bool parallelInsertFromFile(const string& filename, ShardedBloomFilter& filter, unsigned int numThreads,
+                            size_t& inserted, KeySet* retained) {
+    return insertShared(filename, filter, numThreads, inserted, retained);
+}
@@ -0,0 +1,28 @@
+#ifndef PARALLEL_BUILD_H
+#define PARALLEL_BUILD_H
+
+#include "bloom_filter.h"
+#include "concurrent_bloom_filter.h"
+#include "key_set.h"
+#include "sharded_bloom_filter.h"
+#include <string>
+
+// Parallel bulk build from a newline-separated list file.
+// The file is split into one byte range per thread; a line belongs to the range
+// that holds its first byte, and is read zero-copy through forEachLineBatch. Empty
+// lines are skipped, as in the sequential path. If retained is non-null every line is
+// interned into it, in file order, after the filter is built.
+// numThreads == 0 uses every hardware thread.
+
+// Each thread fills a private filter of the same geometry; the private filters are
+// OR-merged into filter at the end with the vectorized word kernels.
+bool parallelInsertFromFile(const std::string& filename, BloomFilter& filter, unsigned int numThreads,
+                            size_t& inserted, KeySet* retained = nullptr);
+
+// All threads insert straight into the shared lock-free filter; no merge step.
+bool parallelInsertFromFile(const std::string& filename, ConcurrentBloomFilter& filter, unsigned int numThreads,
+                            size_t& inserted, KeySet* retained = nullptr);
+bool parallelInsertFromFile(const std::string& filename, ShardedBloomFilter& filter, unsigned int numThreads,
+                            size_t& inserted, KeySet* retained = nullptr);
+
+#endif // PARALLEL_BUILD_H
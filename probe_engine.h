@@ -0,0 +1,199 @@
+#ifndef PROBE_ENGINE_H
+#define PROBE_ENGINE_H
+
+#include "hash_policy.h"
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+// Probe engine: hashes a key once and derives all k bit indices by double hashing,
+// index_i = reduce(h1) + i * reduce(h2), wrapped into [0, size). h1 and h2 are
+// reduced once per key and the sequence is stepped with a conditional subtract.
+//
+// K is the number of probes fixed at compile time (loops fully unroll); K == 0 is
+// the runtime fallback that reads k from the filter.
+
+// Largest probe count with a compile-time specialization
+constexpr unsigned int kMaxUnrolledHashes = 16;
+
+// Keys hashed and prefetched together by the batch kernels so their misses overlap
+constexpr size_t kBatchWindow = 16;
+
+// Reduction policies map a 64-bit hash into [0, size) and step the probe sequence.
+
+// h % size: two hardware divisions per key. Matches the original bit positions.
+struct ModuloReduction {
+    static size_t reduce(uint64_t h, size_t size) { return h % size; }
+    static size_t advance(size_t index, size_t step, size_t size) {
+        index += step;
+        return index >= size ? index - size : index;
+    }
+};
+
+// h & (size - 1) for power-of-two sizes. Identical results to ModuloReduction for
+// those sizes, so legacy filters keep their bit positions, with no division at all.
+struct MaskReduction {
+    static size_t reduce(uint64_t h, size_t size) { return h & (size - 1); }
+    static size_t advance(size_t index, size_t step, size_t size) {
+        return (index + step) & (size - 1);
+    }
+};
+
+// Lemire's multiply-high range reduction: (h * size) >> 64. Division-free for any
+// size, but maps hashes differently from modulo, so only for new filter layouts.
+struct FastRangeReduction {
+    static size_t reduce(uint64_t h, size_t size) {
+        return static_cast<size_t>((static_cast<__uint128_t>(h) * size) >> 64);
+    }
+    static size_t advance(size_t index, size_t step, size_t size) {
+        index += step;
+        return index >= size ? index - size : index;
+    }
+};
+
+inline bool isPowerOfTwo(size_t value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+inline size_t roundUpToPowerOfTwo(size_t value) {
+    size_t result = 1;
+    while (result < value) result <<= 1;
+    return result;
+}
+
+template <typename Hash, typename Reduction, unsigned int K>
+struct ProbeEngine {
+    // Call visit(index) for each of the probes of a key; stops early if visit returns false
+    template <typename Visit>
+    static bool forEachIndex(const HashPair& hp, size_t size, unsigned int k, Visit&& visit) {
+        const unsigned int probes = K ? K : k;
+        size_t index = Reduction::reduce(hp.h1, size);
+        const size_t step = Reduction::reduce(hp.h2, size);
+        for (unsigned int i = 0; i < probes; i++) {
+            if (!visit(index)) return false;
+            index = Reduction::advance(index, step, size);
+        }
+        return true;
+    }
+
+    // Set one bit, adding 1 to added if it was clear. added is deliberately not a
+    // uint64_t/size_t: a counter of the word type could alias the bit array, forcing
+    // it through memory on every store.
+    static void setBit(uint64_t* words, size_t index, unsigned int& added) {
+        uint64_t& word = words[index >> 6];
+        uint64_t mask = uint64_t(1) << (index & 63);
+        added += !(word & mask);
+        word |= mask;
+    }
+
+    // The insert kernels return how many bits they turned on, so filters can keep a
+    // running set-bit count without scanning
+    static size_t insertHashed(uint64_t* words, size_t size, unsigned int k, const HashPair& hp) {
+        unsigned int added = 0;
+        forEachIndex(hp, size, k, [words, &added](size_t index) {
+            setBit(words, index, added);
+            return true;
+        });
+        return added;
+    }
+
+    static bool containsHashed(const uint64_t* words, size_t size, unsigned int k, const HashPair& hp) {
+        return forEachIndex(hp, size, k, [words](size_t index) {
+            return ((words[index >> 6] >> (index & 63)) & 1) != 0;
+        });
+    }
+
+    static size_t insert(uint64_t* words, size_t size, unsigned int k, const char* key, size_t len) {
+        return insertHashed(words, size, k, Hash::hash(key, len));
+    }
+
+    static bool contains(const uint64_t* words, size_t size, unsigned int k, const char* key, size_t len) {
+        return containsHashed(words, size, k, Hash::hash(key, len));
+    }
+
+    // Batched paths: hash a window of keys, prefetch every target word, then resolve
+    static size_t insertBatch(uint64_t* words, size_t size, unsigned int k,
+                              const std::string_view* keys, size_t count) {
+        size_t added = 0;
+        HashPair hashes[kBatchWindow];
+        for (size_t base = 0; base < count; base += kBatchWindow) {
+            size_t n = count - base < kBatchWindow ? count - base : kBatchWindow;
+            for (size_t j = 0; j < n; j++) {
+                hashes[j] = Hash::hash(keys[base + j].data(), keys[base + j].size());
+                forEachIndex(hashes[j], size, k, [words](size_t index) {
+                    __builtin_prefetch(&words[index >> 6], 1);
+                    return true;
+                });
+            }
+            unsigned int windowAdded = 0;
+            for (size_t j = 0; j < n; j++) {
+                forEachIndex(hashes[j], size, k, [words, &windowAdded](size_t index) {
+                    setBit(words, index, windowAdded);
+                    return true;
+                });
+            }
+            added += windowAdded;
+        }
+        return added;
+    }
+
+    static void containsBatch(const uint64_t* words, size_t size, unsigned int k,
+                              const std::string_view* keys, size_t count, bool* results) {
+        HashPair hashes[kBatchWindow];
+        for (size_t base = 0; base < count; base += kBatchWindow) {
+            size_t n = count - base < kBatchWindow ? count - base : kBatchWindow;
+            for (size_t j = 0; j < n; j++) {
+                hashes[j] = Hash::hash(keys[base + j].data(), keys[base + j].size());
+                forEachIndex(hashes[j], size, k, [words](size_t index) {
+                    __builtin_prefetch(&words[index >> 6], 0);
+                    return true;
+                });
+            }
+            for (size_t j = 0; j < n; j++) {
+                results[base + j] = forEachIndex(hashes[j], size, k, [words](size_t index) {
+                    return ((words[index >> 6] >> (index & 63)) & 1) != 0;
+                });
+            }
+        }
+    }
+};
+
+// Kernel pair selected once per filter; replaces the per-probe std::function calls
+struct ProbeKernels {
+    // Inserts return the number of bits they turned on
+    size_t (*insert)(uint64_t* words, size_t size, unsigned int k, const char* key, size_t len);
+    bool (*contains)(const uint64_t* words, size_t size, unsigned int k, const char* key, size_t len);
+    size_t (*insertBatch)(uint64_t* words, size_t size, unsigned int k,
+                          const std::string_view* keys, size_t count);
+    void (*containsBatch)(const uint64_t* words, size_t size, unsigned int k,
+                          const std::string_view* keys, size_t count, bool* results);
+    // Keys already hashed, e.g. by the policy's integer-key fast path
+    size_t (*insertHashed)(uint64_t* words, size_t size, unsigned int k, const HashPair& hp);
+    bool (*containsHashed)(const uint64_t* words, size_t size, unsigned int k, const HashPair& hp);
+};
+
+namespace probe_detail {
+
+template <typename Hash, typename Reduction, unsigned int... Ks>
+const ProbeKernels* kernelTable(std::integer_sequence<unsigned int, Ks...>) {
+    // Entry 0 is the runtime-k fallback, entries 1..16 are unrolled
+    static const ProbeKernels table[] = {
+        {&ProbeEngine<Hash, Reduction, Ks>::insert, &ProbeEngine<Hash, Reduction, Ks>::contains,
+         &ProbeEngine<Hash, Reduction, Ks>::insertBatch, &ProbeEngine<Hash, Reduction, Ks>::containsBatch,
+         &ProbeEngine<Hash, Reduction, Ks>::insertHashed, &ProbeEngine<Hash, Reduction, Ks>::containsHashed}...
+    };
+    return table;
+}
+
+} // namespace probe_detail
+
+// Pick the kernels for a hash policy, reduction and probe count
+template <typename Hash, typename Reduction>
+const ProbeKernels& selectProbeKernels(unsigned int k) {
+    const ProbeKernels* table = probe_detail::kernelTable<Hash, Reduction>(
+        std::make_integer_sequence<unsigned int, kMaxUnrolledHashes + 1>{});
+    return table[k <= kMaxUnrolledHashes ? k : 0];
+}
+
+#endif // PROBE_ENGINE_H
@@ -0,0 +1,304 @@
+#include "rotating_bloom_filter.h"
+#include "bloom_filter.h"
+#include "latency_profile.h"
+#include "probe_engine.h"
+#include <cmath>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+// Bit s of every byte lane in a word
+constexpr uint64_t kLaneOnes = 0x0101010101010101ULL;
+
+inline size_t laneWord(size_t position) {
+    return position >> 3;
+}
+
+inline unsigned int laneShift(size_t position) {
+    return static_cast<unsigned int>(position & 7) * 8;
+}
+
+} // namespace
+
+RotatingBloomFilter::RotatingBloomFilter(size_t filterSize, unsigned int numHashFunctions,
+                                         unsigned int generations, const RotationPolicy& rotationPolicy)
+    : lanes(filterSize * 8), size(filterSize), numHashes(numHashFunctions), numGenerations(generations),
+      powerOfTwo(isPowerOfTwo(filterSize)), policy(rotationPolicy), state(packState(0, 1)),
+      liveOrder{0}, liveCount(1), cleanSlots(0), dirtySlot(-1), rotationCount(0),
+      generationStart(chrono::steady_clock::now()), stopping(false) {
+    if (filterSize == 0 || numHashFunctions == 0) {
+        throw invalid_argument("RotatingBloomFilter needs a non-zero size and hash count");
+    }
+    if (generations == 0 || generations > kMaxGenerations) {
+        throw invalid_argument("RotatingBloomFilter supports 1 to 7 generations");
+    }
+    for (unsigned int slot = 0; slot <= numGenerations; slot++) {
+        slotInserts[slot].store(0, memory_order_relaxed);
+        if (slot != 0) cleanSlots |= 1u << slot;
+    }
+    maintenance = thread([this]() { maintenanceLoop(); });
+}
+
+RotatingBloomFilter::~RotatingBloomFilter() {
+    {
+        lock_guard<mutex> guard(rotationLock);
+        stopping = true;
+    }
+    maintenanceWake.notify_all();
+    maintenance.join();
+}
+
+RotatingBloomFilter RotatingBloomFilter::createOptimal(size_t itemsPerGeneration, double falsePositiveRate,
+                                                       unsigned int generations,
+                                                       const RotationPolicy& rotationPolicy) {
+    if (generations == 0 || generations > kMaxGenerations) {
+        throw invalid_argument("RotatingBloomFilter supports 1 to 7 generations");
+    }
+    size_t optimalSize;
+    unsigned int optimalHashes;
+    BloomFilter::computeOptimalParameters(itemsPerGeneration, falsePositiveRate / generations, false,
+                                          optimalSize, optimalHashes);
+    RotationPolicy effective = rotationPolicy;
+    if (effective.maxInserts == 0 && effective.maxAge.count() == 0) effective.maxInserts = itemsPerGeneration;
+    return RotatingBloomFilter(optimalSize, optimalHashes, generations, effective);
+}
+
+unsigned int RotatingBloomFilter::insertHashed(const HashPair& hp) {
+    unsigned int slot = state.load(memory_order_acquire) >> 8;
+    atomic<uint64_t>* words = lanes.data();
+    auto setLane = [words, slot](size_t position) {
+        uint64_t bit = uint64_t(1) << (laneShift(position) + slot);
+        atomic<uint64_t>& word = words[laneWord(position)];
+        // Skip the read-modify-write once the bit is already there
+        if (!(word.load(memory_order_relaxed) & bit)) word.fetch_or(bit, memory_order_relaxed);
+        return true;
+    };
+    if (powerOfTwo) {
+        ProbeEngine<WyHash, MaskReduction, 0>::forEachIndex(hp, size, numHashes, setLane);
+    } else {
+        ProbeEngine<WyHash, ModuloReduction, 0>::forEachIndex(hp, size, numHashes, setLane);
+    }
+    return slot;
+}
+
+bool RotatingBloomFilter::containsHashed(const HashPair& hp, uint32_t liveMask) const {
+    const atomic<uint64_t>* words = lanes.data();
+    // Slots whose bits every probe so far has had
+    uint32_t candidates = liveMask;
+    auto testLane = [words, &candidates](size_t position) {
+        candidates &= static_cast<uint32_t>(words[laneWord(position)].load(memory_order_relaxed) >>
+                                            laneShift(position)) & 0xff;
+        return candidates != 0;
+    };
+    if (powerOfTwo) {
+        return ProbeEngine<WyHash, MaskReduction, 0>::forEachIndex(hp, size, numHashes, testLane);
+    }
+    return ProbeEngine<WyHash, ModuloReduction, 0>::forEachIndex(hp, size, numHashes, testLane);
+}
+
+void RotatingBloomFilter::countInsert(unsigned int slot) {
+    uint64_t inserted = slotInserts[slot].fetch_add(1, memory_order_relaxed) + 1;
+    if (policy.maxInserts == 0 || inserted != policy.maxInserts) return;
+    unique_lock<mutex> guard(rotationLock);
+    // An insert that raced a time-based rotation must not rotate a second time
+    if ((state.load(memory_order_relaxed) >> 8) == slot) rotateLocked(guard);
+}
+
+void RotatingBloomFilter::insert(string_view element) {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::Insert);
+    countInsert(insertHashed(WyHash::hash(element.data(), element.size())));
+}
+
+void RotatingBloomFilter::insert(const void* data, size_t len) {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::Insert);
+    countInsert(insertHashed(WyHash::hash(static_cast<const char*>(data), len)));
+}
+
+void RotatingBloomFilter::insert(uint64_t key) {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::Insert);
+    countInsert(insertHashed(WyHash::hashKey(key)));
+}
+
+bool RotatingBloomFilter::mightContain(string_view element) const {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::Contains);
+    return containsHashed(WyHash::hash(element.data(), element.size()), state.load(memory_order_acquire) & 0xff);
+}
+
+bool RotatingBloomFilter::mightContain(const void* data, size_t len) const {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::Contains);
+    return containsHashed(WyHash::hash(static_cast<const char*>(data), len), state.load(memory_order_acquire) & 0xff);
+}
+
+bool RotatingBloomFilter::mightContain(uint64_t key) const {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::Contains);
+    return containsHashed(WyHash::hashKey(key), state.load(memory_order_acquire) & 0xff);
+}
+
+void RotatingBloomFilter::insertBatch(const string_view* elements, size_t count) {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::InsertBatch);
+    const atomic<uint64_t>* words = lanes.data();
+    auto prefetch = [words](size_t position) {
+        __builtin_prefetch(&words[laneWord(position)], 1);
+        return true;
+    };
+    HashPair hashes[kBatchWindow];
+    for (size_t base = 0; base < count; base += kBatchWindow) {
+        size_t n = min(kBatchWindow, count - base);
+        for (size_t j = 0; j < n; j++) {
+            hashes[j] = WyHash::hash(elements[base + j].data(), elements[base + j].size());
+            if (powerOfTwo) {
+                ProbeEngine<WyHash, MaskReduction, 0>::forEachIndex(hashes[j], size, numHashes, prefetch);
+            } else {
+                ProbeEngine<WyHash, ModuloReduction, 0>::forEachIndex(hashes[j], size, numHashes, prefetch);
+            }
+        }
+        for (size_t j = 0; j < n; j++) countInsert(insertHashed(hashes[j]));
+    }
+}
+
+void RotatingBloomFilter::mightContainBatch(const string_view* elements, size_t count, bool* results) const {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::ContainsBatch);
+    const atomic<uint64_t>* words = lanes.data();
+    auto prefetch = [words](size_t position) {
+        __builtin_prefetch(&words[laneWord(position)], 0);
+        return true;
+    };
+    uint32_t liveMask = state.load(memory_order_acquire) & 0xff;
+    HashPair hashes[kBatchWindow];
+    for (size_t base = 0; base < count; base += kBatchWindow) {
+        size_t n = min(kBatchWindow, count - base);
+        for (size_t j = 0; j < n; j++) {
+            hashes[j] = WyHash::hash(elements[base + j].data(), elements[base + j].size());
+            if (powerOfTwo) {
+                ProbeEngine<WyHash, MaskReduction, 0>::forEachIndex(hashes[j], size, numHashes, prefetch);
+            } else {
+                ProbeEngine<WyHash, ModuloReduction, 0>::forEachIndex(hashes[j], size, numHashes, prefetch);
+            }
+        }
+        for (size_t j = 0; j < n; j++) results[base + j] = containsHashed(hashes[j], liveMask);
+    }
+}
+
+void RotatingBloomFilter::rotateLocked(unique_lock<mutex>& guard) {
+    // With every generation live the only free slot is the one expired last time
+    spareReady.wait(guard, [this]() { return cleanSlots != 0; });
+    unsigned int next = static_cast<unsigned int>(__builtin_ctz(cleanSlots));
+    cleanSlots &= ~(1u << next);
+    slotInserts[next].store(0, memory_order_relaxed);
+
+    uint32_t liveMask = state.load(memory_order_relaxed) & 0xff;
+    if (liveCount == numGenerations) {
+        unsigned int oldest = liveOrder[0];
+        for (unsigned int i = 1; i < liveCount; i++) liveOrder[i - 1] = liveOrder[i];
+        liveCount--;
+        liveMask &= ~(1u << oldest);
+        dirtySlot = static_cast<int>(oldest);
+    }
+    liveOrder[liveCount++] = next;
+    liveMask |= 1u << next;
+    state.store(packState(next, liveMask), memory_order_release);
+
+    rotationCount++;
+    generationStart = chrono::steady_clock::now();
+    maintenanceWake.notify_all();
+}
+
+void RotatingBloomFilter::rotate() {
+    unique_lock<mutex> guard(rotationLock);
+    rotateLocked(guard);
+}
+
+void RotatingBloomFilter::zeroSlot(unsigned int slot) {
+    // Inserts into live slots share these words, so clear with an atomic AND, and only
+    // where the slot has a bit at all
+    const uint64_t mask = kLaneOnes << slot;
+    atomic<uint64_t>* words = lanes.data();
+    for (size_t i = 0; i < lanes.numWords(); i++) {
+        if (words[i].load(memory_order_relaxed) & mask) words[i].fetch_and(~mask, memory_order_relaxed);
+    }
+}
+
+void RotatingBloomFilter::maintenanceLoop() {
+    unique_lock<mutex> guard(rotationLock);
+    while (!stopping) {
+        if (dirtySlot >= 0) {
+            unsigned int slot = static_cast<unsigned int>(dirtySlot);
+            guard.unlock();
+            zeroSlot(slot);
+            guard.lock();
+            dirtySlot = -1;
+            cleanSlots |= 1u << slot;
+            spareReady.notify_all();
+            continue;
+        }
+        if (policy.maxAge.count() > 0) {
+            auto deadline = generationStart + policy.maxAge;
+            if (chrono::steady_clock::now() >= deadline) {
+                rotateLocked(guard);
+                continue;
+            }
+            maintenanceWake.wait_until(guard, deadline);
+        } else {
+            maintenanceWake.wait(guard);
+        }
+    }
+}
+
+double RotatingBloomFilter::getCurrentFalsePositiveRate() const {
+    uint32_t liveMask = state.load(memory_order_acquire) & 0xff;
+    double allNegative = 1.0;
+    for (unsigned int slot = 0; slot <= numGenerations; slot++) {
+        if (!(liveMask & (1u << slot))) continue;
+        double items = static_cast<double>(slotInserts[slot].load(memory_order_relaxed));
+        allNegative *= 1.0 - pow(1.0 - exp(-1.0 * numHashes * items / size), numHashes);
+    }
+    return 1.0 - allNegative;
+}
+
+size_t RotatingBloomFilter::getSize() const {
+    return size;
+}
+
+size_t RotatingBloomFilter::memoryBytes() const {
+    return lanes.numWords() * sizeof(uint64_t);
+}
+
+unsigned int RotatingBloomFilter::getNumHashes() const {
+    return numHashes;
+}
+
+unsigned int RotatingBloomFilter::getGenerationCount() const {
+    return numGenerations;
+}
+
+unsigned int RotatingBloomFilter::getLiveGenerations() const {
+    return static_cast<unsigned int>(__builtin_popcount(state.load(memory_order_acquire) & 0xff));
+}
+
+uint64_t RotatingBloomFilter::getRotationCount() const {
+    lock_guard<mutex> guard(rotationLock);
+    return rotationCount;
+}
+
+unique_ptr<RotatingBloomFilter> RotatingBloomFilter::emptyLike() const {
+    return unique_ptr<RotatingBloomFilter>(new RotatingBloomFilter(size, numHashes, numGenerations, policy));
+}
+
+void RotatingBloomFilter::clear() {
+    unique_lock<mutex> guard(rotationLock);
+    // Let a pending zeroing finish so it cannot clear bits of the restarted generation
+    spareReady.wait(guard, [this]() { return dirtySlot < 0; });
+    lanes.reset();
+    for (unsigned int slot = 0; slot <= numGenerations; slot++) {
+        slotInserts[slot].store(0, memory_order_relaxed);
+    }
+    cleanSlots = 0;
+    for (unsigned int slot = 1; slot <= numGenerations; slot++) cleanSlots |= 1u << slot;
+    liveOrder[0] = 0;
+    liveCount = 1;
+    state.store(packState(0, 1), memory_order_release);
+    generationStart = chrono::steady_clock::now();
+    maintenanceWake.notify_all();
+}
@@ -0,0 +1,148 @@
+#ifndef ROTATING_BLOOM_FILTER_H
+#define ROTATING_BLOOM_FILTER_H
+
+#include "bit_storage.h"
+#include "hash_policy.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+
+// When a RotatingBloomFilter starts a new generation; either limit may be 0 (off)
+struct RotationPolicy {
+    // Inserts into the current generation
+    uint64_t maxInserts = 0;
+    // Age of the current generation
+    std::chrono::milliseconds maxAge{0};
+};
+
+// Sliding-window Bloom filter for "seen in the last N periods" questions: keys go into
+// the current generation, lookups check every live one, and the oldest generation is
+// expired whole on each rotation instead of clearing everything at once.
+//
+// Generations share one array of byte lanes: probe position p owns byte p, and bit s
+// of that byte is p's bit in slot s. A lookup ANDs the k lanes of a key and masks the
+// result with the live slots, so every generation is checked with k loads in one
+// pass, and a lane never splits across a cache line. There are generations + 1 slots:
+// rotating is a single atomic store that makes the spare slot current and drops the
+// oldest from the live mask; a background thread then zeroes the dropped slot into the
+// next spare and also rotates on maxAge. A rotation that finds the spare still being
+// zeroed waits for it.
+//
+// Thread-safe: inserts use relaxed fetch_or and lookups relaxed loads, as in
+// ConcurrentBloomFilter. An insert that races a rotation may land in the generation
+// that was just closed, which only delays its expiry by one rotation.
+// The false positive rate adds up over the live generations, so createOptimal sizes
+// each one for falsePositiveRate / generations.
+class RotatingBloomFilter {
+public:
+    // Lanes are bytes, so at most 8 slots: 7 live generations plus the spare
+    static constexpr unsigned int kMaxGenerations = 7;
+
+private:
+    // Eight lanes per word
+    AtomicBitStorage lanes;
+    size_t size;
+    unsigned int numHashes;
+    unsigned int numGenerations;
+    bool powerOfTwo;
+    RotationPolicy policy;
+
+    // Current slot in bits 8..15, live slot mask in bits 0..7; one word so a lookup
+    // and a rotation always agree on which slots are live
+    std::atomic<uint32_t> state;
+    // Inserts per slot since it became current; drives maxInserts and the FPR estimate
+    std::atomic<uint64_t> slotInserts[kMaxGenerations + 1];
+
+    // Guards everything below, and serializes rotations
+    mutable std::mutex rotationLock;
+    std::condition_variable maintenanceWake;
+    std::condition_variable spareReady;
+    // Live slots, oldest first
+    unsigned int liveOrder[kMaxGenerations];
+    unsigned int liveCount;
+    // Zeroed slots ready to become current, and the expired slot still being zeroed (-1: none)
+    uint32_t cleanSlots;
+    int dirtySlot;
+    uint64_t rotationCount;
+    std::chrono::steady_clock::time_point generationStart;
+    bool stopping;
+    std::thread maintenance;
+
+    static uint32_t packState(unsigned int current, uint32_t liveMask) { return (current << 8) | liveMask; }
+
+    // Returns the slot the key went into
+    unsigned int insertHashed(const HashPair& hp);
+    bool containsHashed(const HashPair& hp, uint32_t liveMask) const;
+
+    // Count one insert into slot and rotate if it filled the generation
+    void countInsert(unsigned int slot);
+
+    void rotateLocked(std::unique_lock<std::mutex>& guard);
+    void zeroSlot(unsigned int slot);
+    void maintenanceLoop();
+
+public:
+    // filterSize probe positions (one byte each) with numHashFunctions probes, and
+    // numGenerations live generations (1..kMaxGenerations). Throws
+    // std::invalid_argument for bad parameters.
+    RotatingBloomFilter(size_t filterSize, unsigned int numHashFunctions, unsigned int numGenerations,
+                        const RotationPolicy& rotationPolicy = RotationPolicy());
+    RotatingBloomFilter(const RotatingBloomFilter&) = delete;
+    RotatingBloomFilter& operator=(const RotatingBloomFilter&) = delete;
+    ~RotatingBloomFilter();
+
+    // Size each generation for itemsPerGeneration keys, so the filter as a whole stays
+    // at falsePositiveRate with every generation full. A policy with neither limit set
+    // rotates every itemsPerGeneration inserts.
+    static RotatingBloomFilter createOptimal(size_t itemsPerGeneration, double falsePositiveRate,
+                                             unsigned int numGenerations,
+                                             const RotationPolicy& rotationPolicy = RotationPolicy());
+
+    // Insert into the current generation; safe to call from many threads at once
+    void insert(std::string_view element);
+    void insert(const void* data, size_t len);
+    void insert(uint64_t key);
+
+    // True if the key might be in any live generation; lock-free
+    bool mightContain(std::string_view element) const;
+    bool mightContain(const void* data, size_t len) const;
+    bool mightContain(uint64_t key) const;
+
+    // Batched paths: a window of keys is hashed and its lanes prefetched before any is
+    // resolved. A batch lookup checks every key against the same live generations.
+    void insertBatch(const std::string_view* elements, size_t count);
+    void mightContainBatch(const std::string_view* elements, size_t count, bool* results) const;
+
+    // Start a new generation now, expiring the oldest once all of them are live
+    void rotate();
+
+    // Compound false positive rate of the live generations at their insert counts
+    double getCurrentFalsePositiveRate() const;
+
+    // Probe positions per generation, and bytes of lanes
+    size_t getSize() const;
+    size_t memoryBytes() const;
+    unsigned int getNumHashes() const;
+    unsigned int getGenerationCount() const;
+
+    // Generations holding keys right now (grows to getGenerationCount() as it rotates)
+    unsigned int getLiveGenerations() const;
+
+    // Rotations so far
+    uint64_t getRotationCount() const;
+
+    // Empty filter with the same geometry and rotation policy
+    std::unique_ptr<RotatingBloomFilter> emptyLike() const;
+
+    // Expire every generation and start again from one empty one; callers must make
+    // sure no inserts run concurrently
+    void clear();
+};
+
+#endif // ROTATING_BLOOM_FILTER_H
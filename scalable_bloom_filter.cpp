@@ -0,0 +1,212 @@
+#include "scalable_bloom_filter.h"
+#include "atomic_file.h"
+#include "filter_format.h"
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+// Manifest words: initialCapacity, fpr, growth, tightening, stage count, then per-stage counts
+constexpr size_t kManifestFixedWords = 5;
+
+uint64_t doubleBits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+double bitsDouble(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Every stage rate is derived from both, so each must lie strictly inside (0, 1)
+bool validRates(double falsePositiveRate, double tighteningRatio) {
+    return falsePositiveRate > 0 && falsePositiveRate < 1 && tighteningRatio > 0 && tighteningRatio < 1;
+}
+
+// Smallest prime >= n. With the legacy double hashing the probe stride is h2 % size,
+// and an even size with an even stride only ever reaches half the bits; at the low
+// error rates of later stages that multiplies the false positive rate several times.
+size_t nextPrime(size_t n) {
+    auto isPrime = [](size_t candidate) {
+        if (candidate < 2) return false;
+        for (size_t d = 2; d * d <= candidate; d++) {
+            if (candidate % d == 0) return false;
+        }
+        return true;
+    };
+    while (!isPrime(n)) n++;
+    return n;
+}
+
+} // namespace
+
+ScalableBloomFilter::ScalableBloomFilter(size_t initialCapacity, double falsePositiveRate,
+                                         unsigned int growthFactor, double tighteningRatio)
+    : initialCapacity(initialCapacity > 0 ? initialCapacity : 1), targetFalsePositiveRate(falsePositiveRate),
+      growthFactor(growthFactor > 0 ? growthFactor : 1), tighteningRatio(tighteningRatio) {
+    if (!validRates(falsePositiveRate, tighteningRatio)) {
+        throw invalid_argument("ScalableBloomFilter needs a false positive rate and tightening ratio between 0 and 1");
+    }
+    addStage();
+}
+
+size_t ScalableBloomFilter::stageCapacity(size_t index) const {
+    return static_cast<size_t>(initialCapacity * pow(static_cast<double>(growthFactor), static_cast<double>(index)));
+}
+
+double ScalableBloomFilter::stageFalsePositiveRate(size_t index) const {
+    return targetFalsePositiveRate * (1.0 - tighteningRatio) * pow(tighteningRatio, static_cast<double>(index));
+}
+
+void ScalableBloomFilter::addStage() {
+    size_t index = stages.size();
+    size_t optimalSize;
+    unsigned int optimalHashes;
+    BloomFilter::computeOptimalParameters(stageCapacity(index), stageFalsePositiveRate(index), false,
+                                          optimalSize, optimalHashes);
+    stages.emplace_back(nextPrime(optimalSize), optimalHashes);
+    stageItems.push_back(0);
+}
+
+template <typename Key>
+void ScalableBloomFilter::insertKey(const Key& key) {
+    if (containsKey(key)) return;
+
+    if (stageItems.back() >= stageCapacity(stages.size() - 1)) {
+        addStage();
+    }
+    stages.back().insert(key);
+    stageItems.back()++;
+}
+
+template <typename Key>
+bool ScalableBloomFilter::containsKey(const Key& key) const {
+    // The newest stage is the largest and holds the most keys
+    for (size_t i = stages.size(); i-- > 0;) {
+        if (stages[i].mightContain(key)) return true;
+    }
+    return false;
+}
+
+void ScalableBloomFilter::insert(string_view element) {
+    insertKey(element);
+}
+
+void ScalableBloomFilter::insert(const void* data, size_t len) {
+    insertKey(string_view(static_cast<const char*>(data), len));
+}
+
+void ScalableBloomFilter::insert(uint64_t key) {
+    insertKey(key);
+}
+
+bool ScalableBloomFilter::mightContain(string_view element) const {
+    return containsKey(element);
+}
+
+bool ScalableBloomFilter::mightContain(const void* data, size_t len) const {
+    return containsKey(string_view(static_cast<const char*>(data), len));
+}
+
+bool ScalableBloomFilter::mightContain(uint64_t key) const {
+    return containsKey(key);
+}
+
+double ScalableBloomFilter::getCurrentFalsePositiveRate() const {
+    double allNegative = 1.0;
+    for (size_t i = 0; i < stages.size(); i++) {
+        allNegative *= 1.0 - stages[i].getCurrentFalsePositiveRate(stageItems[i]);
+    }
+    return 1.0 - allNegative;
+}
+
+size_t ScalableBloomFilter::getItemCount() const {
+    size_t total = 0;
+    for (size_t items : stageItems) total += items;
+    return total;
+}
+
+size_t ScalableBloomFilter::getStageCount() const {
+    return stages.size();
+}
+
+size_t ScalableBloomFilter::getSize() const {
+    size_t total = 0;
+    for (const BloomFilter& stage : stages) total += stage.getSize();
+    return total;
+}
+
+void ScalableBloomFilter::clear() {
+    stages.clear();
+    stageItems.clear();
+    addStage();
+}
+
+bool ScalableBloomFilter::saveToFile(const string& filename, bool compress) const {
+    BitStorage manifest((kManifestFixedWords + stages.size()) * BitStorage::kBitsPerWord);
+    manifest.storeWord(0, initialCapacity);
+    manifest.storeWord(1, doubleBits(targetFalsePositiveRate));
+    manifest.storeWord(2, growthFactor);
+    manifest.storeWord(3, doubleBits(tighteningRatio));
+    manifest.storeWord(4, stages.size());
+    for (size_t i = 0; i < stages.size(); i++) {
+        manifest.storeWord(kManifestFixedWords + i, stageItems[i]);
+    }
+
+    return writeFileAtomically(filename, [&](ostream& out) {
+        if (!writeFilterFile(out, FilterKind::Scalable, Djb2SdbmHash::id, manifest.size(), 0, manifest)) {
+            return false;
+        }
+        for (const BloomFilter& stage : stages) {
+            if (!stage.writeTo(out, compress)) return false;
+        }
+        return true;
+    });
+}
+
+ScalableBloomFilter* ScalableBloomFilter::loadFromFile(const string& filename) {
+    ifstream inFile(filename, ios::binary);
+
+    if (!inFile.is_open()) {
+        return nullptr;
+    }
+
+    FilterFileHeader header;
+    if (!readFilterHeader(inFile, header) || header.kind != static_cast<uint32_t>(FilterKind::Scalable) ||
+        header.sizeBits % BitStorage::kBitsPerWord != 0 ||
+        header.sizeBits / BitStorage::kBitsPerWord < kManifestFixedWords) {
+        return nullptr;
+    }
+    BitStorage manifest(header.sizeBits);
+    if (!readFilterPayload(inFile, header, manifest)) {
+        return nullptr;
+    }
+
+    size_t stageCount = manifest.word(4);
+    if (stageCount == 0 || manifest.numWords() != kManifestFixedWords + stageCount ||
+        !validRates(bitsDouble(manifest.word(1)), bitsDouble(manifest.word(3)))) {
+        return nullptr;
+    }
+
+    unique_ptr<ScalableBloomFilter> loaded(new ScalableBloomFilter(
+        manifest.word(0), bitsDouble(manifest.word(1)),
+        static_cast<unsigned int>(manifest.word(2)), bitsDouble(manifest.word(3))));
+    loaded->stages.clear();
+    loaded->stageItems.clear();
+
+    for (size_t i = 0; i < stageCount; i++) {
+        unique_ptr<BloomFilter> stage(BloomFilter::readFrom(inFile));
+        if (!stage) return nullptr;
+        loaded->stages.push_back(move(*stage));
+        loaded->stageItems.push_back(manifest.word(kManifestFixedWords + i));
+    }
+    return loaded.release();
+}
@@ -0,0 +1,77 @@
+#ifndef SCALABLE_BLOOM_FILTER_H
+#define SCALABLE_BLOOM_FILTER_H
+
+#include "bloom_filter.h"
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Bloom filter that grows instead of needing expectedItems up front
+// (Almeida et al., "Scalable Bloom Filters").
+// Keys go into the newest stage; once it holds its capacity a new stage is added
+// with growthFactor times the capacity and tighteningRatio times the false positive
+// rate. Stage i targets p0 * r^i with p0 = falsePositiveRate * (1 - r), so the
+// compound rate stays below falsePositiveRate however many stages are added.
+// Stage sizes are rounded up to a prime so every probe stride covers the whole stage.
+//
+// Saved as one file: a Scalable manifest record (parameters and per-stage counts)
+// followed by one Standard record per stage, all in the versioned format.
+class ScalableBloomFilter {
+private:
+    std::vector<BloomFilter> stages;
+    std::vector<size_t> stageItems;
+    size_t initialCapacity;
+    double targetFalsePositiveRate;
+    unsigned int growthFactor;
+    double tighteningRatio;
+
+    // Capacity and error rate of stage index
+    size_t stageCapacity(size_t index) const;
+    double stageFalsePositiveRate(size_t index) const;
+
+    void addStage();
+
+    template <typename Key>
+    void insertKey(const Key& key);
+    template <typename Key>
+    bool containsKey(const Key& key) const;
+
+public:
+    // Throws std::invalid_argument unless falsePositiveRate and tighteningRatio are
+    // both strictly between 0 and 1.
+    ScalableBloomFilter(size_t initialCapacity = 1024, double falsePositiveRate = 0.01,
+                        unsigned int growthFactor = 2, double tighteningRatio = 0.85);
+
+    // Insert an element; keys that already test positive are not counted again.
+    // Raw bytes and integer keys hash as in BloomFilter.
+    void insert(std::string_view element);
+    void insert(const void* data, size_t len);
+    void insert(uint64_t key);
+
+    // Check if an element might be in the set; newest (largest) stage first
+    bool mightContain(std::string_view element) const;
+    bool mightContain(const void* data, size_t len) const;
+    bool mightContain(uint64_t key) const;
+
+    // Compound false positive probability at the current fill of every stage
+    double getCurrentFalsePositiveRate() const;
+
+    // Number of distinct keys counted so far
+    size_t getItemCount() const;
+
+    size_t getStageCount() const;
+
+    // Total bits across all stages
+    size_t getSize() const;
+
+    // Drop every stage but a fresh first one
+    void clear();
+
+    // Save every stage to one file
+    bool saveToFile(const std::string& filename, bool compress = false) const;
+
+    // Load a file written by saveToFile; nullptr on failure
+    static ScalableBloomFilter* loadFromFile(const std::string& filename);
+};
+
+#endif // SCALABLE_BLOOM_FILTER_H
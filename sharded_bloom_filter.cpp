@@ -0,0 +1,343 @@
+#include "sharded_bloom_filter.h"
+#include "atomic_file.h"
+#include "bloom_filter.h"
+#include "filter_format.h"
+#include "latency_profile.h"
+#include "probe_engine.h"
+#include "word_ops.h"
+#include <cmath>
+#include <fstream>
+#include <new>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+// Manifest words: shard count, bits per shard
+constexpr size_t kManifestWords = 2;
+
+// Largest shard count accepted from a file
+constexpr uint64_t kMaxShards = 1 << 16;
+
+} // namespace
+
+ShardedBloomFilter::ShardedBloomFilter(size_t bitsPerShard, unsigned int numHashFunctions, unsigned int numShards,
+                                       const ShardPlacement& shardPlacement)
+    : placement(shardPlacement), shardSize(bitsPerShard), numHashes(numHashFunctions), shardShift(0),
+      powerOfTwo(isPowerOfTwo(bitsPerShard)) {
+    if (bitsPerShard == 0 || numHashFunctions == 0) {
+        throw invalid_argument("ShardedBloomFilter needs a non-zero shard size and hash count");
+    }
+    if (!isPowerOfTwo(numShards) || numShards > kMaxShards) {
+        throw invalid_argument("ShardedBloomFilter needs a power-of-two shard count");
+    }
+    while ((size_t(1) << shardShift) < numShards) shardShift++;
+
+    vector<int> nodes = placement.nodes.empty() ? numaNodes() : placement.nodes;
+    size_t bytes = (bitsPerShard + BitStorage::kBitsPerWord - 1) / BitStorage::kBitsPerWord * sizeof(uint64_t);
+    shards.reserve(numShards);
+    for (unsigned int i = 0; i < numShards; i++) {
+        // Bound before the first touch, so every page the shard faults in comes from its node
+        shared_ptr<NumaMemory> memory = NumaMemory::allocate(bytes, nodes[i % nodes.size()], placement.hugePages);
+        Shard shard;
+        shard.node = memory->node();
+        shard.backing = memory->pageBacking();
+        shard.bits.reset(new AtomicBitStorage(memory->data(), bitsPerShard, memory));
+        shards.push_back(move(shard));
+    }
+}
+
+ShardedBloomFilter ShardedBloomFilter::createOptimal(size_t expectedItems, double falsePositiveRate,
+                                                     unsigned int numShards, bool roundToPowerOfTwo,
+                                                     const ShardPlacement& placement) {
+    if (numShards == 0) {
+        numShards = static_cast<unsigned int>(roundUpToPowerOfTwo(placement.nodes.empty() ? numaNodeCount()
+                                                                                          : placement.nodes.size()));
+    }
+    size_t optimalSize;
+    unsigned int optimalHashes;
+    BloomFilter::computeOptimalParameters(expectedItems, falsePositiveRate, false, optimalSize, optimalHashes);
+    size_t bitsPerShard = (optimalSize + numShards - 1) / numShards;
+    if (roundToPowerOfTwo) bitsPerShard = roundUpToPowerOfTwo(bitsPerShard);
+    return ShardedBloomFilter(bitsPerShard, optimalHashes, numShards, placement);
+}
+
+void ShardedBloomFilter::recountSetBits() {
+    size_t total = 0;
+    for (const Shard& shard : shards) total += popcountWords(shard.bits->data(), shard.bits->numWords());
+    setBits.store(total);
+}
+
+void ShardedBloomFilter::insertHashed(const HashPair& hp) {
+    AtomicBitStorage& bits = *shards[shardIndex(hp)].bits;
+    size_t added = 0;
+    auto setBit = [&bits, &added](size_t index) {
+        added += bits.set(index);
+        return true;
+    };
+    if (powerOfTwo) {
+        ProbeEngine<WyHash, MaskReduction, 0>::forEachIndex(hp, shardSize, numHashes, setBit);
+    } else {
+        ProbeEngine<WyHash, ModuloReduction, 0>::forEachIndex(hp, shardSize, numHashes, setBit);
+    }
+    // Once a filter fills up most inserts change nothing and skip the counter
+    if (added) setBits.add(added);
+}
+
+bool ShardedBloomFilter::containsHashed(const HashPair& hp) const {
+    const AtomicBitStorage& bits = *shards[shardIndex(hp)].bits;
+    auto testBit = [&bits](size_t index) {
+        return bits.test(index);
+    };
+    if (powerOfTwo) {
+        return ProbeEngine<WyHash, MaskReduction, 0>::forEachIndex(hp, shardSize, numHashes, testBit);
+    }
+    return ProbeEngine<WyHash, ModuloReduction, 0>::forEachIndex(hp, shardSize, numHashes, testBit);
+}
+
+void ShardedBloomFilter::insert(string_view element) {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::Insert);
+    insertHashed(WyHash::hash(element.data(), element.size()));
+}
+
+void ShardedBloomFilter::insert(const void* data, size_t len) {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::Insert);
+    insertHashed(WyHash::hash(static_cast<const char*>(data), len));
+}
+
+void ShardedBloomFilter::insert(uint64_t key) {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::Insert);
+    insertHashed(WyHash::hashKey(key));
+}
+
+bool ShardedBloomFilter::mightContain(string_view element) const {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::Contains);
+    return containsHashed(WyHash::hash(element.data(), element.size()));
+}
+
+bool ShardedBloomFilter::mightContain(const void* data, size_t len) const {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::Contains);
+    return containsHashed(WyHash::hash(static_cast<const char*>(data), len));
+}
+
+bool ShardedBloomFilter::mightContain(uint64_t key) const {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::Contains);
+    return containsHashed(WyHash::hashKey(key));
+}
+
+void ShardedBloomFilter::insertBatch(const string_view* elements, size_t count) {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::InsertBatch);
+    HashPair hashes[kBatchWindow];
+    for (size_t base = 0; base < count; base += kBatchWindow) {
+        size_t n = min(kBatchWindow, count - base);
+        for (size_t j = 0; j < n; j++) {
+            hashes[j] = WyHash::hash(elements[base + j].data(), elements[base + j].size());
+            const atomic<uint64_t>* words = shards[shardIndex(hashes[j])].bits->data();
+            auto prefetch = [words](size_t index) {
+                __builtin_prefetch(&words[index >> 6], 1);
+                return true;
+            };
+            if (powerOfTwo) {
+                ProbeEngine<WyHash, MaskReduction, 0>::forEachIndex(hashes[j], shardSize, numHashes, prefetch);
+            } else {
+                ProbeEngine<WyHash, ModuloReduction, 0>::forEachIndex(hashes[j], shardSize, numHashes, prefetch);
+            }
+        }
+        for (size_t j = 0; j < n; j++) insertHashed(hashes[j]);
+    }
+}
+
+void ShardedBloomFilter::mightContainBatch(const string_view* elements, size_t count, bool* results) const {
+    BLOOM_PROFILE_SCOPE(ProfiledOp::ContainsBatch);
+    HashPair hashes[kBatchWindow];
+    for (size_t base = 0; base < count; base += kBatchWindow) {
+        size_t n = min(kBatchWindow, count - base);
+        for (size_t j = 0; j < n; j++) {
+            hashes[j] = WyHash::hash(elements[base + j].data(), elements[base + j].size());
+            const atomic<uint64_t>* words = shards[shardIndex(hashes[j])].bits->data();
+            auto prefetch = [words](size_t index) {
+                __builtin_prefetch(&words[index >> 6], 0);
+                return true;
+            };
+            if (powerOfTwo) {
+                ProbeEngine<WyHash, MaskReduction, 0>::forEachIndex(hashes[j], shardSize, numHashes, prefetch);
+            } else {
+                ProbeEngine<WyHash, ModuloReduction, 0>::forEachIndex(hashes[j], shardSize, numHashes, prefetch);
+            }
+        }
+        for (size_t j = 0; j < n; j++) results[base + j] = containsHashed(hashes[j]);
+    }
+}
+
+size_t ShardedBloomFilter::shardOf(string_view element) const {
+    return shardIndex(WyHash::hash(element.data(), element.size()));
+}
+
+int ShardedBloomFilter::nodeOf(string_view element) const {
+    return shards[shardOf(element)].node;
+}
+
+int ShardedBloomFilter::shardNode(size_t shard) const {
+    return shards[shard].node;
+}
+
+PageBacking ShardedBloomFilter::shardPageBacking(size_t shard) const {
+    return shards[shard].backing;
+}
+
+bool ShardedBloomFilter::pinToShard(size_t shard) const {
+    return shards[shard].node >= 0 && pinThreadToNumaNode(shards[shard].node);
+}
+
+double ShardedBloomFilter::getCurrentFalsePositiveRate(size_t insertedItems) const {
+    // Keys spread evenly over the shards, so every shard sees the same rate
+    if (insertedItems == 0) return 0.0;
+    double exponent = -1.0 * numHashes * insertedItems / getSize();
+    return pow(1.0 - exp(exponent), numHashes);
+}
+
+size_t ShardedBloomFilter::getSize() const {
+    return shardSize * shards.size();
+}
+
+size_t ShardedBloomFilter::getShardSize() const {
+    return shardSize;
+}
+
+size_t ShardedBloomFilter::getShardCount() const {
+    return shards.size();
+}
+
+unsigned int ShardedBloomFilter::getNumHashes() const {
+    return numHashes;
+}
+
+void ShardedBloomFilter::clear() {
+    for (Shard& shard : shards) shard.bits->reset();
+    setBits.store(0);
+}
+
+unique_ptr<ShardedBloomFilter> ShardedBloomFilter::emptyLike() const {
+    return unique_ptr<ShardedBloomFilter>(new ShardedBloomFilter(
+        shardSize, numHashes, static_cast<unsigned int>(shards.size()), placement));
+}
+
+bool ShardedBloomFilter::sameGeometry(const ShardedBloomFilter& other) const {
+    return shardSize == other.shardSize && numHashes == other.numHashes && shards.size() == other.shards.size();
+}
+
+bool ShardedBloomFilter::unionWith(const ShardedBloomFilter& other) {
+    if (!sameGeometry(other)) return false;
+    for (size_t i = 0; i < shards.size(); i++) {
+        orWords(shards[i].bits->data(), other.shards[i].bits->data(), shards[i].bits->numWords());
+    }
+    recountSetBits();
+    return true;
+}
+
+bool ShardedBloomFilter::intersectWith(const ShardedBloomFilter& other) {
+    if (!sameGeometry(other)) return false;
+    for (size_t i = 0; i < shards.size(); i++) {
+        andWords(shards[i].bits->data(), other.shards[i].bits->data(), shards[i].bits->numWords());
+    }
+    recountSetBits();
+    return true;
+}
+
+size_t ShardedBloomFilter::countSetBits() const {
+    return setBits.load();
+}
+
+double ShardedBloomFilter::getFillRatio() const {
+    return static_cast<double>(countSetBits()) / getSize();
+}
+
+double ShardedBloomFilter::getFalsePositiveRateFromFill() const {
+    return pow(getFillRatio(), numHashes);
+}
+
+double ShardedBloomFilter::estimateCardinality() const {
+    // Shards fill evenly, so the whole-filter fill gives the same estimate as summing
+    // per-shard ones without a count per shard
+    return estimateItemsFromBits(getSize(), numHashes, countSetBits());
+}
+
+bool ShardedBloomFilter::saveToFile(const string& filename, bool compress) const {
+    BitStorage manifest(kManifestWords * BitStorage::kBitsPerWord);
+    manifest.storeWord(0, shards.size());
+    manifest.storeWord(1, shardSize);
+
+    return writeFileAtomically(filename, [&](ostream& out) {
+        if (!writeFilterFile(out, FilterKind::Sharded, WyHash::id, manifest.size(), numHashes, manifest)) {
+            return false;
+        }
+        for (const Shard& shard : shards) {
+            if (!writeFilterFile(out, FilterKind::Sharded, WyHash::id, shardSize, numHashes, *shard.bits, compress)) {
+                return false;
+            }
+        }
+        return true;
+    });
+}
+
+ShardedBloomFilter* ShardedBloomFilter::loadFromFile(const string& filename, const ShardPlacement& placement) {
+    ifstream inFile(filename, ios::binary);
+
+    if (!inFile.is_open()) {
+        return nullptr;
+    }
+
+    FilterFileHeader header;
+    if (!readFilterHeader(inFile, header) || header.kind != static_cast<uint32_t>(FilterKind::Sharded) ||
+        header.hashPolicy != static_cast<uint32_t>(WyHash::id) || header.numHashes == 0 ||
+        header.sizeBits != kManifestWords * BitStorage::kBitsPerWord) {
+        return nullptr;
+    }
+    BitStorage manifest(header.sizeBits);
+    if (!readFilterPayload(inFile, header, manifest)) {
+        return nullptr;
+    }
+
+    uint64_t shardCount = manifest.word(0);
+    uint64_t bitsPerShard = manifest.word(1);
+    unsigned int hashes = header.numHashes;
+    if (!isPowerOfTwo(shardCount) || shardCount > kMaxShards || bitsPerShard == 0) {
+        return nullptr;
+    }
+
+    // Nothing is allocated until the file can hold every shard: the first shard's header
+    // must match the manifest, and each shard takes at least a header plus one byte per
+    // snapshot container even when compressed
+    auto isShardHeader = [&](const FilterFileHeader& shardHeader) {
+        return shardHeader.kind == static_cast<uint32_t>(FilterKind::Sharded) &&
+               shardHeader.hashPolicy == static_cast<uint32_t>(WyHash::id) &&
+               shardHeader.sizeBits == bitsPerShard && shardHeader.numHashes == hashes;
+    };
+    streampos firstShard = inFile.tellg();
+    uint64_t minShardBytes = kFilterHeaderBytes + (bitsPerShard + kSnapshotContainerBits - 1) / kSnapshotContainerBits;
+    if (!readFilterHeader(inFile, header) || !isShardHeader(header)) {
+        return nullptr;
+    }
+    inFile.seekg(firstShard);
+    if (!streamHolds(inFile, shardCount * minShardBytes)) {
+        return nullptr;
+    }
+
+    try {
+        unique_ptr<ShardedBloomFilter> loaded(new ShardedBloomFilter(
+            bitsPerShard, hashes, static_cast<unsigned int>(shardCount), placement));
+        // Each shard is read straight into its placed memory
+        for (Shard& shard : loaded->shards) {
+            if (!readFilterHeader(inFile, header) || !isShardHeader(header) ||
+                !readFilterPayload(inFile, header, *shard.bits)) {
+                return nullptr;
+            }
+        }
+        loaded->recountSetBits();
+        return loaded.release();
+    } catch (const bad_alloc&) {
+        // The file is well-formed but larger than this machine's memory
+        return nullptr;
+    }
+}
@@ -0,0 +1,142 @@
+#ifndef SHARDED_BLOOM_FILTER_H
+#define SHARDED_BLOOM_FILTER_H
+
+#include "bit_storage.h"
+#include "hash_policy.h"
+#include "numa_memory.h"
+#include "sharded_counter.h"
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Where the shards of a ShardedBloomFilter live
+struct ShardPlacement {
+    // Shard i goes on nodes[i % nodes.size()]; empty spreads the shards round-robin
+    // over numaNodes(), so shard i is on the (i % nodeCount)-th node
+    std::vector<int> nodes;
+    // Back each shard with huge pages (MAP_HUGETLB, else transparent huge pages), so
+    // random probes into a multi-GB array do not miss the TLB on nearly every lookup
+    bool hugePages = true;
+};
+
+// Thread-safe Bloom filter split into independent shards, each placed on a NUMA node.
+// A key is routed by the top bits of its hash to one shard, and all k of its probes
+// land in that shard, so a lookup touches one node's memory only. Shards use relaxed
+// atomics like ConcurrentBloomFilter: any number of threads may insert and query.
+//
+// Keys are hashed with WyHash: routing needs well-mixed top bits, which the legacy
+// djb2/sdbm pair does not have for short keys. Probes within a shard use the low bits
+// (modulo, or a mask for power-of-two shards), independent of the routing bits.
+//
+// To keep lookups local, have a thread pinned to each node (pinToShard, or
+// pinThreadToNumaNode) and hand each key to the thread on nodeOf(key).
+//
+// Saved as one file: a Sharded manifest record (shard count, bits per shard) followed
+// by one Sharded record per shard, all in the versioned format. Placement is not part
+// of the file; a loaded filter is placed by the ShardPlacement given to loadFromFile.
+class ShardedBloomFilter {
+private:
+    struct Shard {
+        std::unique_ptr<AtomicBitStorage> bits;
+        int node;
+        PageBacking backing;
+    };
+
+    ShardPlacement placement;
+
+    std::vector<Shard> shards;
+    size_t shardSize;
+    unsigned int numHashes;
+    // log2 of the shard count
+    unsigned int shardShift;
+    bool powerOfTwo;
+
+    // Bits set, counted by the inserting threads on shards of their own
+    ShardedCounter setBits;
+
+    void recountSetBits();
+
+    size_t shardIndex(const HashPair& hp) const {
+        return shardShift ? static_cast<size_t>(hp.h1 >> (64 - shardShift)) : 0;
+    }
+
+    void insertHashed(const HashPair& hp);
+    bool containsHashed(const HashPair& hp) const;
+
+    bool sameGeometry(const ShardedBloomFilter& other) const;
+
+public:
+    // numShards shards of bitsPerShard bits each; numShards must be a power of two.
+    // Throws std::invalid_argument for a zero size, hash count or bad shard count.
+    ShardedBloomFilter(size_t bitsPerShard, unsigned int numHashFunctions, unsigned int numShards,
+                       const ShardPlacement& placement = ShardPlacement());
+
+    // Size the whole filter for expectedItems at falsePositiveRate and split it into
+    // numShards shards (0: one per NUMA node, rounded up to a power of two)
+    static ShardedBloomFilter createOptimal(size_t expectedItems, double falsePositiveRate,
+                                            unsigned int numShards = 0, bool roundToPowerOfTwo = false,
+                                            const ShardPlacement& placement = ShardPlacement());
+
+    // Insert an element; safe to call from many threads at once
+    void insert(std::string_view element);
+    void insert(const void* data, size_t len);
+    void insert(uint64_t key);
+
+    // Check if an element might be in the set; lock-free
+    bool mightContain(std::string_view element) const;
+    bool mightContain(const void* data, size_t len) const;
+    bool mightContain(uint64_t key) const;
+
+    // Batched paths: hash a window of keys and prefetch their words (in whichever
+    // shards they route to) before resolving any of them
+    void insertBatch(const std::string_view* elements, size_t count);
+    void mightContainBatch(const std::string_view* elements, size_t count, bool* results) const;
+
+    // Shard a key routes to, and the node that shard was placed on (-1 if unbound)
+    size_t shardOf(std::string_view element) const;
+    int nodeOf(std::string_view element) const;
+    int shardNode(size_t shard) const;
+    PageBacking shardPageBacking(size_t shard) const;
+
+    // Pin the calling thread to the CPUs of the shard's node; false if the shard is
+    // unbound or the affinity call fails
+    bool pinToShard(size_t shard) const;
+
+    // Get current false positive probability based on items inserted
+    double getCurrentFalsePositiveRate(size_t insertedItems) const;
+
+    // Total bits over every shard
+    size_t getSize() const;
+    size_t getShardSize() const;
+    size_t getShardCount() const;
+    unsigned int getNumHashes() const;
+
+    // Reset the filter; callers must make sure no inserts run concurrently
+    void clear();
+
+    // Empty filter with the same geometry and placement
+    std::unique_ptr<ShardedBloomFilter> emptyLike() const;
+
+    // OR / AND a filter of the same geometry into this one shard by shard; see
+    // ConcurrentBloomFilter for what racing inserts see. False on a mismatch.
+    bool unionWith(const ShardedBloomFilter& other);
+    bool intersectWith(const ShardedBloomFilter& other);
+
+    // Number of bits set (O(1), from the running count), the fill ratio and FPR it
+    // implies, and the item count estimated from it
+    size_t countSetBits() const;
+    double getFillRatio() const;
+    double getFalsePositiveRateFromFill() const;
+    double estimateCardinality() const;
+
+    // Save every shard to one file
+    bool saveToFile(const std::string& filename, bool compress = false) const;
+
+    // Load a file written by saveToFile, placing the shards as placement says; nullptr
+    // on failure
+    static ShardedBloomFilter* loadFromFile(const std::string& filename,
+                                            const ShardPlacement& placement = ShardPlacement());
+};
+
+#endif // SHARDED_BLOOM_FILTER_H
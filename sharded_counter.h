@@ -0,0 +1,46 @@
+#ifndef SHARDED_COUNTER_H
+#define SHARDED_COUNTER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Event counter spread over cache-line-sized shards, so threads counting at the same
+// time do not fight over one line. Each thread adds to the shard it was given on first
+// use with a relaxed fetch_add; load() sums the shards and is exact once the adds it
+// should see have returned.
+class ShardedCounter {
+public:
+    static constexpr size_t kShards = 16;
+
+    void add(uint64_t n) {
+        shards[shardIndex()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t load() const {
+        uint64_t total = 0;
+        for (const Shard& shard : shards) total += shard.value.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    // Replace the total; adds racing with it may be lost
+    void store(uint64_t total) {
+        shards[0].value.store(total, std::memory_order_relaxed);
+        for (size_t i = 1; i < kShards; i++) shards[i].value.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> value{0};
+    };
+
+    Shard shards[kShards];
+
+    static size_t shardIndex() {
+        static std::atomic<size_t> nextShard{0};
+        thread_local size_t index = nextShard.fetch_add(1, std::memory_order_relaxed) % kShards;
+        return index;
+    }
+};
+
+#endif // SHARDED_COUNTER_H
@@ -0,0 +1,385 @@
+#include "static_filter.h"
+#include "atomic_file.h"
+#include "hash_policy.h"
+#include "line_reader.h"
+#include "mapped_file.h"
+#include "probe_engine.h"
+#include "string_arena.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <memory>
+
+using namespace std;
+
+namespace {
+
+// Parameter block at the start of the payload: seed, item count, segment length,
+// segment count length, array length, three reserved words
+constexpr size_t kParameterWords = 8;
+constexpr unsigned int kArity = 3;
+constexpr uint32_t kMaxSegmentLength = 262144;
+constexpr int kMaxBuildAttempts = 100;
+
+inline uint64_t murmurMix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+inline uint64_t splitmix64(uint64_t& state) {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+inline uint8_t fingerprintOf(uint64_t hash) {
+    return static_cast<uint8_t>(hash ^ (hash >> 32));
+}
+
+inline uint64_t mulhi(uint64_t a, uint64_t b) {
+    return static_cast<uint64_t>((static_cast<__uint128_t>(a) * b) >> 64);
+}
+
+inline uint32_t mod3(uint8_t x) {
+    return x > 2 ? x - 3 : x;
+}
+
+// Layout of a fuse filter holding count keys
+struct FuseGeometry {
+    uint32_t segmentLength;
+    uint32_t segmentCountLength;
+    uint32_t arrayLength;
+};
+
+FuseGeometry fuseGeometry(uint64_t count) {
+    FuseGeometry geometry;
+    geometry.segmentLength = count == 0 ? 4 : uint32_t(1) << int(floor(log(double(count)) / log(3.33) + 2.25));
+    geometry.segmentLength = min(geometry.segmentLength, kMaxSegmentLength);
+
+    double sizeFactor = count <= 1 ? 0 : max(1.125, 0.875 + 0.25 * log(1000000.0) / log(double(count)));
+    uint64_t capacity = count <= 1 ? 0 : uint64_t(round(double(count) * sizeFactor));
+    // Unsigned wrap-around for tiny sets is intended and resolves to a single segment
+    uint64_t initSegmentCount = (capacity + geometry.segmentLength - 1) / geometry.segmentLength - (kArity - 1);
+    uint64_t arrayLength = (initSegmentCount + kArity - 1) * geometry.segmentLength;
+    uint64_t segmentCount = (arrayLength + geometry.segmentLength - 1) / geometry.segmentLength;
+    segmentCount = segmentCount <= kArity - 1 ? 1 : segmentCount - (kArity - 1);
+
+    geometry.arrayLength = static_cast<uint32_t>((segmentCount + kArity - 1) * geometry.segmentLength);
+    geometry.segmentCountLength = static_cast<uint32_t>(segmentCount * geometry.segmentLength);
+    return geometry;
+}
+
+size_t payloadWords(uint32_t arrayLength) {
+    return kParameterWords + (arrayLength + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+}
+
+bool isStaticHeader(const FilterFileHeader& header) {
+    return header.kind == static_cast<uint32_t>(FilterKind::BinaryFuse8) &&
+           header.hashPolicy == static_cast<uint32_t>(WyHash::id) &&
+           header.sizeBits % BitStorage::kBitsPerWord == 0 &&
+           header.sizeBits / BitStorage::kBitsPerWord > kParameterWords;
+}
+
+} // namespace
+
+StaticFilter::StaticFilter(BitStorage buffer)
+    : storage(move(buffer)), seed(0), itemCount(0), segmentLength(0), segmentLengthMask(0),
+      segmentCountLength(0), arrayLength(0) {
+}
+
+const uint8_t* StaticFilter::fingerprints() const {
+    return reinterpret_cast<const uint8_t*>(storage.data() + kParameterWords);
+}
+
+uint64_t StaticFilter::keyHash(const char* data, size_t len) const {
+    return murmurMix(WyHash::hash64(data, len) + seed);
+}
+
+void StaticFilter::fingerprintIndexes(uint64_t hash, uint32_t& h0, uint32_t& h1, uint32_t& h2) const {
+    uint64_t hi = mulhi(hash, segmentCountLength);
+    h0 = static_cast<uint32_t>(hi);
+    h1 = h0 + segmentLength;
+    h2 = h1 + segmentLength;
+    h1 ^= static_cast<uint32_t>(hash >> 18) & segmentLengthMask;
+    h2 ^= static_cast<uint32_t>(hash) & segmentLengthMask;
+}
+
+bool StaticFilter::loadParameters() {
+    if (storage.numWords() <= kParameterWords) return false;
+    uint64_t length = storage.word(2);
+    uint64_t countLength = storage.word(3);
+    uint64_t array = storage.word(4);
+    if (length < 4 || length > kMaxSegmentLength || (length & (length - 1)) != 0) return false;
+    if (countLength == 0 || countLength % length != 0 || array != countLength + (kArity - 1) * length) return false;
+    if (array > UINT32_MAX || storage.numWords() != payloadWords(static_cast<uint32_t>(array))) return false;
+
+    seed = storage.word(0);
+    itemCount = storage.word(1);
+    segmentLength = static_cast<uint32_t>(length);
+    segmentLengthMask = segmentLength - 1;
+    segmentCountLength = static_cast<uint32_t>(countLength);
+    arrayLength = static_cast<uint32_t>(array);
+    return true;
+}
+
+StaticFilter* StaticFilter::build(const string_view* keys, size_t count) {
+    // Fingerprint indexes are 32-bit
+    if (count > (uint64_t(UINT32_MAX) * 4) / 5) return nullptr;
+
+    FuseGeometry geometry = fuseGeometry(count);
+    unique_ptr<StaticFilter> filter(new StaticFilter(BitStorage(payloadWords(geometry.arrayLength) * BitStorage::kBitsPerWord)));
+    filter->segmentLength = geometry.segmentLength;
+    filter->segmentLengthMask = geometry.segmentLength - 1;
+    filter->segmentCountLength = geometry.segmentCountLength;
+    filter->arrayLength = geometry.arrayLength;
+
+    const size_t capacity = geometry.arrayLength;
+    vector<uint64_t> reverseOrder(count + 1, 0);
+    vector<uint32_t> alone(capacity);
+    vector<uint8_t> t2count(capacity, 0);
+    vector<uint8_t> reverseH(count);
+    vector<uint64_t> t2hash(capacity, 0);
+
+    // Keys are bucketed by segment before peeling so the working set stays cache-sized
+    uint64_t segmentCount = geometry.segmentCountLength / geometry.segmentLength;
+    unsigned int blockBits = 1;
+    while ((uint64_t(1) << blockBits) < segmentCount) blockBits++;
+    const size_t block = size_t(1) << blockBits;
+    vector<size_t> startPos(block);
+
+    // The hashes of the raw keys do not depend on the seed
+    vector<uint64_t> keyHashes(count);
+    for (size_t i = 0; i < count; i++) {
+        keyHashes[i] = WyHash::hash64(keys[i].data(), keys[i].size());
+    }
+
+    uint64_t rngState = 0x726b2b9d438b9d4dULL;
+    filter->seed = splitmix64(rngState);
+    reverseOrder[count] = 1;  // sentinel for the bucketing loop
+    size_t stackSize = 0;
+    size_t distinct = count;
+
+    for (int attempt = 0;; attempt++) {
+        if (attempt + 1 > kMaxBuildAttempts) return nullptr;
+
+        for (size_t i = 0; i < block; i++) {
+            startPos[i] = (i * count) >> blockBits;
+        }
+        for (size_t i = 0; i < count; i++) {
+            uint64_t hash = murmurMix(keyHashes[i] + filter->seed);
+            size_t segmentIndex = hash >> (64 - blockBits);
+            while (reverseOrder[startPos[segmentIndex]] != 0) {
+                segmentIndex = (segmentIndex + 1) & (block - 1);
+            }
+            reverseOrder[startPos[segmentIndex]] = hash;
+            startPos[segmentIndex]++;
+        }
+
+        bool failed = false;
+        size_t duplicates = 0;
+        for (size_t i = 0; i < count; i++) {
+            uint64_t hash = reverseOrder[i];
+            uint32_t h0, h1, h2;
+            filter->fingerprintIndexes(hash, h0, h1, h2);
+            t2count[h0] += 4;
+            t2hash[h0] ^= hash;
+            t2count[h1] += 4;
+            t2count[h1] ^= 1;
+            t2hash[h1] ^= hash;
+            t2count[h2] += 4;
+            t2count[h2] ^= 2;
+            t2hash[h2] ^= hash;
+            // Two copies of one key cancel out; undo the second so it is not peeled twice
+            if ((t2hash[h0] & t2hash[h1] & t2hash[h2]) == 0) {
+                if ((t2hash[h0] == 0 && t2count[h0] == 8) || (t2hash[h1] == 0 && t2count[h1] == 8) ||
+                    (t2hash[h2] == 0 && t2count[h2] == 8)) {
+                    duplicates++;
+                    t2count[h0] -= 4;
+                    t2hash[h0] ^= hash;
+                    t2count[h1] -= 4;
+                    t2count[h1] ^= 1;
+                    t2hash[h1] ^= hash;
+                    t2count[h2] -= 4;
+                    t2count[h2] ^= 2;
+                    t2hash[h2] ^= hash;
+                }
+            }
+            // A counter wrapped past 63 keys
+            failed |= t2count[h0] < 4 || t2count[h1] < 4 || t2count[h2] < 4;
+        }
+
+        if (!failed) {
+            // Peel: repeatedly take a slot touched by exactly one key
+            size_t queueSize = 0;
+            for (size_t i = 0; i < capacity; i++) {
+                alone[queueSize] = static_cast<uint32_t>(i);
+                queueSize += (t2count[i] >> 2) == 1 ? 1 : 0;
+            }
+            stackSize = 0;
+            while (queueSize > 0) {
+                uint32_t index = alone[--queueSize];
+                if ((t2count[index] >> 2) != 1) continue;
+
+                uint64_t hash = t2hash[index];
+                uint32_t h012[5];
+                filter->fingerprintIndexes(hash, h012[0], h012[1], h012[2]);
+                h012[3] = h012[0];
+                h012[4] = h012[1];
+                uint8_t found = t2count[index] & 3;
+                reverseH[stackSize] = found;
+                reverseOrder[stackSize] = hash;
+                stackSize++;
+
+                for (uint8_t step = 1; step <= 2; step++) {
+                    uint32_t other = h012[found + step];
+                    alone[queueSize] = other;
+                    queueSize += (t2count[other] >> 2) == 2 ? 1 : 0;
+                    t2count[other] -= 4;
+                    t2count[other] ^= mod3(found + step);
+                    t2hash[other] ^= hash;
+                }
+            }
+            if (stackSize + duplicates == count) {
+                distinct = stackSize;
+                break;
+            }
+        }
+
+        fill(reverseOrder.begin(), reverseOrder.end() - 1, 0);
+        fill(t2count.begin(), t2count.end(), 0);
+        fill(t2hash.begin(), t2hash.end(), 0);
+        filter->seed = splitmix64(rngState);
+    }
+
+    // Assign fingerprints in reverse peeling order so each key's three bytes xor to it
+    uint8_t* prints = reinterpret_cast<uint8_t*>(filter->storage.data() + kParameterWords);
+    for (size_t i = stackSize; i-- > 0;) {
+        uint64_t hash = reverseOrder[i];
+        uint32_t h012[5];
+        filter->fingerprintIndexes(hash, h012[0], h012[1], h012[2]);
+        h012[3] = h012[0];
+        h012[4] = h012[1];
+        uint8_t found = reverseH[i];
+        prints[h012[found]] = fingerprintOf(hash) ^ prints[h012[found + 1]] ^ prints[h012[found + 2]];
+    }
+
+    filter->itemCount = distinct;
+    filter->storage.storeWord(0, filter->seed);
+    filter->storage.storeWord(1, filter->itemCount);
+    filter->storage.storeWord(2, filter->segmentLength);
+    filter->storage.storeWord(3, filter->segmentCountLength);
+    filter->storage.storeWord(4, filter->arrayLength);
+    return filter.release();
+}
+
+StaticFilter* StaticFilter::build(const vector<string>& keys) {
+    vector<string_view> views(keys.begin(), keys.end());
+    return build(views.data(), views.size());
+}
+
+StaticFilter* StaticFilter::buildFromFile(const string& filename) {
+    // The build needs every key at once; intern them so only the views are per-key
+    StringArena arena;
+    vector<string_view> keys;
+    bool ok = forEachLineBatch(filename, [&](const string_view* lines, size_t count) {
+        for (size_t i = 0; i < count; i++) keys.push_back(arena.intern(lines[i]));
+    });
+    if (!ok) return nullptr;
+    return build(keys.data(), keys.size());
+}
+
+bool StaticFilter::mightContain(string_view element) const {
+    uint64_t hash = keyHash(element.data(), element.size());
+    uint32_t h0, h1, h2;
+    fingerprintIndexes(hash, h0, h1, h2);
+    const uint8_t* prints = fingerprints();
+    return (fingerprintOf(hash) ^ prints[h0] ^ prints[h1] ^ prints[h2]) == 0;
+}
+
+void StaticFilter::mightContainBatch(const string_view* elements, size_t count, bool* results) const {
+    const uint8_t* prints = fingerprints();
+    uint64_t hashes[kBatchWindow];
+    for (size_t base = 0; base < count; base += kBatchWindow) {
+        size_t n = min(kBatchWindow, count - base);
+        for (size_t j = 0; j < n; j++) {
+            hashes[j] = keyHash(elements[base + j].data(), elements[base + j].size());
+            uint32_t h0, h1, h2;
+            fingerprintIndexes(hashes[j], h0, h1, h2);
+            __builtin_prefetch(&prints[h0], 0);
+            __builtin_prefetch(&prints[h1], 0);
+            __builtin_prefetch(&prints[h2], 0);
+        }
+        for (size_t j = 0; j < n; j++) {
+            uint32_t h0, h1, h2;
+            fingerprintIndexes(hashes[j], h0, h1, h2);
+            results[base + j] = (fingerprintOf(hashes[j]) ^ prints[h0] ^ prints[h1] ^ prints[h2]) == 0;
+        }
+    }
+}
+
+double StaticFilter::getFalsePositiveRate() const {
+    return 1.0 / (1u << kFingerprintBits);
+}
+
+size_t StaticFilter::getItemCount() const {
+    return itemCount;
+}
+
+size_t StaticFilter::getSize() const {
+    return size_t(arrayLength) * kFingerprintBits;
+}
+
+bool StaticFilter::saveToFile(const string& filename) const {
+    return writeFileAtomically(filename, [this](ostream& out) {
+        return writeFilterFile(out, FilterKind::BinaryFuse8, WyHash::id, storage.size(), kArity, storage);
+    });
+}
+
+StaticFilter* StaticFilter::loadFromFile(const string& filename) {
+    ifstream inFile(filename, ios::binary);
+
+    if (!inFile.is_open()) {
+        return nullptr;
+    }
+
+    FilterFileHeader header;
+    if (!readFilterHeader(inFile, header) || !isStaticHeader(header)) {
+        return nullptr;
+    }
+
+    unique_ptr<StaticFilter> loaded(new StaticFilter(BitStorage(header.sizeBits)));
+    if (!readFilterPayload(inFile, header, loaded->storage) || !loaded->loadParameters()) {
+        return nullptr;
+    }
+    return loaded.release();
+}
+
+StaticFilter* StaticFilter::openMapped(const string& filename, bool verifyChecksum) {
+    shared_ptr<MappedFile> mapping = MappedFile::open(filename);
+    if (!mapping || mapping->size() < kFilterHeaderBytes) {
+        return nullptr;
+    }
+
+    FilterFileHeader header;
+    memcpy(&header, mapping->data(), sizeof(header));
+    if (!validateFilterHeader(header) || !isStaticHeader(header)) {
+        return nullptr;
+    }
+    if (!validateMappedRecord(mapping->data(), mapping->size(), header, verifyChecksum)) {
+        return nullptr;
+    }
+
+    unsigned char* payload = mapping->mutableData() + kFilterHeaderBytes;
+    BitStorage view = BitStorage::view(reinterpret_cast<uint64_t*>(payload), header.sizeBits, mapping);
+    unique_ptr<StaticFilter> mapped(new StaticFilter(move(view)));
+    if (!mapped->loadParameters()) {
+        return nullptr;
+    }
+    return mapped.release();
+}
@@ -0,0 +1,76 @@
+#ifndef STATIC_FILTER_H
+#define STATIC_FILTER_H
+
+#include "bit_storage.h"
+#include "filter_format.h"
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Immutable membership filter for sets that are built once and never modified:
+// a binary fuse filter with 8-bit fingerprints (Graf & Lemire, "Binary Fuse Filters").
+// About 9 bits per key for a 1/256 (0.39%) false positive rate, where a Bloom filter
+// needs about 11.5, and every lookup reads exactly three bytes.
+//
+// Saved in the versioned format (kind BinaryFuse8, WyHash keys). The payload is a
+// 64-byte parameter block followed by the fingerprint array, so openMapped can probe
+// a file in place just like BloomFilter::openMapped.
+class StaticFilter {
+private:
+    // Parameters and fingerprints live in one aligned buffer (or a file mapping)
+    BitStorage storage;
+    uint64_t seed;
+    uint64_t itemCount;
+    uint32_t segmentLength;
+    uint32_t segmentLengthMask;
+    uint32_t segmentCountLength;
+    uint32_t arrayLength;
+
+    StaticFilter(BitStorage buffer);
+
+    const uint8_t* fingerprints() const;
+    uint64_t keyHash(const char* data, size_t len) const;
+    void fingerprintIndexes(uint64_t hash, uint32_t& h0, uint32_t& h1, uint32_t& h2) const;
+
+    // Recompute the derived fields from the parameter block
+    bool loadParameters();
+
+public:
+    static constexpr unsigned int kFingerprintBits = 8;
+
+    // Build from keys; duplicates are allowed. nullptr if construction fails, which
+    // only happens for pathological inputs after many reseeds.
+    static StaticFilter* build(const std::string_view* keys, size_t count);
+    static StaticFilter* build(const std::vector<std::string>& keys);
+
+    // Build from a newline-separated list file (empty lines are skipped, as in
+    // addFilesFromList); nullptr if the file cannot be read or the build fails
+    static StaticFilter* buildFromFile(const std::string& filename);
+
+    // Check if an element might be in the set
+    bool mightContain(std::string_view element) const;
+
+    // Check many elements at once; the three fingerprint bytes of a window of keys are
+    // prefetched before any is compared
+    void mightContainBatch(const std::string_view* elements, size_t count, bool* results) const;
+
+    // False positive probability (independent of fill)
+    double getFalsePositiveRate() const;
+
+    // Number of distinct keys the filter was built from
+    size_t getItemCount() const;
+
+    // Fingerprint array size in bits
+    size_t getSize() const;
+
+    // Save to a file in the versioned format
+    bool saveToFile(const std::string& filename) const;
+
+    // Load a file written by saveToFile
+    static StaticFilter* loadFromFile(const std::string& filename);
+
+    // Map a file and query it in place (see BloomFilter::openMapped)
+    static StaticFilter* openMapped(const std::string& filename, bool verifyChecksum = false);
+};
+
+#endif // STATIC_FILTER_H
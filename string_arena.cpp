@@ -0,0 +1,41 @@
+#include "string_arena.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace {
+
+constexpr size_t kFirstBlockBytes = 4096;
+constexpr size_t kMaxBlockBytes = 1 << 20;
+
+} // namespace
+
+char* StringArena::allocate(size_t bytes) {
+    if (blocks.empty() || blocks.back().capacity - blocks.back().used < bytes) {
+        size_t capacity = blocks.empty() ? kFirstBlockBytes : min(blocks.back().capacity * 2, kMaxBlockBytes);
+        capacity = max(capacity, bytes);
+        blocks.push_back(Block{unique_ptr<char[]>(new char[capacity]), 0, capacity});
+    }
+
+    Block& block = blocks.back();
+    char* result = block.bytes.get() + block.used;
+    block.used += bytes;
+    return result;
+}
+
+string_view StringArena::intern(string_view text) {
+    char* copy = allocate(text.size());
+    if (!text.empty()) memcpy(copy, text.data(), text.size());
+    return string_view(copy, text.size());
+}
+
+size_t StringArena::capacityBytes() const {
+    size_t bytes = 0;
+    for (const Block& block : blocks) bytes += block.capacity;
+    return bytes;
+}
+
+void StringArena::clear() {
+    blocks.clear();
+}
@@ -0,0 +1,45 @@
+#ifndef STRING_ARENA_H
+#define STRING_ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Monotonic arena for string bytes.
+// Allocations are carved from blocks that double from 4 KiB up to 1 MiB (larger
+// requests get a block of their own) and are only released all at once, so interning
+// a key costs a pointer bump and a memcpy instead of a heap allocation. Returned
+// pointers stay valid until clear() or destruction, including across moves.
+class StringArena {
+private:
+    struct Block {
+        std::unique_ptr<char[]> bytes;
+        size_t used;
+        size_t capacity;
+    };
+
+    std::vector<Block> blocks;
+
+public:
+    // Uninitialized space for bytes bytes
+    char* allocate(size_t bytes);
+
+    // Copy of text that lives as long as the arena
+    std::string_view intern(std::string_view text);
+
+    // Bytes reserved by all blocks
+    size_t capacityBytes() const;
+
+    void clear();
+
+    // Visit the filled part of each block in allocation order as visit(data, used)
+    template <typename Visit>
+    void forEachBlock(Visit visit) const {
+        for (const Block& block : blocks) {
+            visit(static_cast<const char*>(block.bytes.get()), block.used);
+        }
+    }
+};
+
+#endif // STRING_ARENA_H
@@ -0,0 +1,234 @@
+#include "word_ops.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BLOOM_X86 1
+#endif
+
+using namespace std;
+
+namespace {
+
+// Chunks handed to threads are multiples of a cache line of words
+constexpr size_t kChunkAlignWords = 8;
+
+// Each thread gets at least this many words
+constexpr size_t kMinWordsPerThread = kParallelWords / 2;
+
+using CombineKernel = void (*)(uint64_t* dst, const uint64_t* src, size_t count);
+using PopcountKernel = uint64_t (*)(const uint64_t* words, size_t count);
+
+void orScalar(uint64_t* dst, const uint64_t* src, size_t count) {
+    for (size_t i = 0; i < count; i++) dst[i] |= src[i];
+}
+
+void andScalar(uint64_t* dst, const uint64_t* src, size_t count) {
+    for (size_t i = 0; i < count; i++) dst[i] &= src[i];
+}
+
+uint64_t popcountScalar(const uint64_t* words, size_t count) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < count; i++) total += __builtin_popcountll(words[i]);
+    return total;
+}
+
+#ifdef BLOOM_X86
+
+__attribute__((target("avx2")))
+void orAvx2(uint64_t* dst, const uint64_t* src, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_or_si256(a, b));
+    }
+    orScalar(dst + i, src + i, count - i);
+}
+
+__attribute__((target("avx2")))
+void andAvx2(uint64_t* dst, const uint64_t* src, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_and_si256(a, b));
+    }
+    andScalar(dst + i, src + i, count - i);
+}
+
+// Nibble-lookup popcount (Mula): per-byte counts from two shuffles, summed with SAD
+__attribute__((target("avx2")))
+uint64_t popcountAvx2(const uint64_t* words, size_t count) {
+    const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                           0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i lowNibbles = _mm256_set1_epi8(0x0f);
+    __m256i totals = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i));
+        __m256i low = _mm256_shuffle_epi8(table, _mm256_and_si256(v, lowNibbles));
+        __m256i high = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), lowNibbles));
+        totals = _mm256_add_epi64(totals, _mm256_sad_epu8(_mm256_add_epi8(low, high), _mm256_setzero_si256()));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), totals);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + popcountScalar(words + i, count - i);
+}
+
+__attribute__((target("avx512f")))
+void orAvx512(uint64_t* dst, const uint64_t* src, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m512i a = _mm512_loadu_si512(dst + i);
+        __m512i b = _mm512_loadu_si512(src + i);
+        _mm512_storeu_si512(dst + i, _mm512_or_si512(a, b));
+    }
+    orScalar(dst + i, src + i, count - i);
+}
+
+__attribute__((target("avx512f")))
+void andAvx512(uint64_t* dst, const uint64_t* src, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m512i a = _mm512_loadu_si512(dst + i);
+        __m512i b = _mm512_loadu_si512(src + i);
+        _mm512_storeu_si512(dst + i, _mm512_and_si512(a, b));
+    }
+    andScalar(dst + i, src + i, count - i);
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+uint64_t popcountAvx512(const uint64_t* words, size_t count) {
+    __m512i totals = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        totals = _mm512_add_epi64(totals, _mm512_popcnt_epi64(_mm512_loadu_si512(words + i)));
+    }
+    uint64_t lanes[8];
+    _mm512_storeu_si512(lanes, totals);
+    uint64_t total = 0;
+    for (uint64_t lane : lanes) total += lane;
+    return total + popcountScalar(words + i, count - i);
+}
+
+#endif
+
+struct WordKernels {
+    CombineKernel orKernel = &orScalar;
+    CombineKernel andKernel = &andScalar;
+    PopcountKernel popcountKernel = &popcountScalar;
+};
+
+const WordKernels& wordKernels() {
+    static const WordKernels kernels = []() {
+        WordKernels selected;
+#ifdef BLOOM_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            selected.orKernel = &orAvx2;
+            selected.andKernel = &andAvx2;
+            selected.popcountKernel = &popcountAvx2;
+        }
+        if (__builtin_cpu_supports("avx512f")) {
+            selected.orKernel = &orAvx512;
+            selected.andKernel = &andAvx512;
+            if (__builtin_cpu_supports("avx512vpopcntdq")) selected.popcountKernel = &popcountAvx512;
+        }
+#endif
+        return selected;
+    }();
+    return kernels;
+}
+
+unsigned int threadsFor(size_t count) {
+    if (count < kParallelWords) return 1;
+    unsigned int hardware = max(1u, thread::hardware_concurrency());
+    return static_cast<unsigned int>(min<size_t>(hardware, count / kMinWordsPerThread));
+}
+
+// Sum of fn(begin, end) over the chunks of [0, count)
+template <typename Fn>
+uint64_t sumWordRanges(size_t count, Fn fn) {
+    unsigned int threads = threadsFor(count);
+    if (threads <= 1) return fn(0, count);
+    vector<uint64_t> partial(threads, 0);
+    forEachWordRange(count, [&](size_t begin, size_t end) {
+        size_t index = begin / ((count + threads - 1) / threads);
+        partial[min<size_t>(index, threads - 1)] += fn(begin, end);
+    });
+    uint64_t total = 0;
+    for (uint64_t value : partial) total += value;
+    return total;
+}
+
+} // namespace
+
+void forEachWordRange(size_t count, const function<void(size_t, size_t)>& fn) {
+    unsigned int threads = threadsFor(count);
+    if (threads <= 1) {
+        fn(0, count);
+        return;
+    }
+    // Chunk boundaries fall on cache lines so no two threads write the same line
+    size_t chunk = (count + threads - 1) / threads;
+    chunk = (chunk + kChunkAlignWords - 1) / kChunkAlignWords * kChunkAlignWords;
+    vector<thread> pool;
+    for (size_t begin = chunk; begin < count; begin += chunk) {
+        pool.emplace_back([&fn, begin, chunk, count]() { fn(begin, min(begin + chunk, count)); });
+    }
+    fn(0, min(chunk, count));
+    for (auto& th : pool) th.join();
+}
+
+void orWords(uint64_t* dst, const uint64_t* src, size_t count) {
+    CombineKernel kernel = wordKernels().orKernel;
+    forEachWordRange(count, [=](size_t begin, size_t end) { kernel(dst + begin, src + begin, end - begin); });
+}
+
+void andWords(uint64_t* dst, const uint64_t* src, size_t count) {
+    CombineKernel kernel = wordKernels().andKernel;
+    forEachWordRange(count, [=](size_t begin, size_t end) { kernel(dst + begin, src + begin, end - begin); });
+}
+
+uint64_t popcountWords(const uint64_t* words, size_t count) {
+    PopcountKernel kernel = wordKernels().popcountKernel;
+    return sumWordRanges(count, [=](size_t begin, size_t end) { return kernel(words + begin, end - begin); });
+}
+
+void orWords(atomic<uint64_t>* dst, const atomic<uint64_t>* src, size_t count) {
+    forEachWordRange(count, [=](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            uint64_t bits = src[i].load(memory_order_relaxed);
+            // Skip the locked RMW when nothing would change
+            if (bits & ~dst[i].load(memory_order_relaxed)) dst[i].fetch_or(bits, memory_order_relaxed);
+        }
+    });
+}
+
+void andWords(atomic<uint64_t>* dst, const atomic<uint64_t>* src, size_t count) {
+    forEachWordRange(count, [=](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            uint64_t bits = src[i].load(memory_order_relaxed);
+            if (~bits & dst[i].load(memory_order_relaxed)) dst[i].fetch_and(bits, memory_order_relaxed);
+        }
+    });
+}
+
+uint64_t popcountWords(const atomic<uint64_t>* words, size_t count) {
+    return sumWordRanges(count, [=](size_t begin, size_t end) {
+        uint64_t total = 0;
+        for (size_t i = begin; i < end; i++) total += __builtin_popcountll(words[i].load(memory_order_relaxed));
+        return total;
+    });
+}
+
+double estimateItemsFromBits(size_t bits, unsigned int numHashes, uint64_t setBits) {
+    if (bits == 0 || numHashes == 0) return 0.0;
+    double m = static_cast<double>(bits);
+    double x = min(static_cast<double>(setBits), m - 1);
+    return -(m / numHashes) * log1p(-x / m);
+}
@@ -0,0 +1,36 @@
+#ifndef WORD_OPS_H
+#define WORD_OPS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// Bulk word-wise kernels over bit arrays of equal length: OR, AND and popcount.
+// The plain-word versions use AVX-512 (with VPOPCNTDQ for popcount) or AVX2 when the
+// CPU has them, chosen once at runtime from cpuid like the blocked probe kernels.
+// Arrays of kParallelWords or more are split across hardware threads.
+
+constexpr size_t kParallelWords = size_t(1) << 20;
+
+void orWords(uint64_t* dst, const uint64_t* src, size_t count);
+void andWords(uint64_t* dst, const uint64_t* src, size_t count);
+uint64_t popcountWords(const uint64_t* words, size_t count);
+
+// Atomic-word versions for shared filters: relaxed fetch_or / fetch_and per word, so
+// they are safe against concurrent inserts and readers. An AND that races an insert
+// may clear the inserted bits.
+void orWords(std::atomic<uint64_t>* dst, const std::atomic<uint64_t>* src, size_t count);
+void andWords(std::atomic<uint64_t>* dst, const std::atomic<uint64_t>* src, size_t count);
+uint64_t popcountWords(const std::atomic<uint64_t>* words, size_t count);
+
+// Run fn(begin, end) over [0, count) in cache-line-aligned chunks, on several threads
+// when count reaches kParallelWords; returns once every chunk is done
+void forEachWordRange(size_t count, const std::function<void(size_t begin, size_t end)>& fn);
+
+// Swamidass-Baldi estimate of the items in a Bloom filter of bits bits and numHashes
+// hash functions with setBits of them set: n = -(m / k) ln(1 - X / m). A saturated
+// filter reports the estimate for X = m - 1, the largest the bit count can express.
+double estimateItemsFromBits(size_t bits, unsigned int numHashes, uint64_t setBits);
+
+#endif // WORD_OPS_H